@@ -0,0 +1,55 @@
+#include "sketch/sparse.h"
+#include <chrono>
+#include <random>
+
+using clk = std::chrono::high_resolution_clock;
+using namespace sketch;
+
+static double since(clk::time_point t) {return std::chrono::duration<double>(clk::now() - t).count();}
+
+// Many per-key sketches with mostly small, heavy-tailed cardinalities: memory, insertion time
+// and pairwise Jaccard time for AdaptiveHLL against always-dense HLLs of the same precision.
+int main(int argc, char **argv) {
+    const size_t nsketches = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 20000;
+    const int p = argc > 2 ? std::atoi(argv[2]): 14;
+    std::mt19937_64 mt(13);
+    std::lognormal_distribution<double> sizes(4., 1.5);
+    std::vector<std::vector<uint64_t>> keys(nsketches);
+    size_t nkeys = 0;
+    for(auto &k: keys) {
+        k.resize(std::min(size_t(sizes(mt)) + 1, size_t(1) << 20));
+        for(auto &x: k) x = mt() % (size_t(1) << 22);
+        nkeys += k.size();
+    }
+    auto t = clk::now();
+    std::vector<sparse::AdaptiveHLL<>> adaptive;
+    adaptive.reserve(nsketches);
+    for(const auto &k: keys) {
+        adaptive.emplace_back(p);
+        adaptive.back().addh_batch(k.data(), k.size());
+        adaptive.back().compact();
+    }
+    const double at = since(t);
+    t = clk::now();
+    std::vector<hll::hll_t> dense;
+    dense.reserve(nsketches);
+    for(const auto &k: keys) {
+        dense.emplace_back(p);
+        dense.back().addh_batch(k.data(), k.size());
+    }
+    const double dt = since(t);
+    size_t abytes = 0, dbytes = 0, nsparse = 0;
+    for(const auto &a: adaptive) abytes += a.est_memory_usage().first + a.est_memory_usage().second, nsparse += a.is_sparse();
+    for(const auto &d: dense) dbytes += d.est_memory_usage().first + d.est_memory_usage().second;
+    std::fprintf(stderr, "%zu sketches, %zu keys, %zu still sparse. Memory: adaptive %g MB, dense %g MB (%gx). Build: adaptive %g ns/key, dense %g ns/key\n",
+                 nsketches, nkeys, nsparse, abytes * 1e-6, dbytes * 1e-6, double(dbytes) / abytes, at * 1e9 / nkeys, dt * 1e9 / nkeys);
+    const size_t npairs = std::min(size_t(20000), nsketches - 1);
+    double asum = 0., dsum = 0.;
+    t = clk::now();
+    for(size_t i = 0; i < npairs; ++i) asum += adaptive[i].jaccard_index(adaptive[i + 1]);
+    const double aj = since(t);
+    t = clk::now();
+    for(size_t i = 0; i < npairs; ++i) dsum += dense[i].jaccard_index(dense[i + 1]);
+    const double dj = since(t);
+    std::fprintf(stderr, "Jaccard over %zu adjacent pairs: adaptive %g us/pair, dense %g us/pair (mean %g vs %g)\n", npairs, aj * 1e6 / npairs, dj * 1e6 / npairs, asum / npairs, dsum / npairs);
+}
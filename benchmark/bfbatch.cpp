@@ -0,0 +1,41 @@
+#include "sketch/bf.h"
+#include "sketch/cbf.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+// Lookup throughput of one-at-a-time may_contain against the prefetching may_contain_batch on filters larger than cache.
+template<typename Filter>
+void measure(const char *name, const Filter &f, const std::vector<uint64_t> &q) {
+    std::vector<uint8_t> out(q.size());
+    auto t = clk::now();
+    size_t hits = 0;
+    for(const auto v: q) hits += f.may_contain(v);
+    const double loop_ns = std::chrono::duration<double, std::nano>(clk::now() - t).count() / q.size();
+    t = clk::now();
+    f.may_contain_batch(q.data(), q.size(), out.data());
+    const double batch_ns = std::chrono::duration<double, std::nano>(clk::now() - t).count() / q.size();
+    const size_t bhits = std::accumulate(out.begin(), out.end(), size_t(0));
+    std::fprintf(stderr, "%s\t%g\t%g\t%g\t%s\n", name, loop_ns, batch_ns, loop_ns / batch_ns, hits == bhits ? "match": "MISMATCH");
+}
+
+int main(int argc, char **argv) {
+    const unsigned l2sz = argc > 1 ? std::atoi(argv[1]): 30;
+    const size_t nq = argc > 2 ? std::strtoull(argv[2], nullptr, 10): 4000000;
+    const size_t n = (size_t(1) << l2sz) / 16;
+    std::vector<uint64_t> q(nq);
+    // Half present, half absent
+    for(size_t i = 0; i < nq; ++i) q[i] = hash::WangHash::hash(i % 2 ? i / 2: n + i);
+    std::fprintf(stderr, "#filter\tloop ns/key\tbatch ns/key\tspeedup\n");
+    {
+        bf::bf_t f(l2sz, 11, 137);
+        for(size_t i = 0; i < n; ++i) f.addh(hash::WangHash::hash(i));
+        measure("bf_t", f, q);
+    }
+    {
+        bf::blockedbf_t f(l2sz);
+        for(size_t i = 0; i < n; ++i) f.addh(hash::WangHash::hash(i));
+        measure("blockedbf_t", f, q);
+    }
+}
@@ -0,0 +1,30 @@
+#include "sketch/bf.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+// False positive rate and lookup latency of the split-block Bloom filter against bf_t at equal memory.
+template<typename Filter>
+std::pair<double, double> measure(Filter &f, size_t n, size_t nq) {
+    for(size_t i = 0; i < n; ++i) f.addh(hash::WangHash::hash(i));
+    size_t fp = 0;
+    auto t = clk::now();
+    for(size_t i = 0; i < nq; ++i) fp += f.may_contain(hash::WangHash::hash(i + n));
+    const double ns = std::chrono::duration<double, std::nano>(clk::now() - t).count() / nq;
+    return {double(fp) / nq, ns};
+}
+
+int main(int argc, char **argv) {
+    const unsigned l2sz = argc > 1 ? std::atoi(argv[1]): 27;
+    const size_t nq = argc > 2 ? std::strtoull(argv[2], nullptr, 10): 2000000;
+    std::fprintf(stderr, "#bits/key\tkeys\tbf_t k\tbf_t FPR\tbf_t ns\tblocked FPR\tblocked est FPR\tblocked ns\n");
+    for(const unsigned bpk: {8u, 12u, 16u, 24u}) {
+        const size_t n = (size_t(1) << l2sz) / bpk;
+        const unsigned k = std::max(1., std::round(bpk * M_LN2));
+        bf::bf_t classic(l2sz, k, 137);
+        bf::blockedbf_t blocked(l2sz);
+        const auto c = measure(classic, n, nq), b = measure(blocked, n, nq);
+        std::fprintf(stderr, "%u\t%zu\t%u\t%g\t%g\t%g\t%g\t%g\n", bpk, n, k, c.first, c.second, b.first, blocked.est_err(), b.second);
+    }
+}
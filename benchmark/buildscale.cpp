@@ -0,0 +1,31 @@
+#include "sketch/build.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+// Strong scaling of parallel_build: time to sketch the same keys as the thread count doubles.
+template<typename Factory>
+void run(const char *name, const std::vector<uint64_t> &keys, unsigned maxthreads, const Factory &factory) {
+    auto t = clk::now();
+    const auto serial = build::parallel_build(keys, factory, 1, 1);
+    const double base = std::chrono::duration<double>(clk::now() - t).count();
+    for(unsigned nt = 1; nt <= maxthreads; nt <<= 1) {
+        t = clk::now();
+        const auto par = build::parallel_build(keys, factory, nt);
+        const double secs = std::chrono::duration<double>(clk::now() - t).count();
+        std::fprintf(stderr, "%s\t%u\t%g\t%g\t%g\t%s\n", name, nt, secs, keys.size() / secs * 1e-6, base / secs, par == serial ? "match": "MISMATCH");
+    }
+}
+
+int main(int argc, char **argv) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 50000000;
+    const unsigned maxthreads = argc > 2 ? std::atoi(argv[2]): std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = hash::WangHash::hash(i);
+    std::fprintf(stderr, "#sketch\tthreads\tseconds\tMkeys/s\tspeedup\n");
+    run("SetSketch<uint16_t>", keys, maxthreads, []() {return setsketch::SetSketch<uint16_t>(1024, 1.001, 30., 65534);});
+    run("CSetSketch<double>", keys, maxthreads, []() {return setsketch::CSetSketch<double>(1024);});
+    run("hll_t", keys, maxthreads, []() {return hll::hll_t(14);});
+    run("BBitMinHasher<uint64_t>", keys, maxthreads, []() {return minhash::BBitMinHasher<uint64_t>(10, 32);});
+}
@@ -0,0 +1,43 @@
+#include "sketch/ccm.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+// Update and query throughput of item-at-a-time add/est_count against add_batch/est_count_batch on tables larger than cache.
+template<typename Sketch>
+void measure(const char *name, Sketch &&looped, Sketch &&batched, const std::vector<uint64_t> &items) {
+    auto ns_per = [&](auto t) {return std::chrono::duration<double, std::nano>(clk::now() - t).count() / items.size();};
+    auto t = clk::now();
+    for(const auto v: items) looped.addh(v);
+    const double loop_add = ns_per(t);
+    t = clk::now();
+    batched.add_batch(items.data(), items.size());
+    const double batch_add = ns_per(t);
+    uint64_t total = 0;
+    t = clk::now();
+    for(const auto v: items) total += looped.est_count(v);
+    const double loop_est = ns_per(t);
+    std::vector<uint64_t> ests(items.size());
+    t = clk::now();
+    batched.est_count_batch(items.data(), items.size(), ests.data());
+    const double batch_est = ns_per(t);
+    const bool match = total == std::accumulate(ests.begin(), ests.end(), uint64_t(0));
+    std::fprintf(stderr, "%s\t%g\t%g\t%g\t%g\t%s\n", name, loop_add, batch_add, loop_est, batch_est, match ? "match": "MISMATCH");
+}
+
+int main(int argc, char **argv) {
+    const int l2sz = argc > 1 ? std::atoi(argv[1]): 24;
+    const size_t n = argc > 2 ? std::strtoull(argv[2], nullptr, 10): 4000000;
+    const int nhashes = 4;
+    std::vector<uint64_t> items(n);
+    std::mt19937_64 mt(13);
+    for(auto &i: items) i = mt() % (n / 4);
+    std::fprintf(stderr, "#sketch\tloop add ns\tbatch add ns\tloop est ns\tbatch est ns\n");
+    measure("ccm_t", cm::ccm_t(16, l2sz, nhashes), cm::ccm_t(16, l2sz, nhashes), items);
+    measure("pccm_t", cm::pccm_t(6, l2sz, nhashes), cm::pccm_t(6, l2sz, nhashes), items);
+    using Flat = cm::ccmbase_t<update::Increment, std::vector<uint32_t, Allocator<uint32_t>>>;
+    measure("ccm uint32", Flat(32, l2sz, nhashes), Flat(32, l2sz, nhashes), items);
+    using CountSketch = cm::ccmbase_t<update::CountSketch, std::vector<int32_t, Allocator<int32_t>>, hash::WangHash, false>;
+    measure("countsketch", CountSketch(32, l2sz, nhashes), CountSketch(32, l2sz, nhashes), items);
+}
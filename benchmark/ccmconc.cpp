@@ -0,0 +1,54 @@
+#include "sketch/ccm.h"
+#include <chrono>
+#include <thread>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+using Concurrent = cm::ccmbase_t<update::Increment, std::vector<uint32_t, Allocator<uint32_t>>>;
+
+template<typename F>
+double timed_run(unsigned nthreads, const F &func) {
+    std::vector<std::thread> threads;
+    auto t = clk::now();
+    for(unsigned tid = 0; tid < nthreads; ++tid) threads.emplace_back(func, tid);
+    for(auto &th: threads) th.join();
+    return std::chrono::duration<double>(clk::now() - t).count();
+}
+
+// Conservative-update throughput scaling: one shared table (strict and relaxed CAS updates)
+// vs one sketch per thread merged at the end, which costs nthreads times the memory.
+int main(int argc, char **argv) {
+    const int l2sz = argc > 1 ? std::atoi(argv[1]): 20;
+    const size_t n = argc > 2 ? std::strtoull(argv[2], nullptr, 10): size_t(1) << 25;
+    const unsigned maxthreads = argc > 3 ? std::atoi(argv[3]): 64;
+    const int nhashes = 4;
+    std::vector<uint64_t> items(n);
+    std::mt19937_64 mt(13);
+    for(auto &i: items) i = (mt() & 1) ? mt() % 1024: mt() % (n / 4); // Half the updates hit 1024 hot keys
+    std::fprintf(stderr, "#threads\tstrict Mupd/s\trelaxed Mupd/s\tper-thread+merge Mupd/s\tstrict overcount\trelaxed undercount\n");
+    for(unsigned nt = 1; nt <= maxthreads; nt <<= 1) {
+        const size_t per = (n + nt - 1) / nt;
+        Concurrent strict(32, l2sz, nhashes), relaxed(32, l2sz, nhashes);
+        std::vector<Concurrent> local;
+        for(unsigned i = 0; i < nt; ++i) local.emplace_back(32, l2sz, nhashes);
+        const double st = timed_run(nt, [&](unsigned tid) {
+            for(size_t i = tid * per, e = std::min(n, i + per); i < e; strict.add_concurrent(items[i++]));
+        });
+        const double rt = timed_run(nt, [&](unsigned tid) {
+            for(size_t i = tid * per, e = std::min(n, i + per); i < e; relaxed.add_concurrent_relaxed(items[i++]));
+        });
+        auto t = clk::now();
+        timed_run(nt, [&](unsigned tid) {
+            for(size_t i = tid * per, e = std::min(n, i + per); i < e; local[tid].addh(items[i++]));
+        });
+        for(unsigned i = 1; i < nt; ++i) local[0] += local[i];
+        const double lt = std::chrono::duration<double>(clk::now() - t).count();
+        int64_t over = 0, under = 0;
+        for(const uint64_t k: {0, 1, 2, 3, 4, 5, 6, 7}) {
+            const int64_t truth = std::count(items.begin(), items.end(), k);
+            over += int64_t(strict.est_count_concurrent(k)) - truth;
+            under += std::max(int64_t(0), truth - int64_t(relaxed.est_count_concurrent(k)));
+        }
+        std::fprintf(stderr, "%u\t%g\t%g\t%g\t%" PRIi64 "\t%" PRIi64 "\n", nt, n / st * 1e-6, n / rt * 1e-6, n / lt * 1e-6, over, under);
+    }
+}
@@ -0,0 +1,32 @@
+#include "sketch/dd.h"
+#include <chrono>
+#include <random>
+
+using clk = std::chrono::high_resolution_clock;
+
+// DDSketch insertion throughput: addh per value against add_batch, on log-normal "latencies".
+template<typename FT>
+void measure(const char *name, const std::vector<FT> &vals, size_t maxbins) {
+    sketch::DDSketch<FT> looped(0.01, maxbins), batched(0.01, maxbins);
+    auto t = clk::now();
+    for(const auto v: vals) looped.addh(v);
+    const double loop_ns = std::chrono::duration<double, std::nano>(clk::now() - t).count() / vals.size();
+    t = clk::now();
+    batched.add_batch(vals.data(), vals.size());
+    const double batch_ns = std::chrono::duration<double, std::nano>(clk::now() - t).count() / vals.size();
+    std::fprintf(stderr, "%s\t%zu\t%g\t%g\t%g\t%g\n", name, maxbins, loop_ns, batch_ns, batched.quantile(.5), batched.quantile(.99));
+}
+
+int main(int argc, char **argv) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 50000000;
+    std::mt19937_64 mt(13);
+    std::lognormal_distribution<double> lnd(3., 1.5);
+    std::vector<double> dvals(n);
+    for(auto &v: dvals) v = lnd(mt);
+    std::vector<float> fvals(dvals.begin(), dvals.end());
+    std::fprintf(stderr, "#type\tmaxbins\taddh ns/value\tadd_batch ns/value\tp50\tp99\n");
+    for(const size_t maxbins: {2048, 128}) {
+        measure("double", dvals, maxbins);
+        measure("float", fvals, maxbins);
+    }
+}
@@ -0,0 +1,61 @@
+#include "sketch/dd.h"
+#include <chrono>
+#include <numeric>
+#include <random>
+
+using clk = std::chrono::high_resolution_clock;
+using ddd = sketch::ddd;
+
+static double since(clk::time_point t) {return std::chrono::duration<double>(clk::now() - t).count();}
+
+// Central aggregation of DDSketches: serialize many per-host sketches, then deserialize and merge them,
+// one at a time and as a range, and answer a set of quantiles with one pass against one query per quantile.
+int main(int argc, char **argv) {
+    const size_t nsketches = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 1000;
+    const size_t per = argc > 2 ? std::strtoull(argv[2], nullptr, 10): 10000;
+    std::mt19937_64 mt(13);
+    std::vector<ddd> sketches;
+    std::vector<double> vals(per);
+    for(size_t i = 0; i < nsketches; ++i) {
+        std::lognormal_distribution<double> lnd(3. + (i % 10) * .1, 1.5);
+        for(auto &v: vals) v = lnd(mt);
+        sketches.emplace_back();
+        sketches.back().add_batch(vals.data(), vals.size());
+    }
+    auto t = clk::now();
+    std::vector<std::vector<uint8_t>> bufs;
+    size_t nbytes = 0;
+    for(const auto &s: sketches) nbytes += (bufs.emplace_back(s.serialize())).size();
+    const double ser = since(t);
+    t = clk::now();
+    ddd seq;
+    for(const auto &b: bufs) seq += ddd::deserialize(b.data(), b.size());
+    const double deser_merge = since(t);
+    t = clk::now();
+    std::vector<ddd> back;
+    back.reserve(bufs.size());
+    for(const auto &b: bufs) back.push_back(ddd::deserialize(b.data(), b.size()));
+    const double deser = since(t);
+    t = clk::now();
+    ddd ranged;
+    ranged.merge(back.begin(), back.end());
+    const double range_merge = since(t);
+    std::fprintf(stderr, "%zu sketches, %g bytes each: serialize %g us, deserialize %g us, deserialize+merge %g us, range merge %g us per sketch\n",
+                 nsketches, double(nbytes) / nsketches, ser * 1e6 / nsketches, deser * 1e6 / nsketches, deser_merge * 1e6 / nsketches, range_merge * 1e6 / nsketches);
+
+    std::vector<double> qs(1000), out(qs.size());
+    for(size_t i = 0; i < qs.size(); ++i) qs[i] = (i + .5) / qs.size();
+    std::shuffle(qs.begin(), qs.end(), mt);
+    const size_t reps = 100;
+    double check = 0.;
+    t = clk::now();
+    for(size_t r = 0; r < reps; ++r) for(size_t i = 0; i < qs.size(); ++i) check += out[i] = ranged.quantile(qs[i]);
+    const double single = since(t);
+    t = clk::now();
+    for(size_t r = 0; r < reps; ++r) {
+        ranged.quantiles(qs.data(), qs.size(), out.data());
+        check -= std::accumulate(out.begin(), out.end(), 0.);
+    }
+    const double batch = since(t);
+    std::fprintf(stderr, "%zu quantiles: quantile() %g us, quantiles() %g us per set (check %g)\n", qs.size(), single * 1e6 / reps, batch * 1e6 / reps, check);
+}
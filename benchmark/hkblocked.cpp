@@ -0,0 +1,32 @@
+#include "hk.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+// Update and query throughput of HeavyKeeper (one cache line per subtable) against BlockedHeavyKeeper (one line per key).
+template<typename HK>
+void measure(const char *name, HK &&hk, const std::vector<uint64_t> &items) {
+    auto t = clk::now();
+    for(const auto v: items) hk.addh(v);
+    const double add_ns = std::chrono::duration<double, std::nano>(clk::now() - t).count() / items.size();
+    uint64_t total = 0;
+    t = clk::now();
+    for(const auto v: items) total += hk.queryh(v);
+    const double query_ns = std::chrono::duration<double, std::nano>(clk::now() - t).count() / items.size();
+    std::fprintf(stderr, "%s\t%g\t%g\t%zu\n", name, add_ns, query_ns, size_t(total));
+}
+
+int main(int argc, char **argv) {
+    const size_t tbsz = argc > 1 ? std::strtoull(argv[1], nullptr, 10): size_t(1) << 22;
+    const size_t nh = argc > 2 ? std::atoi(argv[2]): 5;
+    const size_t n = argc > 3 ? std::strtoull(argv[3], nullptr, 10): 10000000;
+    std::vector<uint64_t> items(n);
+    std::mt19937_64 mt(13);
+    for(auto &i: items) i = (mt() & 3) ? mt() % (n / 2): mt() % 1000; // A quarter of updates go to heavy hitters
+    std::fprintf(stderr, "#sketch\tadd ns\tquery ns\tsum of estimates\n");
+    measure("HeavyKeeper<32,32>", HeavyKeeper<32,32>(tbsz, nh), items);
+    measure("BlockedHeavyKeeper<32,32>", BlockedHeavyKeeper<32,32>(tbsz, nh), items);
+    measure("HeavyKeeper<16,16>", HeavyKeeper<16,16>(tbsz, nh), items);
+    measure("BlockedHeavyKeeper<16,16>", BlockedHeavyKeeper<16,16>(tbsz, nh), items);
+}
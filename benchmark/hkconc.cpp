@@ -0,0 +1,49 @@
+#include "hk.h"
+#include <chrono>
+#include <thread>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+using HK = HeavyKeeper<32,32>;
+
+template<typename F>
+double timed_run(unsigned nthreads, const F &func) {
+    std::vector<std::thread> threads;
+    auto t = clk::now();
+    for(unsigned tid = 0; tid < nthreads; ++tid) threads.emplace_back(func, tid);
+    for(auto &th: threads) th.join();
+    return std::chrono::duration<double>(clk::now() - t).count();
+}
+
+// Top-k ingestion throughput scaling: one HeavyKeeperHeap behind a mutex vs ConcurrentHeavyKeeperHeap,
+// with a reader taking topk() snapshots throughout the concurrent run.
+int main(int argc, char **argv) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): size_t(1) << 24;
+    const unsigned maxthreads = argc > 2 ? std::atoi(argv[2]): std::max(1u, std::thread::hardware_concurrency());
+    const size_t tbsz = 1 << 16, nh = 4, k = 100;
+    std::vector<uint64_t> items(n);
+    std::mt19937_64 mt(13);
+    for(auto &i: items) i = (mt() & 3) ? mt() % (n / 2): mt() % 1000; // A quarter of updates go to heavy hitters
+    std::fprintf(stderr, "#threads\tlocked heap Mupd/s\tconcurrent Mupd/s\tsnapshots taken\n");
+    for(unsigned nt = 1; nt <= maxthreads; nt <<= 1) {
+        const size_t per = (n + nt - 1) / nt;
+        HeavyKeeperHeap<HK, uint64_t> heap(k, HK(tbsz, nh));
+        std::mutex mut;
+        const double lt = timed_run(nt, [&](unsigned tid) {
+            for(size_t i = tid * per, e = std::min(n, i + per); i < e; ++i) {
+                std::lock_guard<std::mutex> lock(mut);
+                heap.addh(items[i]);
+            }
+        });
+        ConcurrentHeavyKeeperHeap<HK, uint64_t> chk(k, HK(tbsz, nh), nt);
+        std::atomic<bool> done(false);
+        size_t nsnapshots = 0;
+        std::thread reader([&]() {while(!done.load()) chk.topk(), ++nsnapshots, std::this_thread::yield();});
+        const double ct = timed_run(nt, [&](unsigned tid) {
+            for(size_t i = tid * per, e = std::min(n, i + per); i < e; chk.addh(items[i++], tid));
+        });
+        done.store(true);
+        reader.join();
+        std::fprintf(stderr, "%u\t%g\t%g\t%zu\n", nt, n / lt * 1e-6, n / ct * 1e-6, nsnapshots);
+    }
+}
@@ -0,0 +1,31 @@
+#include "hll.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+template<typename HS>
+void run(const std::vector<uint64_t> &keys, unsigned p, const char *name) {
+    hll::hllbase_t<HS> scalar(p), batch(p);
+    auto t = clk::now();
+    for(const auto k: keys) scalar.addh(k);
+    auto scalar_time = std::chrono::duration<double>(clk::now() - t).count();
+    t = clk::now();
+    batch.addh_batch(keys.data(), keys.size());
+    auto batch_time = std::chrono::duration<double>(clk::now() - t).count();
+    std::fprintf(stderr, "%s\t%u\t%g\t%g\t%g\t%s\n", name, p,
+                 keys.size() / scalar_time * 1e-6, keys.size() / batch_time * 1e-6,
+                 scalar_time / batch_time, scalar == batch ? "match": "MISMATCH");
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): size_t(1) << 26;
+    std::vector<uint64_t> keys(n);
+    wy::WyHash<uint64_t> gen(13);
+    for(auto &k: keys) k = gen();
+    std::fprintf(stderr, "#Hash\tp\tscalar Mkeys/s\tbatch Mkeys/s\tspeedup\tcheck\n");
+    for(const unsigned p: {10u, 14u, 16u, 20u, 24u}) {
+        run<hll::WangHash>(keys, p, "WangHash");
+        run<hll::MurFinHash>(keys, p, "MurFinHash");
+    }
+}
@@ -0,0 +1,32 @@
+#include "hll.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+// All-pairs Jaccard: a pair-at-a-time loop vs the blocked engine.
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 512;
+    unsigned p = argc > 2 ? std::atoi(argv[2]): 14;
+    int nthreads = argc > 3 ? std::atoi(argv[3]): -1;
+    std::vector<hll::hll_t> sketches;
+    wy::WyHash<uint64_t> gen(13);
+    for(size_t i = 0; i < n; ++i) {
+        sketches.emplace_back(p);
+        for(size_t j = 0, e = 1000 + gen() % 100000; j < e; ++j) sketches.back().addh(gen());
+        sketches.back().sum();
+    }
+    const size_t npairs = n * (n - 1) / 2;
+    std::vector<float> naive(npairs);
+    auto t = clk::now();
+    for(size_t i = 0, k = 0; i < n; ++i)
+        for(size_t j = i + 1; j < n; ++j)
+            naive[k++] = sketches[i].jaccard_index(sketches[j]);
+    const double nt = std::chrono::duration<double>(clk::now() - t).count();
+    t = clk::now();
+    const auto blocked = hll::jaccard_matrix(sketches, nthreads);
+    const double bt = std::chrono::duration<double>(clk::now() - t).count();
+    std::fprintf(stderr, "#n\tp\tpairwise Mpairs/s\tblocked Mpairs/s\tspeedup\tcheck\n");
+    std::fprintf(stderr, "%zu\t%u\t%g\t%g\t%g\t%s\n", n, p, npairs / nt * 1e-6, npairs / bt * 1e-6, nt / bt,
+                 naive == blocked ? "match": "MISMATCH");
+}
@@ -0,0 +1,45 @@
+#include "hll.h"
+#include <chrono>
+#include <thread>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+template<typename F>
+double timed_run(unsigned nthreads, const F &func) {
+    std::vector<std::thread> threads;
+    auto t = clk::now();
+    for(unsigned tid = 0; tid < nthreads; ++tid) threads.emplace_back(func, tid);
+    for(auto &th: threads) th.join();
+    return std::chrono::duration<double>(clk::now() - t).count();
+}
+
+// Insertion throughput scaling: one shared hll_t (CAS on shared registers) vs shardedhll_t.
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): size_t(1) << 26;
+    unsigned maxthreads = argc > 2 ? std::atoi(argv[2]): std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint64_t> keys(n);
+    wy::WyHash<uint64_t> gen(13);
+    for(auto &k: keys) k = gen();
+    std::fprintf(stderr, "#p\tthreads\tshared Mkeys/s\tsharded Mkeys/s\tsharded+batch Mkeys/s\tcheck\n");
+    for(const unsigned p: {10u, 14u, 18u}) {
+        for(unsigned nt = 1; nt <= maxthreads; nt <<= 1) {
+            const size_t per = (n + nt - 1) / nt;
+            hll::hll_t shared(p);
+            hll::shardedhll_t sharded(p, nt), bsharded(p, nt);
+            const double st = timed_run(nt, [&](unsigned tid) {
+                for(size_t i = tid * per, e = std::min(n, i + per); i < e; shared.addh(keys[i++]));
+            });
+            const double sht = timed_run(nt, [&](unsigned tid) {
+                for(size_t i = tid * per, e = std::min(n, i + per); i < e; sharded.addh(keys[i++], tid));
+            });
+            const double bt = timed_run(nt, [&](unsigned tid) {
+                const size_t i = std::min(n, tid * per);
+                bsharded.addh_batch(keys.data() + i, std::min(n, i + per) - i, tid);
+            });
+            std::fprintf(stderr, "%u\t%u\t%g\t%g\t%g\t%s\n", p, nt,
+                         n / st * 1e-6, n / sht * 1e-6, n / bt * 1e-6,
+                         sharded.finalize() == shared && bsharded.finalize() == shared ? "match": "MISMATCH");
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#include "sketch/lpcqf.h"
+#include <chrono>
+#include <random>
+
+using clk = std::chrono::high_resolution_clock;
+
+// Item-at-a-time update against batch_update, on uniform and on skewed (Zipfian, k-mer-like) streams.
+template<typename LP>
+void measure(const char *name, size_t tblsz, const std::vector<uint64_t> &items) {
+    LP looped(tblsz), batched(tblsz);
+    auto t = clk::now();
+    for(const auto v: items) looped.update(v);
+    const double loop_ns = std::chrono::duration<double, std::nano>(clk::now() - t).count() / items.size();
+    t = clk::now();
+    batched.batch_update(items.data(), items.size());
+    const double batch_ns = std::chrono::duration<double, std::nano>(clk::now() - t).count() / items.size();
+    size_t mismatches = 0;
+    for(size_t i = 0; i < std::min(items.size(), size_t(100000)); ++i)
+        mismatches += looped.count_estimate(items[i]) != batched.count_estimate(items[i]);
+    std::fprintf(stderr, "%s\t%g\t%g\t%zu\n", name, loop_ns, batch_ns, mismatches);
+}
+
+int main(int argc, char **argv) {
+    const unsigned l2sz = argc > 1 ? std::atoi(argv[1]): 26;
+    const size_t n = argc > 2 ? std::strtoull(argv[2], nullptr, 10): 20000000;
+    const size_t tblsz = size_t(1) << l2sz;
+    const size_t ndistinct = tblsz / 2;
+    std::mt19937_64 mt(13);
+    std::vector<uint64_t> uniform(n), skewed(n);
+    for(auto &i: uniform) i = mt() % ndistinct;
+    // Zipf(1.2) over ranks, drawn by inverting a power-law CDF
+    std::uniform_real_distribution<double> u;
+    for(auto &i: skewed) i = std::min(size_t(std::pow(1. - u(mt), -1. / 0.2)), ndistinct) * 0x9E3779B97F4A7C15ull;
+    std::fprintf(stderr, "#stream\tloop ns/item\tbatch ns/item\tmismatches\n");
+    using LP = sketch::LPCQF<uint32_t, 8, sketch::IS_POW2>;
+    measure<LP>("uniform", tblsz, uniform);
+    measure<LP>("skewed", tblsz, skewed);
+}
@@ -0,0 +1,38 @@
+#include "sketch/lpcqf.h"
+#include <chrono>
+#include <random>
+
+using clk = std::chrono::steady_clock;
+
+// Per-update latency while a resizable LPCQF grows from 1024 slots, with incremental migration
+// and with each resize finished as soon as it starts, against a table allocated at its final size.
+template<typename LP, typename F>
+void measure(const char *name, LP &&lp, const std::vector<uint64_t> &items, const F &after_update) {
+    std::vector<double> lat(items.size());
+    const auto start = clk::now();
+    for(size_t i = 0; i < items.size(); ++i) {
+        const auto t = clk::now();
+        lp.update(items[i]);
+        after_update(lp);
+        lat[i] = std::chrono::duration<double, std::nano>(clk::now() - t).count();
+    }
+    const double total = std::chrono::duration<double, std::nano>(clk::now() - start).count();
+    std::sort(lat.begin(), lat.end());
+    auto pct = [&](double p) {return lat[std::min(lat.size() - 1, size_t(p * lat.size()))];};
+    std::fprintf(stderr, "%s\t%g\t%g\t%g\t%g\t%g\t%g\n", name, total / items.size(), pct(.5), pct(.99), pct(.9999), lat.back(), double(lp.size()));
+}
+
+int main(int argc, char **argv) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 10000000;
+    std::mt19937_64 mt(13);
+    std::vector<uint64_t> items(n);
+    for(auto &i: items) i = mt();
+    using Resizable = sketch::LPCQF<uint64_t, 32, sketch::IS_POW2 | sketch::IS_RESIZABLE>;
+    using Fixed = sketch::LPCQF<uint64_t, 32, sketch::IS_POW2>;
+    size_t finalsz = 1024;
+    while(finalsz < 2 * n) finalsz <<= 1;
+    std::fprintf(stderr, "#table\tmean ns\tp50 ns\tp99 ns\tp99.99 ns\tmax ns\tslots\n");
+    measure("incremental", Resizable(1024), items, [](auto &) {});
+    measure("stop-the-world", Resizable(1024), items, [](auto &lp) {lp.finish_resize();});
+    measure("fixed", Fixed(finalsz), items, [](auto &) {});
+}
@@ -0,0 +1,66 @@
+#include "sketch/mh.h"
+#include <chrono>
+#include <random>
+
+using clk = std::chrono::high_resolution_clock;
+using namespace sketch;
+
+// Bottom-k Jaccard and full intersection over sorted k-element sketches:
+// the one-element-at-a-time merge against the SIMD block kernel in isz.h.
+template<typename T>
+size_t merge_bottom_k(const std::vector<T> &a, const std::vector<T> &b, size_t k) {
+    size_t shared = 0;
+    for(size_t i = 0, j = 0, nused = 0; nused < k && i < a.size() && j < b.size(); ++nused) {
+        if(a[i] == b[j]) ++shared, ++i, ++j;
+        else if(a[i] < b[j]) ++i;
+        else ++j;
+    }
+    return shared;
+}
+
+template<typename T>
+void measure(size_t k, size_t nsketches, size_t npairs, double olap) {
+    std::mt19937_64 mt(13);
+    std::vector<std::vector<T>> sketches(nsketches);
+    std::vector<T> shared(k);
+    for(auto &v: shared) v = mt();
+    for(auto &s: sketches) {
+        s.resize(k);
+        for(auto &v: s) v = std::uniform_real_distribution<double>()(mt) < olap ? shared[mt() % k]: T(mt());
+        std::sort(s.begin(), s.end());
+        s.erase(std::unique(s.begin(), s.end()), s.end());
+    }
+    std::vector<std::pair<size_t, size_t>> pairs(npairs);
+    for(auto &p: pairs) p = {mt() % nsketches, mt() % nsketches};
+    size_t c1 = 0, c2 = 0, c3 = 0, c4 = 0;
+    auto t = clk::now();
+    for(const auto &p: pairs) c1 += merge_bottom_k(sketches[p.first], sketches[p.second], k);
+    const double merge_t = std::chrono::duration<double, std::nano>(clk::now() - t).count() / npairs;
+    t = clk::now();
+    for(const auto &p: pairs) {
+        const auto &a = sketches[p.first], &b = sketches[p.second];
+        c2 += isz::bottom_k_intersection_size(a.data(), a.size(), b.data(), b.size(), k);
+    }
+    const double simd_t = std::chrono::duration<double, std::nano>(clk::now() - t).count() / npairs;
+    t = clk::now();
+    for(const auto &p: pairs) {
+        const auto &a = sketches[p.first], &b = sketches[p.second];
+        c3 += isz::detail::scalar_intersection_size(a.data(), a.size(), b.data(), b.size());
+    }
+    const double scalar_isz_t = std::chrono::duration<double, std::nano>(clk::now() - t).count() / npairs;
+    t = clk::now();
+    for(const auto &p: pairs) c4 += isz::intersection_size(sketches[p.first], sketches[p.second]);
+    const double simd_isz_t = std::chrono::duration<double, std::nano>(clk::now() - t).count() / npairs;
+    if(c1 != c2 || c3 != c4) throw std::runtime_error("Kernel mismatch");
+    std::fprintf(stderr, "%zu-bit\t%zu\t%g\t%g\t%g\t%g\t%g\n", sizeof(T) * 8, k, olap, merge_t, simd_t, scalar_isz_t, simd_isz_t);
+}
+
+int main(int argc, char **argv) {
+    const size_t k = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 10000;
+    const size_t npairs = argc > 2 ? std::strtoull(argv[2], nullptr, 10): 20000;
+    std::fprintf(stderr, "#type\tk\toverlap\tmerge jaccard ns\tSIMD jaccard ns\tmerge isz ns\tSIMD isz ns\n");
+    for(const double olap: {0.01, .5, .95}) {
+        measure<uint64_t>(k, 256, npairs, olap);
+        measure<uint32_t>(k, 256, npairs, olap);
+    }
+}
@@ -0,0 +1,33 @@
+#include "hll.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+// Merge and union-size throughput of packed (6-bit) vs unpacked (8-bit) HLL registers.
+int main(int argc, char **argv) {
+    size_t nreps = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 200;
+    wy::WyHash<uint64_t> gen(13);
+    std::fprintf(stderr, "#p\tmerge (8-bit) Gregs/s\tmerge (6-bit) Gregs/s\tunion (8-bit) ms\tunion (6-bit) ms\n");
+    for(const unsigned p: {10u, 14u, 16u, 20u}) {
+        hll::hll_t h1(p), h2(p);
+        for(size_t i = 0; i < (size_t(4) << p); ++i) h1.addh(gen()), h2.addh(gen());
+        hll::phll_t ph1(h1), ph2(h2);
+        auto t = clk::now();
+        for(size_t i = 0; i < nreps; ++i) h1 += h2;
+        const double ut = std::chrono::duration<double>(clk::now() - t).count();
+        t = clk::now();
+        for(size_t i = 0; i < nreps; ++i) ph1 += ph2;
+        const double pt = std::chrono::duration<double>(clk::now() - t).count();
+        volatile double sink = 0;
+        t = clk::now();
+        for(size_t i = 0; i < nreps; ++i) sink = sink + h1.union_size(h2);
+        const double uut = std::chrono::duration<double>(clk::now() - t).count();
+        t = clk::now();
+        for(size_t i = 0; i < nreps; ++i) sink = sink + ph1.union_size(ph2);
+        const double put = std::chrono::duration<double>(clk::now() - t).count();
+        std::fprintf(stderr, "%u\t%g\t%g\t%g\t%g\t%s\n", p,
+                     nreps * h1.m() / ut * 1e-9, nreps * h1.m() / pt * 1e-9,
+                     uut / nreps * 1e3, put / nreps * 1e3, h1.union_size(h2) == ph1.union_size(ph2) && ph1.unpack() == h1 ? "match": "MISMATCH");
+    }
+}
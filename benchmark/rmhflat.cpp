@@ -0,0 +1,52 @@
+#include "sketch/mh.h"
+#include <chrono>
+#include <random>
+
+using namespace sketch;
+using clk = std::chrono::steady_clock;
+
+// The std::set bottom-k RangeMinHash used before FlatBottomK, as a baseline.
+struct SetBottomK {
+    size_t k_;
+    std::set<uint64_t, std::greater<uint64_t>> s_;
+    SetBottomK(size_t k): k_(k) {}
+    void add(uint64_t v) {
+        if(s_.size() == k_) {
+            if(*s_.begin() > v) {
+                s_.insert(v);
+                if(s_.size() > k_) s_.erase(s_.begin());
+            }
+        } else s_.insert(v);
+    }
+};
+
+template<typename F>
+double time_ns(const F &f) {
+    auto t = clk::now();
+    f();
+    return std::chrono::duration<double, std::nano>(clk::now() - t).count();
+}
+
+// Insertion throughput of RangeMinHash and CountingRangeMinHash against a std::set bottom-k,
+// for streams of distinct hashes and for streams where each hash repeats many times.
+int main(int argc, char **argv) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 20000000;
+    std::mt19937_64 mt(13);
+    std::vector<uint64_t> distinct(n), repeated(n);
+    for(auto &v: distinct) v = mt();
+    for(auto &v: repeated) v = mt() % (n / 64 + 1);
+    for(auto &v: repeated) v = hash::WangHash()(v);
+    std::fprintf(stderr, "#k\tstream\tstd::set ns/add\tRangeMinHash ns/add\tCountingRangeMinHash ns/add\n");
+    for(const size_t k: {128, 1024, 10000, 100000}) {
+        for(const auto *items: {&distinct, &repeated}) {
+            SetBottomK sb(k);
+            mh::RangeMinHash<uint64_t> rm(k);
+            mh::CountingRangeMinHash<uint64_t> crm(k);
+            const double st = time_ns([&]() {for(const auto v: *items) sb.add(v);});
+            const double rt = time_ns([&]() {for(const auto v: *items) rm.add(v); rm.size();});
+            const double ct = time_ns([&]() {for(const auto v: *items) crm.add(v); crm.size();});
+            if(!std::equal(rm.begin(), rm.end(), sb.s_.begin(), sb.s_.end())) throw std::runtime_error("Sketches differ");
+            std::fprintf(stderr, "%zu\t%s\t%g\t%g\t%g\n", k, items == &distinct ? "distinct": "repeated", st / n, rt / n, ct / n);
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#include "sketch/setsketch.h"
+#include <chrono>
+
+using namespace sketch::setsketch;
+using clk = std::chrono::high_resolution_clock;
+
+// Ingest throughput of update_batch against one update call per id.
+template<typename Sketch, typename Factory>
+void run(const char *name, const std::vector<uint64_t> &ids, const Factory &f) {
+    Sketch s1(f()), s2(f());
+    auto t = clk::now();
+    for(const auto id: ids) s1.update(id);
+    const double loop = std::chrono::duration<double>(clk::now() - t).count();
+    t = clk::now();
+    s2.update_batch(ids.data(), ids.size());
+    const double batch = std::chrono::duration<double>(clk::now() - t).count();
+    std::fprintf(stderr, "%s\t%zu\t%g\t%g\t%g\t%s\n", name, ids.size(), ids.size() / loop * 1e-6, ids.size() / batch * 1e-6, loop / batch, s1 == s2 ? "match": "MISMATCH");
+}
+
+int main(int argc, char **argv) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 10000000;
+    const size_t m = argc > 2 ? std::strtoull(argv[2], nullptr, 10): 1024;
+    std::vector<uint64_t> ids(n);
+    for(size_t i = 0; i < n; ++i) ids[i] = i;
+    std::fprintf(stderr, "#sketch\tids\tloop Mids/s\tbatch Mids/s\tspeedup\n");
+    run<SetSketch<uint16_t>>("SetSketch<uint16_t>", ids, [m]() {return SetSketch<uint16_t>(m, 1.001, 30., 65534);});
+    run<SetSketch<uint8_t>>("SetSketch<uint8_t>", ids, [m]() {return SetSketch<uint8_t>(m, 1.2, 20., 254);});
+    run<CSetSketch<double>>("CSetSketch<double>", ids, [m]() {return CSetSketch<double>(m);});
+    run<CSetSketch<long double>>("CSetSketch<long double>", ids, [m]() {return CSetSketch<long double>(m);});
+}
@@ -0,0 +1,38 @@
+#include "sketch/ssi.h"
+#include "sketch/setsketch.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+using Index = SetSketchIndex<uint64_t, uint32_t>;
+
+// Bulk loading and querying a register matrix one row at a time against the batch entry points.
+int main(int argc, char **argv) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 100000;
+    const unsigned nthreads = argc > 2 ? std::atoi(argv[2]): std::max(1u, std::thread::hardware_concurrency());
+    const size_t m = 64;
+    std::vector<uint16_t> store;
+    for(size_t i = 0; i < n; ++i) {
+        setsketch::SetSketch<uint16_t> ss(m, 1.001, 30., 65534);
+        for(size_t j = i * 50; j < i * 50 + 200; ++j) ss.update(j);
+        store.insert(store.end(), ss.data(), ss.data() + m);
+    }
+    auto secs = [](auto t) {return std::chrono::duration<double>(clk::now() - t).count();};
+    Index looped(m), batched(m);
+    auto t = clk::now();
+    for(size_t i = 0; i < n; ++i) looped.update(lsh::detail::RegisterRow<uint16_t>{&store[i * m], m});
+    const double loop_insert = secs(t);
+    t = clk::now();
+    batched.insert_batch(store.data(), n, nthreads);
+    const double batch_insert = secs(t);
+    size_t total = 0;
+    t = clk::now();
+    for(size_t i = 0; i < n; ++i) total += std::get<0>(looped.query_candidates(lsh::detail::RegisterRow<uint16_t>{&store[i * m], m}, 50)).size();
+    const double loop_query = secs(t);
+    t = clk::now();
+    const auto res = batched.query_batch(store.data(), n, 50, -1, true, nthreads);
+    const double batch_query = secs(t);
+    std::fprintf(stderr, "#sketches\tthreads\tloop insert s\tbatch insert s\tloop query s\tbatch query s\n");
+    std::fprintf(stderr, "%zu\t%u\t%g\t%g\t%g\t%g\t%s\n", n, nthreads, loop_insert, batch_insert, loop_query, batch_query,
+                 looped == batched && total == res.ids.size() ? "match": "MISMATCH");
+}
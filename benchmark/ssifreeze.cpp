@@ -0,0 +1,37 @@
+#include "sketch/ssi.h"
+#include "sketch/setsketch.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+using Index = SetSketchIndex<uint64_t, uint32_t>;
+
+// Memory and query time of the hash-map index against its frozen CSR form.
+int main(int argc, char **argv) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 100000;
+    const size_t nqueries = argc > 2 ? std::strtoull(argv[2], nullptr, 10): 5000;
+    const size_t m = 64;
+    std::vector<std::vector<uint16_t>> sketches;
+    for(size_t i = 0; i < n; ++i) {
+        setsketch::SetSketch<uint16_t> ss(m, 1.001, 30., 65534);
+        for(size_t j = i * 50; j < i * 50 + 200; ++j) ss.update(j);
+        sketches.emplace_back(ss.data(), ss.data() + m);
+    }
+    Index index(m);
+    for(const auto &s: sketches) index.update(s);
+    auto t = clk::now();
+    auto frozen = index;
+    frozen.freeze();
+    const double freeze_ms = std::chrono::duration<double, std::milli>(clk::now() - t).count();
+    auto time_queries = [&](const Index &idx) {
+        size_t total = 0;
+        auto t = clk::now();
+        for(size_t i = 0; i < nqueries; ++i)
+            total += std::get<0>(idx.query_candidates(sketches[(i * 7919) % n], 100)).size();
+        return std::make_pair(std::chrono::duration<double, std::micro>(clk::now() - t).count() / nqueries, total);
+    };
+    const auto mt = time_queries(index), ft = time_queries(frozen);
+    std::fprintf(stderr, "#sketches\tmap bytes\tfrozen bytes\tratio\tfreeze ms\tmap query us\tfrozen query us\n");
+    std::fprintf(stderr, "%zu\t%zu\t%zu\t%g\t%g\t%g\t%g\t%s\n", n, index.memory_usage(), frozen.frozen_bytes(),
+                 double(index.memory_usage()) / frozen.frozen_bytes(), freeze_ms, mt.first, ft.first, mt.second == ft.second ? "match": "MISMATCH");
+}
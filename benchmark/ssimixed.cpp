@@ -0,0 +1,65 @@
+#include "sketch/ssi.h"
+#include "sketch/setsketch.h"
+#include <chrono>
+#include <shared_mutex>
+#include <thread>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+using Index = SetSketchIndex<uint64_t, uint32_t>;
+
+// Mixed read/write throughput: one writer inserts while reader threads query, until the writer finishes or time runs out.
+// Compares the hash-map index behind a reader-writer lock against concurrent mode, where readers take no locks.
+template<typename Query, typename Insert>
+std::pair<double, double> run(size_t nreaders, size_t nprefill, double seconds, const std::vector<std::vector<uint16_t>> &sketches, const Query &query, const Insert &insert) {
+    for(size_t i = 0; i < nprefill; ++i) insert(sketches[i]);
+    std::atomic<bool> done{false};
+    std::atomic<size_t> nq{0};
+    std::vector<std::thread> readers;
+    auto t = clk::now();
+    for(size_t r = 0; r < nreaders; ++r) {
+        readers.emplace_back([&,r]() {
+            size_t local = 0;
+            for(size_t i = r; !done.load(std::memory_order_relaxed); i = (i + 7) % sketches.size(), ++local)
+                query(sketches[i]);
+            nq += local;
+        });
+    }
+    size_t i = nprefill;
+    for(; i < sketches.size() && std::chrono::duration<double>(clk::now() - t).count() < seconds; ++i)
+        insert(sketches[i]);
+    done.store(true);
+    for(auto &th: readers) th.join();
+    const double wt = std::chrono::duration<double>(clk::now() - t).count();
+    return {(i - nprefill) / wt, nq.load() / wt};
+}
+
+int main(int argc, char **argv) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 50000;
+    const size_t nreaders = argc > 2 ? std::strtoull(argv[2], nullptr, 10): std::max(1u, std::thread::hardware_concurrency() - 1);
+    const double seconds = argc > 3 ? std::atof(argv[3]): 2.;
+    const size_t m = 64;
+    std::vector<std::vector<uint16_t>> sketches;
+    for(size_t i = 0; i < n; ++i) {
+        setsketch::SetSketch<uint16_t> ss(m, 1.001, 30., 65534);
+        for(size_t j = i * 50; j < i * 50 + 200; ++j) ss.update(j);
+        sketches.emplace_back(ss.data(), ss.data() + m);
+    }
+    std::fprintf(stderr, "#mode\treaders\tinserts/s\tqueries/s\n");
+    {
+        Index index(m);
+        std::shared_mutex mut;
+        auto res = run(nreaders, n / 2, seconds, sketches,
+            [&](const auto &s) {std::shared_lock<std::shared_mutex> lock(mut); return index.query_candidates(s, 50);},
+            [&](const auto &s) {std::unique_lock<std::shared_mutex> lock(mut); index.update(s);});
+        std::fprintf(stderr, "rwlock\t%zu\t%g\t%g\n", nreaders, res.first, res.second);
+    }
+    {
+        Index index(m);
+        index.make_concurrent();
+        auto res = run(nreaders, n / 2, seconds, sketches,
+            [&](const auto &s) {return index.query_candidates(s, 50);},
+            [&](const auto &s) {index.update(s);});
+        std::fprintf(stderr, "lockfree\t%zu\t%g\t%g\n", nreaders, res.first, res.second);
+    }
+}
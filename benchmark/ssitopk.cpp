@@ -0,0 +1,60 @@
+#include "sketch/ssi.h"
+#include "sketch/setsketch.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+using Index = SetSketchIndex<uint64_t, uint32_t>;
+
+// query_topk against fetching a fixed number of candidates and re-ranking them all,
+// reporting time per query and the fraction of exact top-k scores recovered.
+int main(int argc, char **argv) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 50000;
+    const size_t nqueries = argc > 2 ? std::strtoull(argv[2], nullptr, 10): 500;
+    const size_t k = argc > 3 ? std::strtoull(argv[3], nullptr, 10): 10;
+    const size_t m = 64;
+    std::vector<uint16_t> store;
+    std::vector<std::vector<uint16_t>> sketches;
+    for(size_t i = 0; i < n; ++i) {
+        setsketch::SetSketch<uint16_t> ss(m, 1.001, 30., 65534);
+        for(size_t j = i * 50; j < i * 50 + 200; ++j) ss.update(j);
+        store.insert(store.end(), ss.data(), ss.data() + m);
+        sketches.emplace_back(ss.data(), ss.data() + m);
+    }
+    Index index(m);
+    for(const auto &s: sketches) index.update(s);
+    std::vector<std::vector<double>> exact(nqueries);
+    for(size_t q = 0; q < nqueries; ++q) {
+        const uint16_t *qp = &store[((q * 7919) % n) * m];
+        for(size_t i = 0; i < n; ++i) exact[q].push_back(eq::count_eq(qp, &store[i * m], m) / double(m));
+        std::partial_sort(exact[q].begin(), exact[q].begin() + k, exact[q].end(), std::greater<>());
+        exact[q].resize(k);
+    }
+    auto recall = [&](size_t q, const std::vector<double> &scores) {
+        size_t hits = 0;
+        for(size_t i = 0; i < std::min(k, scores.size()); ++i) hits += scores[i] >= exact[q][k - 1];
+        return hits;
+    };
+    std::fprintf(stderr, "#method\tus/query\trecall\n");
+    for(const size_t maxcand: {k * 10, k * 100}) {
+        size_t hits = 0;
+        auto t = clk::now();
+        for(size_t q = 0; q < nqueries; ++q) {
+            const uint16_t *qp = &store[((q * 7919) % n) * m];
+            auto cands = std::get<0>(index.query_candidates(sketches[(q * 7919) % n], maxcand));
+            std::vector<double> scores;
+            for(const auto id: cands) scores.push_back(eq::count_eq(qp, &store[size_t(id) * m], m) / double(m));
+            std::partial_sort(scores.begin(), scores.begin() + std::min(k, scores.size()), scores.end(), std::greater<>());
+            scores.resize(std::min(k, scores.size()));
+            hits += recall(q, scores);
+        }
+        std::fprintf(stderr, "candidates(%zu)+rerank\t%g\t%g\n", maxcand, std::chrono::duration<double, std::micro>(clk::now() - t).count() / nqueries, double(hits) / (k * nqueries));
+    }
+    for(const double miss: {1e-2, 1e-4}) {
+        size_t hits = 0;
+        auto t = clk::now();
+        for(size_t q = 0; q < nqueries; ++q)
+            hits += recall(q, index.query_topk(sketches[(q * 7919) % n], k, store.data(), miss).second);
+        std::fprintf(stderr, "query_topk(miss=%g)\t%g\t%g\n", miss, std::chrono::duration<double, std::micro>(clk::now() - t).count() / nqueries, double(hits) / (k * nqueries));
+    }
+}
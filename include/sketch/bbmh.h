@@ -1092,7 +1092,6 @@ public:
     BBitMinHasher &operator+=(const BBitMinHasher &o) {
         if(size() != o.size()) throw std::runtime_error("Wrong sizes");
         if(size() == 0) throw std::runtime_error("Empty sketches");
-        std::fprintf(stderr, "Size: %zu\n", size());
         size_t i = 0;
 #if __AVX512F__
         __m512i *p1 = reinterpret_cast<__m512i *>(core_.data());
@@ -1101,10 +1100,12 @@ public:
             for(; i < core_.size() / (sizeof(__m512i) / sizeof(T)); ++i) {
                 _mm512_store_si512(p1 + i, _mm512_min_epu64(_mm512_load_si512(p1 + i), _mm512_load_si512(p2 + i)));
             }
+            i *= (sizeof(__m512i) / sizeof(T));
         } else CONST_IF(sizeof(T) == 4) {
             for(; i < core_.size() / (sizeof(__m512i) / sizeof(T)); ++i) {
                 _mm512_store_si512(p1 + i, _mm512_min_epu32(_mm512_load_si512(p1 + i), _mm512_load_si512(p2 + i)));
             }
+            i *= (sizeof(__m512i) / sizeof(T));
         }
 #else /* no avx512f */
 #    if __AVX2__
@@ -1457,17 +1458,21 @@ public:
     }
 #endif
     uint64_t equal_bblocks(const FinalBBitMinHash &o) const {
+        assert(o.core_.size() == core_.size());
+        return equal_bblocks(core_.data(), o.core_.data(), core_.size(), b_, p_);
+    }
+    // Number of matching b-bit blocks between two packed signatures of nwords 64-bit words each.
+    static uint64_t equal_bblocks(const value_type *lhs, const value_type *rhs, size_t nwords, unsigned b_, unsigned p_) {
         switch(b_) {
-            case 4: return eq::count_eq_nibbles((uint8_t *)core_.data(), (uint8_t *)o.core_.data(), core_.size() * 16);
-            case 8: return eq::count_eq_bytes((uint8_t *)core_.data(), (uint8_t *)o.core_.data(), core_.size() * 8);
-            case 16: return eq::count_eq_shorts((uint16_t *)core_.data(), (uint16_t *)o.core_.data(), core_.size() * 4);
-            case 32: return eq::count_eq_words((uint32_t *)core_.data(), (uint32_t *)o.core_.data(), core_.size() * 2);
-            case 64: return eq::count_eq_longs(core_.data(), o.core_.data(), core_.size());
+            case 4: return eq::count_eq_nibbles((const uint8_t *)lhs, (const uint8_t *)rhs, nwords * 16);
+            case 8: return eq::count_eq_bytes((const uint8_t *)lhs, (const uint8_t *)rhs, nwords * 8);
+            case 16: return eq::count_eq_shorts((const uint16_t *)lhs, (const uint16_t *)rhs, nwords * 4);
+            case 32: return eq::count_eq_words((const uint32_t *)lhs, (const uint32_t *)rhs, nwords * 2);
+            case 64: return eq::count_eq_longs(lhs, rhs, nwords);
             default: ;
         }
         uint64_t sum;
-        assert(o.core_.size() == core_.size());
-        const value_type *p1 = core_.data(), *pe = core_.data() + core_.size(), *p2 = o.core_.data();
+        const value_type *p1 = lhs, *pe = lhs + nwords, *p2 = rhs;
         assert(b_ <= 64); // b_ > 64 not yet supported, though it could be done with a larger hash
         // p_ already guaranteed to be greater than 6
         switch(p_) {
@@ -1495,14 +1500,14 @@ public:
             default: {
                 // Process each 'b' remainder block in
                 const __m512i *vp1 = reinterpret_cast<const __m512i *>(p1), *vp2 = reinterpret_cast<const __m512i *>(p2);
-                auto sum = detail::matching_bits(vp1, vp2, b_);
+                auto local_sum = detail::matching_bits(vp1, vp2, b_);
                 for(size_t i = 1; i < (size_t(1) << (p_ - 9u)); ++i) {
                     vp1 += b_;
                     vp2 += b_;
-                    sum = _mm512_add_epi64(detail::matching_bits(vp1, vp2, b_), sum);
+                    local_sum = _mm512_add_epi64(detail::matching_bits(vp1, vp2, b_), local_sum);
                 }
-                assert((value_type*)vp1 == &core_[core_.size()]);
-                sum = common::sum_of_u64s(sum);
+                assert((const value_type *)(vp1 + b_) == pe);
+                sum = common::sum_of_u64s(local_sum);
                 break;
             }
 #    else /* has avx2 not not 512 */
@@ -1517,7 +1522,7 @@ public:
                 }
 #ifndef NDEBUG
                 auto fptr = (value_type*)(reinterpret_cast<const __m256i *>(p1) + (size_t(b_) << (p_ - 8u)));
-                assert(fptr == (p1 + core_.size()) || !std::fprintf(stderr, "fptr: %p. optr: %p\n", static_cast<const void *>(fptr), static_cast<const void *>(p1 + core_.size())));
+                assert(fptr == pe || !std::fprintf(stderr, "fptr: %p. optr: %p\n", static_cast<const void *>(fptr), static_cast<const void *>(pe)));
 #endif
                 sum = common::sum_of_u64s(local_sum);
                 break;
@@ -0,0 +1,143 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <type_traits>
+#include "hll.h"
+#include "setsketch.h"
+#include "bbmh.h"
+
+namespace sketch {
+
+namespace build {
+
+/*
+ * Parallel construction of a single sketch.
+ * The input is split into contiguous partitions, each partition is sketched on its own thread,
+ * and the partial sketches are combined by a pairwise tree reduction through operator+=.
+ * Register merges for HLL, SetSketch, CSetSketch and BBitMinHasher are exact (max or min),
+ * so the result is identical to a serial build over the same items.
+ */
+
+namespace detail {
+
+template<typename Sketch, typename=void>
+struct has_update_batch: std::false_type {};
+template<typename Sketch>
+struct has_update_batch<Sketch, std::void_t<decltype(std::declval<Sketch &>().update_batch((const uint64_t *)nullptr, size_t(0)))>>: std::true_type {};
+template<typename Sketch, typename=void>
+struct has_addh_batch: std::false_type {};
+template<typename Sketch>
+struct has_addh_batch<Sketch, std::void_t<decltype(std::declval<Sketch &>().addh_batch((const uint64_t *)nullptr, size_t(0)))>>: std::true_type {};
+
+// Adds [beg, end) to sketch, using the sketch's batch entry point for contiguous 64-bit keys.
+template<typename Sketch, typename It>
+void add_range(Sketch &sketch, It beg, It end) {
+    using V = std::decay_t<decltype(*beg)>;
+    constexpr bool contiguous = std::is_pointer<It>::value && std::is_same<V, uint64_t>::value;
+    if constexpr(contiguous && has_update_batch<Sketch>::value) {
+        sketch.update_batch(beg, end - beg);
+    } else if constexpr(contiguous && has_addh_batch<Sketch>::value) {
+        sketch.addh_batch(beg, end - beg);
+    } else {
+        for(; beg != end; ++beg) sketch.addh(*beg);
+    }
+}
+
+// Runs func(i) for i in [0, n), handing out indices dynamically to nthreads threads.
+template<typename Func>
+inline void parallel_for(unsigned nthreads, size_t n, const Func &func) {
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for(size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < n; func(i));
+    };
+    std::vector<std::thread> threads;
+    for(unsigned t = 1; t < std::min<size_t>(nthreads, n); ++t) threads.emplace_back(worker);
+    worker();
+    for(auto &t: threads) t.join();
+}
+
+} // namespace detail
+
+/*
+ * Sketches [beg, end) with nthreads threads (all hardware threads if 0).
+ * factory() must return an empty sketch; every partition's sketch is made by it, so they share parameters.
+ * The range is cut into nparts partitions (one per thread if 0) which threads claim dynamically.
+ * Each partition's sketch pays its own warm-up before most updates are rejected, so more partitions
+ * than threads only help when partitions take uneven time.
+ */
+template<typename Factory, typename It>
+auto parallel_build(It beg, It end, const Factory &factory, unsigned nthreads=0, size_t nparts=0) {
+    using Sketch = std::decay_t<decltype(factory())>;
+    if(nthreads == 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+    const size_t n = std::distance(beg, end);
+    if(nparts == 0) nparts = nthreads;
+    nparts = std::max(size_t(1), std::min(nparts, n));
+    std::vector<Sketch> parts;
+    parts.reserve(nparts);
+    for(size_t i = 0; i < nparts; ++i) parts.emplace_back(factory());
+    detail::parallel_for(nthreads, nparts, [&](size_t i) {
+        auto pbeg = beg, pend = beg;
+        std::advance(pbeg, n * i / nparts);
+        std::advance(pend, n * (i + 1) / nparts);
+        detail::add_range(parts[i], pbeg, pend);
+    });
+    // Tree reduction: each level merges pairs stride apart, in parallel
+    for(size_t stride = 1; stride < nparts; stride <<= 1) {
+        const size_t npairs = (nparts + 2 * stride - 1) / (2 * stride);
+        detail::parallel_for(nthreads, npairs, [&](size_t pi) {
+            const size_t i = pi * 2 * stride;
+            if(i + stride < nparts) parts[i] += parts[i + stride];
+        });
+    }
+    return std::move(parts.front());
+}
+
+template<typename Factory, typename T>
+auto parallel_build(const std::vector<T> &items, const Factory &factory, unsigned nthreads=0, size_t nparts=0) {
+    return parallel_build(items.data(), items.data() + items.size(), factory, nthreads, nparts);
+}
+
+/*
+ * Sketches a binary file of native-endian 64-bit keys, mapped rather than read, with parallel_build.
+ */
+template<typename Factory>
+auto parallel_build_file(const std::string &path, const Factory &factory, unsigned nthreads=0, size_t nparts=0) {
+    const int fd = ::open(path.data(), O_RDONLY);
+    if(fd < 0) throw std::runtime_error(std::string("Failed to open ") + path);
+    struct stat st;
+    if(::fstat(fd, &st)) {
+        ::close(fd);
+        throw std::runtime_error(std::string("Failed to stat ") + path);
+    }
+    const size_t nbytes = st.st_size;
+    if(nbytes % sizeof(uint64_t)) {
+        ::close(fd);
+        throw std::runtime_error(path + " is not a whole number of 64-bit keys");
+    }
+    if(nbytes == 0) {
+        ::close(fd);
+        const uint64_t *p = nullptr;
+        return parallel_build(p, p, factory, nthreads, nparts);
+    }
+    void *map = ::mmap(nullptr, nbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(map == MAP_FAILED) throw std::runtime_error(std::string("Failed to mmap ") + path);
+    ::madvise(map, nbytes, MADV_SEQUENTIAL);
+    const uint64_t *keys = static_cast<const uint64_t *>(map);
+    try {
+        auto ret = parallel_build(keys, keys + nbytes / sizeof(uint64_t), factory, nthreads, nparts);
+        ::munmap(map, nbytes);
+        return ret;
+    } catch(...) {
+        ::munmap(map, nbytes);
+        throw;
+    }
+}
+
+} // namespace build
+
+} // namespace sketch
@@ -78,6 +78,9 @@ public:
     bool may_contain(uint64_t val) const {
         return bfs_[0].may_contain(val);
     }
+    void may_contain_batch(const uint64_t *vals, size_t n, uint8_t *out) const {
+        bfs_[0].may_contain_batch(vals, n, out);
+    }
     unsigned est_count(const uint64_t val) const {
         auto it(bfs_.cbegin());
         if(!it->may_contain(val)) return 0;
@@ -196,6 +199,33 @@ public:
         for(unsigned i(0); i < bfs_.size(); ++i) if(!bfs_[i].may_contain(val) || !hlls_[i].may_contain(val)) return false;
         return true;
     }
+    /*
+     * Sets out[i] to may_contain(vals[i]) for i in [0, n).
+     * Each stage checks only the values still present, with the filter's batched lookup
+     * and with the stage's HLL registers prefetched a fixed distance ahead.
+     */
+    void may_contain_batch(const uint64_t *vals, size_t n, uint8_t *out) const {
+        std::fill(out, out + n, uint8_t(1));
+        std::vector<uint64_t> alive(vals, vals + n);
+        std::vector<size_t> pos(n);
+        std::iota(pos.begin(), pos.end(), size_t(0));
+        std::vector<uint8_t> res(n);
+        for(size_t i = 0; i < bfs_.size() && !alive.empty(); ++i) {
+            bfs_[i].may_contain_batch(alive.data(), alive.size(), res.data());
+            const uint8_t *regs = hlls_[i].data();
+            const auto q = hlls_[i].q();
+            static constexpr size_t PREFETCH_DIST = 16;
+            for(size_t j = 0; j < std::min(PREFETCH_DIST, alive.size()); ++j) __builtin_prefetch(regs + (alive[j] >> q));
+            size_t nalive = 0;
+            for(size_t j = 0; j < alive.size(); ++j) {
+                if(j + PREFETCH_DIST < alive.size()) __builtin_prefetch(regs + (alive[j + PREFETCH_DIST] >> q));
+                if(res[j] && hlls_[i].may_contain(alive[j])) {
+                    alive[nalive] = alive[j], pos[nalive] = pos[j], ++nalive;
+                } else out[pos[j]] = 0;
+            }
+            alive.resize(nalive);
+        }
+    }
     void clear() {
         for(auto &h: hlls_) h.clear();
         for(auto &b: bfs_)  b.clear();
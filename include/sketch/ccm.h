@@ -179,6 +179,32 @@ template<typename T>
 struct IndexedValue {
     using Type = typename std::decay_t<decltype(*(std::declval<T>().cbegin()))>;
 };
+
+template<typename T>
+struct is_std_vector: std::false_type {};
+template<typename T, typename A>
+struct is_std_vector<std::vector<T, A>>: std::true_type {};
+
+// std::vector's (size_t, size_t) constructor would take nbits as the size and nelem as the fill value.
+template<typename VectorType>
+static inline VectorType make_counters(int nbits, size_t nelem) {
+    CONST_IF(is_std_vector<VectorType>::value) {
+        return VectorType(nelem);
+    } else {
+        return VectorType(nbits, nelem);
+    }
+}
+
+// Address of the word holding counter i, for prefetching. Bit-packed vectors expose their words through get().
+template<typename V>
+static inline auto counter_address(const V &v, size_t i, int) -> decltype(v.get(), v.bits(), (const void *)nullptr) {
+    using WordType = std::decay_t<decltype(*v.get())>;
+    return v.get() + (i * v.bits()) / (sizeof(WordType) * CHAR_BIT);
+}
+template<typename V>
+static inline const void *counter_address(const V &v, size_t i, long) {
+    return &v[i];
+}
 } // namespace detail
 
 
@@ -189,6 +215,8 @@ template<typename UpdateStrategy=update::Increment,
 class ccmbase_t {
     static_assert(!std::is_same<UpdateStrategy, update::CountSketch>::value || std::is_signed<typename detail::IndexedValue<VectorType>::Type>::value,
                   "If CountSketch is used, value must be signed.");
+    static_assert(!std::is_same<UpdateStrategy, update::CountSketch>::value || !conservative_update,
+                  "CountSketch updates cannot be conservative.");
 
 protected:
     VectorType        data_;
@@ -213,7 +241,7 @@ public:
     }
     size_t seeds_size() const {return seeds_.size();}
     void clear() {
-        common::detail::zero_memory(data_, ilog2(subtbl_sz_));
+        common::detail::zero_memory(data_, data_.size());
     }
     double l2est() const {
         return detail::sqrl2(data_, nhashes_, l2sz_);
@@ -240,7 +268,7 @@ public:
     //ccmbase_t(ccmbase_t &&o) = default;
     template<typename... Args>
     ccmbase_t(int nbits, int l2sz, int64_t nhashes=4, uint64_t seed=0, Args &&... args):
-            data_(nbits, nhashes << l2sz),
+            data_(detail::make_counters<VectorType>(nbits, nhashes << l2sz)),
             updater_(seed + l2sz * nbits * nhashes),
             nhashes_(nhashes), l2sz_(l2sz),
             nbits_(nbits), hf_(std::forward<Args>(args)...),
@@ -321,6 +349,7 @@ public:
         return true;
     }
     static constexpr bool is_increment = std::is_same<UpdateStrategy, update::Increment>::value;
+    static constexpr bool is_countsketch = std::is_same<UpdateStrategy, update::CountSketch>::value;
     ssize_t add(const uint64_t val) {
         unsigned nhdone = 0;
         ssize_t ret;
@@ -356,15 +385,23 @@ public:
             updater_(best_indices, data_, nbits_);
             ret = minval;
             //std::fprintf(stderr, "Now updated\n");
+        } else CONST_IF(is_countsketch) {
+            // Bits above the index choose each row's sign
+            std::vector<uint64_t> indices, signs;
+            while(nhdone < nhashes_) {
+                uint64_t hv = hash(val, nhdone);
+                indices.push_back((hv & mask_) + subtbl_sz_ * nhdone++);
+                signs.push_back(hv >> l2sz_);
+            }
+            ret = updater_(indices, signs, data_, nbits_);
         } else { // not conservative update. This means we support deletions
             ret = std::numeric_limits<decltype(ret)>::max();
-            const auto maxv = 1ull << nbits_;
             std::vector<uint64_t> indices{0};
             while(nhdone < nhashes_) {
                 uint64_t hv = hash(val, nhdone);
                 auto ind = (hv & mask_) + subtbl_sz_ * nhdone++;
                 indices[0] = ind;
-                updater_(indices, data_, maxv);
+                updater_(indices, data_, nbits_);
                 ret = std::min(ret, ssize_t(data_[ind]));
             }
         }
@@ -374,6 +411,16 @@ public:
         return hash(x ^ seeds_[index]);
     }
     uint64_t est_count(uint64_t val) const {
+        CONST_IF(is_countsketch) {
+            tmpbuffer<int64_t, 8> mem(nhashes_);
+            int64_t *ests = mem.get();
+            for(unsigned i = 0; i < nhashes_; ++i) {
+                auto hv = hash(val, i);
+                const int64_t c = data_[(hv & mask_) + subtbl_sz_ * i];
+                ests[i] = (hv >> l2sz_) & 1 ? c: -c;
+            }
+            return std::max(int64_t(0), int64_t(median(ests, nhashes_)));
+        }
         uint64_t ret = std::numeric_limits<uint64_t>::max();
         for(unsigned i = 0; i < nhashes_; ++i) {
             auto hv = hash(val, i);
@@ -381,6 +428,163 @@ public:
         }
         return updater_.est_count(ret);
     }
+    /*
+     * Batched updates and queries.
+     * Row indices for a block of BATCH_BLOCK items are computed up front and their counters prefetched,
+     * so the cache misses of a block overlap. Counters are then read and updated in input order,
+     * which makes add_batch equivalent to calling add on each item in turn.
+     */
+    static constexpr size_t BATCH_BLOCK = 16;
+    void add_batch(const uint64_t *vals, size_t n) {
+        std::vector<uint64_t> indices(BATCH_BLOCK * nhashes_), hvs(BATCH_BLOCK * nhashes_);
+        std::vector<uint64_t> best, signs;
+        best.reserve(nhashes_);
+        for(size_t start = 0; start < n; start += BATCH_BLOCK) {
+            const size_t nb = std::min(BATCH_BLOCK, n - start);
+            batch_indices(vals + start, nb, indices.data(), hvs.data());
+            for(size_t j = 0; j < nb; ++j) {
+                const uint64_t *ix = &indices[j * nhashes_];
+                CONST_IF(conservative_update) {
+                    best.assign(1, ix[0]);
+                    ssize_t minval = data_[ix[0]];
+                    for(size_t i = 1; i < nhashes_; ++i) {
+                        unsigned score;
+                        if((score = data_[ix[i]]) == minval) {
+                            best.push_back(ix[i]);
+                        } else if(score < minval) {
+                            best.assign(1, ix[i]);
+                            minval = score;
+                        }
+                    }
+                    updater_(best, data_, nbits_);
+                } else CONST_IF(is_countsketch) {
+                    best.assign(ix, ix + nhashes_);
+                    signs.clear();
+                    for(size_t i = 0; i < nhashes_; ++i) signs.push_back(hvs[j * nhashes_ + i] >> l2sz_);
+                    updater_(best, signs, data_, nbits_);
+                } else {
+                    best.assign(1, 0);
+                    for(size_t i = 0; i < nhashes_; ++i) {
+                        best[0] = ix[i];
+                        updater_(best, data_, nbits_);
+                    }
+                }
+            }
+        }
+    }
+    void addh_batch(const uint64_t *vals, size_t n) {add_batch(vals, n);}
+    // Writes est_count(vals[i]) to out[i].
+    void est_count_batch(const uint64_t *vals, size_t n, uint64_t *out) const {
+        std::vector<uint64_t> indices(BATCH_BLOCK * nhashes_), hvs(BATCH_BLOCK * nhashes_);
+        tmpbuffer<int64_t, 8> mem(nhashes_);
+        for(size_t start = 0; start < n; start += BATCH_BLOCK) {
+            const size_t nb = std::min(BATCH_BLOCK, n - start);
+            batch_indices(vals + start, nb, indices.data(), hvs.data());
+            for(size_t j = 0; j < nb; ++j) {
+                const uint64_t *ix = &indices[j * nhashes_];
+                CONST_IF(is_countsketch) {
+                    int64_t *ests = mem.get();
+                    for(size_t i = 0; i < nhashes_; ++i) {
+                        const int64_t c = data_[ix[i]];
+                        ests[i] = (hvs[j * nhashes_ + i] >> l2sz_) & 1 ? c: -c;
+                    }
+                    out[start + j] = std::max(int64_t(0), int64_t(median(ests, nhashes_)));
+                } else {
+                    uint64_t ret = std::numeric_limits<uint64_t>::max();
+                    for(size_t i = 0; i < nhashes_; ++i)
+                        ret = std::min(ret, uint64_t(data_[ix[i]]));
+                    out[start + j] = updater_.est_count(ret);
+                }
+            }
+        }
+    }
+private:
+    // Fills indices and hashes for nb items, item-major, and prefetches each counter.
+    // Hashing is row-major so that each row's loop over the block can vectorize.
+    void batch_indices(const uint64_t *vals, size_t nb, uint64_t *indices, uint64_t *hvs) const {
+        for(size_t i = 0; i < nhashes_; ++i) {
+            const uint64_t seed = seeds_[i], off = subtbl_sz_ * i;
+            for(size_t j = 0; j < nb; ++j) {
+                const uint64_t hv = hash(vals[j] ^ seed);
+                hvs[j * nhashes_ + i] = hv;
+                indices[j * nhashes_ + i] = (hv & mask_) + off;
+            }
+        }
+        for(size_t j = 0; j < nb * nhashes_; ++j)
+            __builtin_prefetch(detail::counter_address(data_, indices[j], 0));
+    }
+public:
+    /*
+     * Concurrent conservative update.
+     * Requires update::Increment with conservative updates over a std::vector of integral counters,
+     * which are accessed with atomic builtins so that one table can be shared by all threads.
+     * add_concurrent reads the row minimum m, then CASes each counter still at m to m + 1.
+     * If one of those CASes fails, another thread moved that counter, and the update is retried from a fresh read.
+     * Counters never fall below the true count, so estimates stay upper bounds; retries can only add overcount.
+     * add_concurrent_relaxed makes a single pass, raising each counter to at least m + 1.
+     * Threads that read the same minimum at once can share one increment, so it may undercount by the number of such collisions.
+     * Plain add/est_count must not run alongside either; use est_count_concurrent for queries during updates.
+     */
+    static constexpr bool supports_concurrent_update() {
+        return is_increment && conservative_update && detail::is_std_vector<VectorType>::value
+            && std::is_integral<counter_register_type>::value;
+    }
+    uint64_t add_concurrent(uint64_t val) {
+        static_assert(supports_concurrent_update(), "Concurrent updates require conservative Increment over a std::vector of integers");
+        tmpbuffer<uint64_t, 16> mem(nhashes_ * 2);
+        uint64_t *ix = mem.get(), *seen = ix + nhashes_;
+        for(unsigned i = 0; i < nhashes_; ++i)
+            ix[i] = (hash(val, i) & mask_) + subtbl_sz_ * i;
+        const uint64_t maxval = max_counter_value();
+        for(;;) {
+            uint64_t m = std::numeric_limits<uint64_t>::max();
+            for(unsigned i = 0; i < nhashes_; ++i)
+                m = std::min(m, seen[i] = __atomic_load_n(&data_[ix[i]], __ATOMIC_RELAXED));
+            if(m >= maxval) return m;
+            bool raced = false;
+            for(unsigned i = 0; i < nhashes_; ++i) {
+                if(seen[i] != m) continue;
+                counter_register_type expected = m;
+                raced |= !__atomic_compare_exchange_n(&data_[ix[i]], &expected, counter_register_type(m + 1), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            }
+            if(!raced) return m + 1;
+        }
+    }
+    uint64_t add_concurrent_relaxed(uint64_t val) {
+        static_assert(supports_concurrent_update(), "Concurrent updates require conservative Increment over a std::vector of integers");
+        tmpbuffer<uint64_t, 8> mem(nhashes_);
+        uint64_t *ix = mem.get();
+        for(unsigned i = 0; i < nhashes_; ++i)
+            ix[i] = (hash(val, i) & mask_) + subtbl_sz_ * i;
+        const uint64_t m = load_min(ix);
+        if(m >= max_counter_value()) return m;
+        const counter_register_type target = m + 1;
+        for(unsigned i = 0; i < nhashes_; ++i) {
+            counter_register_type cur = __atomic_load_n(&data_[ix[i]], __ATOMIC_RELAXED);
+            while(cur < target && !__atomic_compare_exchange_n(&data_[ix[i]], &cur, target, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        }
+        return target;
+    }
+    uint64_t addh_concurrent(uint64_t val) {return add_concurrent(val);}
+    uint64_t est_count_concurrent(uint64_t val) const {
+        static_assert(supports_concurrent_update(), "Concurrent queries require conservative Increment over a std::vector of integers");
+        uint64_t ret = std::numeric_limits<uint64_t>::max();
+        for(unsigned i = 0; i < nhashes_; ++i)
+            ret = std::min(ret, uint64_t(__atomic_load_n(&data_[(hash(val, i) & mask_) + subtbl_sz_ * i], __ATOMIC_RELAXED)));
+        return ret;
+    }
+private:
+    uint64_t max_counter_value() const {
+        const unsigned nb = std::min(unsigned(nbits_), unsigned(sizeof(counter_register_type) * CHAR_BIT));
+        return nb >= 64 ? std::numeric_limits<uint64_t>::max(): (uint64_t(1) << nb) - 1;
+    }
+    uint64_t load_min(const uint64_t *ix) const {
+        uint64_t ret = std::numeric_limits<uint64_t>::max();
+        for(unsigned i = 0; i < nhashes_; ++i)
+            ret = std::min(ret, uint64_t(__atomic_load_n(&data_[ix[i]], __ATOMIC_RELAXED)));
+        return ret;
+    }
+public:
     ccmbase_t operator+(const ccmbase_t &other) const {
         ccmbase_t cpy = *this;
         cpy += other;
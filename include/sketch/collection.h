@@ -0,0 +1,484 @@
+#ifndef SKETCH_COLLECTION_H__
+#define SKETCH_COLLECTION_H__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hll.h"
+#include "setsketch.h"
+#include "bbmh.h"
+#ifndef VEC_DISABLED__
+#include "hmh.h"
+#endif
+
+namespace sketch {
+
+namespace coll {
+
+/*
+ * Uncompressed, versioned container for N sketches of one type and one set of parameters.
+ *
+ * Layout (host byte order, which must be little-endian):
+ *   [0, 128)                       header_t
+ *   [128, data_offset)             double[n] cardinality estimates, then zero padding
+ *   [data_offset + i * stride, +)  registers of sketch i, zero-padded to stride
+ * data_offset and stride are multiples of ALIGNMENT, so registers are aligned for SIMD loads
+ * when the file is mapped.
+ *
+ * collection_t<Sketch> maps a file read-only and returns views which compare sketches
+ * directly from the mapping: opening costs O(1), and the page cache is shared between processes.
+ */
+
+static constexpr uint32_t VERSION = 1;
+static constexpr size_t ALIGNMENT = 64;
+
+enum SketchKind: uint32_t {
+    HLL        = 1,
+    SETSKETCH  = 2,
+    CSETSKETCH = 3,
+    FINAL_BBMH = 4,
+    HMH        = 5
+};
+
+struct header_t {
+    char magic[8];          // "SKCOLL\0\0"
+    uint32_t version;
+    uint32_t kind;          // SketchKind
+    uint64_t n;             // Number of sketches
+    uint64_t nregisters;    // Registers per sketch
+    uint64_t record_bytes;  // Bytes of register data per sketch
+    uint64_t stride;        // Bytes between consecutive sketches
+    uint64_t data_offset;   // Offset of the first sketch's registers
+    uint32_t register_size; // Bytes per register
+    uint32_t flags;         // Reserved
+    uint64_t iparams[4];    // Kind-specific parameters
+    double   fparams[4];
+    static constexpr const char *MAGIC() {return "SKCOLL\0";}
+    bool same_params(const header_t &o) const {
+        return kind == o.kind && nregisters == o.nregisters && record_bytes == o.record_bytes && register_size == o.register_size
+            && std::equal(std::begin(iparams), std::end(iparams), std::begin(o.iparams))
+            && std::equal(std::begin(fparams), std::end(fparams), std::begin(o.fparams));
+    }
+};
+static_assert(sizeof(header_t) == 128, "header_t must be 128 bytes");
+
+static inline uint64_t roundup_aligned(uint64_t x) {return (x + ALIGNMENT - 1) & ~uint64_t(ALIGNMENT - 1);}
+
+/*
+ * traits<Sketch> describes a sketch type's record:
+ *   kind, set_params(header, sketch), data(sketch), card(sketch),
+ *   context_type/make_context(header) (parameters shared by all views), check(header) and view_type.
+ */
+template<typename Sketch> struct traits;
+
+// HyperLogLog
+struct hll_context_t {
+    unsigned p;
+    hll::EstimationMethod estim;
+    hll::JointEstimationMethod jestim;
+};
+class hll_view_t {
+    const hll_context_t *ctx_;
+    const uint8_t *regs_;
+    double card_;
+public:
+    hll_view_t(const hll_context_t *ctx, const uint8_t *regs, double card): ctx_(ctx), regs_(regs), card_(card) {}
+    unsigned p() const {return ctx_->p;}
+    size_t m() const {return size_t(1) << ctx_->p;}
+    const uint8_t *data() const {return regs_;}
+    double cardinality_estimate() const {return card_;}
+    double report() const {return card_;}
+    std::array<double, 3> full_set_comparison(const hll_view_t &o) const {
+        if(ctx_->jestim == hll::ERTL_JOINT_MLE) {
+            uint32_t hist[256]{};
+            hll::detail::allpairs_t::joint_counts(regs_, o.regs_, m(), hist);
+            const uint32_t *h = hist;
+            return hll::detail::ertl_joint_estimate(h, h + 64, h + 128, h + 192, card_, o.card_, m(), p(), 64 - p());
+        }
+        const double us = union_size(o),
+                     is = std::max(card_ + o.card_ - us, 0.);
+        return std::array<double, 3>{{std::max(card_ - is, 0.), std::max(o.card_ - is, 0.), is}};
+    }
+    double union_size(const hll_view_t &o) const {
+        if(ctx_->jestim == hll::ERTL_JOINT_MLE) {
+            const auto f = full_set_comparison(o);
+            return f[0] + f[1] + f[2];
+        }
+        uint32_t counts[64]{};
+        hll::detail::allpairs_t::union_counts(regs_, o.regs_, m(), counts, 0, 63, nullptr);
+        return hll::detail::calculate_estimate(counts, ctx_->estim, m(), p(), make_alpha(m()));
+    }
+    double jaccard_index(const hll_view_t &o) const {
+        if(ctx_->jestim == hll::ERTL_JOINT_MLE) {
+            const auto f = full_set_comparison(o);
+            return f[2] / (f[0] + f[1] + f[2]);
+        }
+        const double us = union_size(o);
+        return std::max(0., (card_ + o.card_ - us) / us);
+    }
+    double containment_index(const hll_view_t &o) const {
+        const auto f = full_set_comparison(o);
+        return f[2] / (f[2] + f[0]);
+    }
+};
+template<typename HS>
+struct traits<hll::hllbase_t<HS>> {
+    using sketch_type = hll::hllbase_t<HS>;
+    using context_type = hll_context_t;
+    using view_type = hll_view_t;
+    static constexpr uint32_t kind = HLL;
+    static void set_params(header_t &h, const sketch_type &s) {
+        h.nregisters = s.m();
+        h.register_size = 1;
+        h.iparams[0] = s.p(); h.iparams[1] = s.get_estim(); h.iparams[2] = s.get_jestim();
+    }
+    static const void *data(const sketch_type &s) {return s.data();}
+    static double card(const sketch_type &s) {
+        return s.get_jestim() != hll::ERTL_JOINT_MLE || s.get_is_ready() ? s.creport()
+                                                                      : hll::detail::ertl_ml_estimate(hll::detail::sum_counts(s.core()), s.p(), s.q());
+    }
+    static void check(const header_t &h) {
+        if(h.register_size != 1 || h.nregisters != uint64_t(1) << h.iparams[0]) throw std::runtime_error("Malformed HLL collection");
+    }
+    static context_type make_context(const header_t &h) {
+        return context_type{unsigned(h.iparams[0]), static_cast<hll::EstimationMethod>(h.iparams[1]), static_cast<hll::JointEstimationMethod>(h.iparams[2])};
+    }
+};
+
+// SetSketch. a and b are stored as doubles.
+struct setsketch_context_t {
+    size_t m;
+    double a, b;
+    int64_t q;
+};
+template<typename ResT>
+class setsketch_view_t {
+    const setsketch_context_t *ctx_;
+    const ResT *regs_;
+    double card_;
+public:
+    setsketch_view_t(const setsketch_context_t *ctx, const ResT *regs, double card): ctx_(ctx), regs_(regs), card_(card) {}
+    size_t size() const {return ctx_->m;}
+    const ResT *data() const {return regs_;}
+    double cardinality_estimate() const {return card_;}
+    size_t shared_registers(const setsketch_view_t &o) const {
+        return eq::count_eq(regs_, o.regs_, ctx_->m);
+    }
+    double jaccard_index(const setsketch_view_t &o) const {
+        auto gtlt = eq::count_gtlt(regs_, o.regs_, ctx_->m);
+        return setsketch::jmle_simple<double>(gtlt.first, gtlt.second, ctx_->m, card_, o.card_, ctx_->b);
+    }
+    std::tuple<double, double, double> jointmle(const setsketch_view_t &o) const {
+        auto ji = jaccard_index(o);
+        const auto y = 1. / (1. + ji);
+        return std::tuple<double, double, double>{std::max(0., card_ - o.card_ * ji) * y,
+                                                  std::max(0., o.card_ - card_ * ji) * y,
+                                                  (card_ + o.card_) * ji * y};
+    }
+    double intersection_size(const setsketch_view_t &o) const {return std::get<2>(jointmle(o));}
+    double containment_index(const setsketch_view_t &o) const {return intersection_size(o) / card_;}
+};
+template<typename ResT, typename FT>
+struct traits<setsketch::SetSketch<ResT, FT>> {
+    using sketch_type = setsketch::SetSketch<ResT, FT>;
+    using context_type = setsketch_context_t;
+    using view_type = setsketch_view_t<ResT>;
+    static constexpr uint32_t kind = SETSKETCH;
+    static void set_params(header_t &h, const sketch_type &s) {
+        h.nregisters = s.size();
+        h.register_size = sizeof(ResT);
+        h.iparams[0] = s.q(); h.iparams[1] = std::is_signed<ResT>::value;
+        h.fparams[0] = s.a(); h.fparams[1] = s.b();
+    }
+    static const void *data(const sketch_type &s) {return s.data();}
+    static double card(const sketch_type &s) {return s.getcard();}
+    static void check(const header_t &h) {
+        if(h.register_size != sizeof(ResT) || h.iparams[1] != std::is_signed<ResT>::value) throw std::runtime_error("SetSketch collection has a different register type");
+    }
+    static context_type make_context(const header_t &h) {
+        return context_type{size_t(h.nregisters), h.fparams[0], h.fparams[1], int64_t(h.iparams[0])};
+    }
+};
+
+// Continuous SetSketch
+struct csetsketch_context_t {
+    size_t m;
+};
+template<typename FT>
+class csetsketch_view_t {
+    const csetsketch_context_t *ctx_;
+    const FT *regs_;
+    double card_;
+public:
+    csetsketch_view_t(const csetsketch_context_t *ctx, const FT *regs, double card): ctx_(ctx), regs_(regs), card_(card) {}
+    size_t size() const {return ctx_->m;}
+    const FT *data() const {return regs_;}
+    double cardinality_estimate() const {return card_;}
+    size_t shared_registers(const csetsketch_view_t &o) const {
+        CONST_IF(sizeof(FT) == 4) {
+            return eq::count_eq((const uint32_t *)regs_, (const uint32_t *)o.regs_, ctx_->m);
+        } else CONST_IF(sizeof(FT) == 8) {
+            return eq::count_eq((const uint64_t *)regs_, (const uint64_t *)o.regs_, ctx_->m);
+        } else CONST_IF(sizeof(FT) == 2) {
+            return eq::count_eq((const uint16_t *)regs_, (const uint16_t *)o.regs_, ctx_->m);
+        }
+        size_t ret = 0;
+        for(size_t i = 0; i < ctx_->m; ++i) ret += regs_[i] == o.regs_[i];
+        return ret;
+    }
+    double jaccard_index(const csetsketch_view_t &o) const {return shared_registers(o) / double(ctx_->m);}
+    std::tuple<double, double, double> alpha_beta_mu(const csetsketch_view_t &o) const {
+        auto gtlt = eq::count_gtlt(regs_, o.regs_, ctx_->m);
+        const double alpha = double(gtlt.first) / ctx_->m, beta = double(gtlt.second) / ctx_->m;
+        if(alpha + beta >= 1.) // They seem to be disjoint sets, use SetSketch (15)
+            return std::tuple<double, double, double>{card_ / (card_ + o.card_), o.card_ / (card_ + o.card_), card_ + o.card_};
+        return std::tuple<double, double, double>{alpha, beta, std::max((card_ + o.card_) / (2. - alpha - beta), 0.)};
+    }
+    double union_size(const csetsketch_view_t &o) const {return std::get<2>(alpha_beta_mu(o));}
+    double intersection_size(const csetsketch_view_t &o) const {
+        auto abm = alpha_beta_mu(o);
+        return std::max(1. - (std::get<0>(abm) + std::get<1>(abm)), 0.) * std::get<2>(abm);
+    }
+    double containment_index(const csetsketch_view_t &o) const {
+        auto abm = alpha_beta_mu(o);
+        auto lho = std::get<0>(abm);
+        auto isf = std::max(1. - (lho + std::get<1>(abm)), 0.);
+        return isf / (lho + isf);
+    }
+};
+template<typename FT>
+struct traits<setsketch::CSetSketch<FT>> {
+    using sketch_type = setsketch::CSetSketch<FT>;
+    using context_type = csetsketch_context_t;
+    using view_type = csetsketch_view_t<FT>;
+    static constexpr uint32_t kind = CSETSKETCH;
+    static void set_params(header_t &h, const sketch_type &s) {
+        h.nregisters = s.size();
+        h.register_size = sizeof(FT);
+    }
+    static const void *data(const sketch_type &s) {return s.data();}
+    static double card(const sketch_type &s) {return s.getcard();}
+    static void check(const header_t &h) {
+        if(h.register_size != sizeof(FT)) throw std::runtime_error("CSetSketch collection has a different register type");
+    }
+    static context_type make_context(const header_t &h) {return context_type{size_t(h.nregisters)};}
+};
+
+// b-bit minhash
+struct bbmh_context_t {
+    unsigned b, p;
+    size_t nwords;
+};
+class bbmh_view_t {
+    const bbmh_context_t *ctx_;
+    const uint64_t *words_;
+    double card_;
+public:
+    bbmh_view_t(const bbmh_context_t *ctx, const uint64_t *words, double card): ctx_(ctx), words_(words), card_(card) {}
+    const uint64_t *data() const {return words_;}
+    double cardinality_estimate() const {return card_;}
+    uint64_t equal_bblocks(const bbmh_view_t &o) const {
+        return minhash::FinalBBitMinHash::equal_bblocks(words_, o.words_, ctx_->nwords, ctx_->b, ctx_->p);
+    }
+    double jaccard_index(const bbmh_view_t &o) const {
+        const double b2pow = std::ldexp(1., -int(ctx_->b));
+        double frac = std::ldexp(equal_bblocks(o), -int(ctx_->p));
+        frac -= b2pow;
+        return std::max(0., frac / (1. - b2pow));
+    }
+    double intersection_size(const bbmh_view_t &o) const {
+        double ji = jaccard_index(o);
+        return (card_ + o.card_) * ji / (1. + ji);
+    }
+    double union_size(const bbmh_view_t &o) const {return card_ + o.card_ - intersection_size(o);}
+    double containment_index(const bbmh_view_t &o) const {return intersection_size(o) / card_;}
+};
+template<>
+struct traits<minhash::FinalBBitMinHash> {
+    using sketch_type = minhash::FinalBBitMinHash;
+    using context_type = bbmh_context_t;
+    using view_type = bbmh_view_t;
+    static constexpr uint32_t kind = FINAL_BBMH;
+    static void set_params(header_t &h, const sketch_type &s) {
+        h.nregisters = s.core_.size();
+        h.register_size = sizeof(uint64_t);
+        h.iparams[0] = s.b_; h.iparams[1] = s.p_;
+    }
+    static const void *data(const sketch_type &s) {return s.core_.data();}
+    static double card(const sketch_type &s) {return s.cardinality_estimate();}
+    static void check(const header_t &h) {
+        if(h.register_size != sizeof(uint64_t)) throw std::runtime_error("Malformed b-bit minhash collection");
+    }
+    static context_type make_context(const header_t &h) {return context_type{unsigned(h.iparams[0]), unsigned(h.iparams[1]), size_t(h.nregisters)};}
+};
+
+#ifndef VEC_DISABLED__
+// HyperMinHash. Views share one parameter-only sketch for the collision estimate.
+struct hmh_context_t {
+    hmh::hmh_t params;
+    size_t nbytes;
+};
+class hmh_view_t {
+    const hmh_context_t *ctx_;
+    const uint8_t *regs_;
+    double card_;
+public:
+    hmh_view_t(const hmh_context_t *ctx, const uint8_t *regs, double card): ctx_(ctx), regs_(regs), card_(card) {}
+    const uint8_t *data() const {return regs_;}
+    double cardinality_estimate() const {return card_;}
+    double jaccard_index(const hmh_view_t &o) const {
+        const uint64_t cc_nc = hmh::hmh_t::calculate_cc_nc(regs_, o.regs_, ctx_->nbytes, ctx_->params.lrszm3());
+        if(!(cc_nc >> 32)) return 0.;
+        return ctx_->params.jaccard_index(cc_nc, card_, o.card_);
+    }
+};
+template<>
+struct traits<hmh::hmh_t> {
+    using sketch_type = hmh::hmh_t;
+    using context_type = hmh_context_t;
+    using view_type = hmh_view_t;
+    static constexpr uint32_t kind = HMH;
+    static void set_params(header_t &h, const sketch_type &s) {
+        h.nregisters = s.num_registers();
+        h.register_size = s.nbytes() >> s.p();
+        h.iparams[0] = s.p(); h.iparams[1] = s.regsize();
+    }
+    static const void *data(const sketch_type &s) {return s.data();}
+    static double card(const sketch_type &s) {return s.cardinality_estimate();}
+    static void check(const header_t &h) {
+        if(h.register_size * 8 != h.iparams[1])
+            throw std::runtime_error("Malformed HyperMinHash collection");
+    }
+    static context_type make_context(const header_t &h) {
+        return context_type{hmh::hmh_t(h.iparams[0], h.register_size * 8), size_t(h.record_bytes)};
+    }
+};
+#endif
+
+// Writes sketches [beg, end), which must share parameters, as an uncompressed collection.
+template<typename It>
+void write_collection(const std::string &path, It beg, It end) {
+    using sketch_type = std::decay_t<decltype(*beg)>;
+    using traits_type = traits<sketch_type>;
+    header_t h{};
+    std::memcpy(h.magic, header_t::MAGIC(), sizeof(h.magic));
+    h.version = VERSION;
+    h.kind = traits_type::kind;
+    h.n = std::distance(beg, end);
+    if(h.n) traits_type::set_params(h, *beg);
+    h.record_bytes = h.nregisters * h.register_size;
+    h.stride = roundup_aligned(h.record_bytes);
+    h.data_offset = roundup_aligned(sizeof(header_t) + h.n * sizeof(double));
+    std::FILE *fp = std::fopen(path.data(), "wb");
+    if(!fp) throw std::runtime_error(std::string("Could not open file at '") + path + "' for writing");
+    auto checkwrite = [fp,&path](const void *ptr, size_t nb) {
+        if(nb && std::fwrite(ptr, 1, nb, fp) != nb) {
+            std::fclose(fp);
+            throw std::runtime_error(std::string("Failed to write collection to ") + path);
+        }
+    };
+    static const char zeros[ALIGNMENT]{};
+    checkwrite(&h, sizeof(h));
+    for(auto it = beg; it != end; ++it) {
+        header_t ih{};
+        ih.kind = h.kind;
+        traits_type::set_params(ih, *it);
+        ih.record_bytes = ih.nregisters * ih.register_size;
+        if(!ih.same_params(h)) {
+            std::fclose(fp);
+            throw std::invalid_argument("All sketches in a collection must have the same parameters");
+        }
+        const double card = traits_type::card(*it);
+        checkwrite(&card, sizeof(card));
+    }
+    checkwrite(zeros, h.data_offset - sizeof(header_t) - h.n * sizeof(double));
+    for(auto it = beg; it != end; ++it) {
+        checkwrite(traits_type::data(*it), h.record_bytes);
+        checkwrite(zeros, h.stride - h.record_bytes);
+    }
+    std::fclose(fp);
+}
+template<typename Sketch>
+void write_collection(const std::string &path, const std::vector<Sketch> &sketches) {
+    write_collection(path, sketches.begin(), sketches.end());
+}
+
+// Read-only memory-mapped collection of Sketch.
+template<typename Sketch>
+class collection_t {
+public:
+    using traits_type = traits<Sketch>;
+    using context_type = typename traits_type::context_type;
+    using view_type = typename traits_type::view_type;
+private:
+    const uint8_t *map_ = nullptr;
+    size_t mapsz_ = 0;
+    const header_t *header_ = nullptr;
+    const double *cards_ = nullptr;
+    std::unique_ptr<context_type> ctx_;
+    void unmap() {
+        if(map_) ::munmap(const_cast<uint8_t *>(map_), mapsz_);
+        map_ = nullptr;
+    }
+public:
+    explicit collection_t(const std::string &path) {
+        const int fd = ::open(path.data(), O_RDONLY);
+        if(fd < 0) throw std::runtime_error(std::string("Could not open file at '") + path + "' for reading");
+        struct stat st;
+        if(::fstat(fd, &st) || size_t(st.st_size) < sizeof(header_t)) {
+            ::close(fd);
+            throw std::runtime_error(std::string("File at '") + path + "' is too small to be a sketch collection");
+        }
+        mapsz_ = st.st_size;
+        void *ptr = ::mmap(nullptr, mapsz_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd); // The mapping holds its own reference
+        if(ptr == MAP_FAILED) throw std::runtime_error(std::string("Failed to mmap '") + path + "'");
+        map_ = static_cast<const uint8_t *>(ptr);
+        header_ = reinterpret_cast<const header_t *>(map_);
+        const header_t &h = *header_;
+        try {
+            if(std::memcmp(h.magic, header_t::MAGIC(), sizeof(h.magic)))
+                throw std::runtime_error(std::string("'") + path + "' is not a sketch collection");
+            if(h.version != VERSION)
+                throw std::runtime_error(std::string("Unsupported sketch collection version ") + std::to_string(h.version));
+            if(h.kind != traits_type::kind)
+                throw std::runtime_error(std::string("Sketch collection holds kind ") + std::to_string(h.kind) + ", expected " + std::to_string(traits_type::kind));
+            if(h.n && (h.record_bytes != h.nregisters * h.register_size || h.stride < h.record_bytes || h.stride % ALIGNMENT || h.data_offset % ALIGNMENT
+                       || h.data_offset < sizeof(header_t) + h.n * sizeof(double) || h.data_offset + h.n * h.stride > mapsz_))
+                throw std::runtime_error(std::string("Sketch collection at '") + path + "' is truncated or malformed");
+            if(h.n) traits_type::check(h);
+        } catch(...) {
+            unmap();
+            throw;
+        }
+        cards_ = reinterpret_cast<const double *>(map_ + sizeof(header_t));
+        ctx_.reset(new context_type(traits_type::make_context(h)));
+    }
+    collection_t(const collection_t &) = delete;
+    collection_t &operator=(const collection_t &) = delete;
+    collection_t(collection_t &&o): map_(o.map_), mapsz_(o.mapsz_), header_(o.header_), cards_(o.cards_), ctx_(std::move(o.ctx_)) {
+        o.map_ = nullptr;
+    }
+    ~collection_t() {unmap();}
+
+    const header_t &header() const {return *header_;}
+    size_t size() const {return header_->n;}
+    const context_type &context() const {return *ctx_;}
+    double cardinality(size_t i) const {return cards_[i];}
+    const uint8_t *record(size_t i) const {return map_ + header_->data_offset + i * header_->stride;}
+    // Views refer to the mapping and must not outlive the collection.
+    view_type operator[](size_t i) const {
+        using RegT = std::remove_cv_t<std::remove_pointer_t<decltype(std::declval<view_type>().data())>>;
+        return view_type(ctx_.get(), reinterpret_cast<const RegT *>(record(i)), cards_[i]);
+    }
+    view_type at(size_t i) const {
+        if(i >= size()) throw std::out_of_range(std::string("Index ") + std::to_string(i) + " out of range for collection of size " + std::to_string(size()));
+        return operator[](i);
+    }
+};
+
+} // namespace coll
+
+} // namespace sketch
+
+#endif /* SKETCH_COLLECTION_H__ */
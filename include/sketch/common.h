@@ -298,6 +298,13 @@ struct tmpbuffer {
     auto end()  const {return cend();}
 };
 
+// Small per-thread integer, assigned round-robin on a thread's first call.
+inline unsigned thread_slot() {
+    static std::atomic<unsigned> next{0};
+    thread_local const unsigned slot = next++;
+    return slot;
+}
+
 } // namespace detail
 
 template<typename T>
@@ -1,14 +1,19 @@
 #ifndef DDSKETCH_H__
 #define DDSKETCH_H__
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <numeric>
 #include <limits>
 #include <stdexcept>
+#include <type_traits>
 #include <cmath>
 
 #include "macros.h"
+#include "intrinsics.h"
+#include "exception.h"
 
 namespace sketch {
 
@@ -22,17 +27,107 @@ using std::uint64_t;
 // Based on implementation from https://raw.githubusercontent.com/DataDog/sketches-py/master/ddsketch/ddsketch.py
 // Accessed 9/6/19
 
-template<typename IntegerType=std::int64_t, size_t initial_nbins=128, size_t grow_left_by=128>
+namespace detail {
+// Natural log for the key mapping: the exponent, plus the log of the mantissa (reduced to [sqrt(1/2), sqrt(2)))
+// from the series 2 * (t + t^3/3 + ... + t^13/13), t = (m - 1) / (m + 1), which is accurate to about 1e-12.
+// The scalar and SIMD versions perform the same IEEE operations, so addh and add_batch agree on every key.
+// x must be positive and normal.
+static constexpr double LOG_SERIES[] = {1., 1. / 3, 1. / 5, 1. / 7, 1. / 9, 1. / 11, 1. / 13};
+static constexpr double LN2 = 0.693147180559945309417;
+static constexpr double SQRT2 = 1.41421356237309504880;
+static constexpr uint64_t MANTISSA_MASK = 0x000FFFFFFFFFFFFFull;
+static constexpr uint64_t EXPONENT_ONE = 0x3FF0000000000000ull;
+static constexpr uint64_t EXPONENT_MAGIC = 0x4330000000000000ull; // 2^52: or'd with the biased exponent, reads as 2^52 + exponent
+static constexpr double EXPONENT_BIAS = 0x1p52 + 1023.;
+
+INLINE double dd_log(double x) {
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    const uint64_t mbits = (bits & MANTISSA_MASK) | EXPONENT_ONE, ebits = (bits >> 52) | EXPONENT_MAGIC;
+    double m, e;
+    std::memcpy(&m, &mbits, sizeof(m));
+    std::memcpy(&e, &ebits, sizeof(e));
+    e -= EXPONENT_BIAS;
+    if(m > SQRT2) m *= .5, e += 1.;
+    const double t = (m - 1.) / (m + 1.), s = t * t;
+    double p = std::fma(s, LOG_SERIES[6], LOG_SERIES[5]);
+    for(int i = 4; i >= 0; --i) p = std::fma(p, s, LOG_SERIES[i]);
+    return std::fma(e, LN2, (t + t) * p);
+}
+#if __AVX512F__
+INLINE __m512d dd_log(__m512d x) {
+    const __m512i bits = _mm512_castpd_si512(x);
+    __m512d m = _mm512_castsi512_pd(_mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi64(MANTISSA_MASK)), _mm512_set1_epi64(EXPONENT_ONE)));
+    __m512d e = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(_mm512_srli_epi64(bits, 52), _mm512_set1_epi64(EXPONENT_MAGIC))), _mm512_set1_pd(EXPONENT_BIAS));
+    const __mmask8 big = _mm512_cmp_pd_mask(m, _mm512_set1_pd(SQRT2), _CMP_GT_OQ);
+    m = _mm512_mask_mul_pd(m, big, m, _mm512_set1_pd(.5));
+    e = _mm512_mask_add_pd(e, big, e, _mm512_set1_pd(1.));
+    const __m512d one = _mm512_set1_pd(1.), t = _mm512_div_pd(_mm512_sub_pd(m, one), _mm512_add_pd(m, one)), s = _mm512_mul_pd(t, t);
+    __m512d p = _mm512_fmadd_pd(s, _mm512_set1_pd(LOG_SERIES[6]), _mm512_set1_pd(LOG_SERIES[5]));
+    for(int i = 4; i >= 0; --i) p = _mm512_fmadd_pd(p, s, _mm512_set1_pd(LOG_SERIES[i]));
+    return _mm512_fmadd_pd(e, _mm512_set1_pd(LN2), _mm512_mul_pd(_mm512_add_pd(t, t), p));
+}
+#elif __AVX2__ && __FMA__
+INLINE __m256d dd_log(__m256d x) {
+    const __m256i bits = _mm256_castpd_si256(x);
+    __m256d m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(MANTISSA_MASK)), _mm256_set1_epi64x(EXPONENT_ONE)));
+    __m256d e = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52), _mm256_set1_epi64x(EXPONENT_MAGIC))), _mm256_set1_pd(EXPONENT_BIAS));
+    const __m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(SQRT2), _CMP_GT_OQ);
+    m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(.5)), big);
+    e = _mm256_add_pd(e, _mm256_and_pd(big, _mm256_set1_pd(1.)));
+    const __m256d one = _mm256_set1_pd(1.), t = _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one)), s = _mm256_mul_pd(t, t);
+    __m256d p = _mm256_fmadd_pd(s, _mm256_set1_pd(LOG_SERIES[6]), _mm256_set1_pd(LOG_SERIES[5]));
+    for(int i = 4; i >= 0; --i) p = _mm256_fmadd_pd(p, s, _mm256_set1_pd(LOG_SERIES[i]));
+    return _mm256_fmadd_pd(e, _mm256_set1_pd(LN2), _mm256_mul_pd(_mm256_add_pd(t, t), p));
+}
+#endif
+
+static inline void write_varint(std::vector<uint8_t> &out, uint64_t x) {
+    for(; x >= 0x80; x >>= 7) out.push_back(uint8_t(x) | 0x80);
+    out.push_back(uint8_t(x));
+}
+static inline uint64_t read_varint(const uint8_t *&p, const uint8_t *end) {
+    uint64_t ret = 0;
+    for(unsigned shift = 0; p < end && shift < 64; shift += 7) {
+        const uint8_t c = *p++;
+        ret |= uint64_t(c & 0x7F) << shift;
+        if(!(c & 0x80)) return ret;
+    }
+    throw std::runtime_error("Truncated or corrupt DDSketch serialization");
+}
+template<typename T>
+static inline void write_raw(std::vector<uint8_t> &out, const T &x) {
+    const size_t pos = out.size();
+    out.resize(pos + sizeof(T));
+    std::memcpy(out.data() + pos, &x, sizeof(T));
+}
+template<typename T>
+static inline T read_raw(const uint8_t *&p, const uint8_t *end) {
+    if(size_t(end - p) < sizeof(T)) throw std::runtime_error("Truncated DDSketch serialization");
+    T ret;
+    std::memcpy(&ret, p, sizeof(T));
+    p += sizeof(T);
+    return ret;
+}
+} // namespace detail
+
+// Dense store over a contiguous range of signed keys, holding at most maxbins_ bins.
+// Bins are allocated in chunks of grow_by around the keys seen so far. Once the key range would need more than
+// maxbins_ bins, the lowest keys are collapsed into the lowest remaining bin, so memory stays fixed
+// and the accuracy guarantee is kept for all but the lowest ranks.
+template<typename IntegerType=std::int64_t, size_t initial_nbins=128, size_t grow_by=128>
 struct Store {
 
-    const size_t maxbins_;
-    std::vector<IntegerType> bins_; // TODO: consider using std::deque; this depends on how often it needs to shift
-    size_t count_;
-    uint64_t mink_, maxk_;
+    size_t maxbins_;
+    std::vector<IntegerType> bins_;
+    uint64_t count_;
+    int64_t offset_; // Key of bins_[0]
+    int64_t mink_, maxk_;
+    bool collapsed_;
 
     using Type = IntegerType;
 
-    Store(size_t maxnbins): maxbins_(maxnbins), bins_(initial_nbins, 0), count_(0), mink_(0), maxk_(0) {}
+    Store(size_t maxnbins): maxbins_(std::max(maxnbins, size_t(1))), count_(0), offset_(0), mink_(0), maxk_(0), collapsed_(false) {}
     Store(const Store &o) = default;
     Store(Store &&o) = default;
 
@@ -46,141 +141,465 @@ struct Store {
     IntegerType &operator[](size_t i) {return bins_[i];}
     const IntegerType &operator[](size_t i) const {return bins_[i];}
 
+    size_t size() const {return bins_.size();}
+    bool empty() const {return bins_.empty();}
+    uint64_t count() const {return count_;}
+    bool collapsed() const {return collapsed_;}
+    int64_t min_key() const {return mink_;}
+    int64_t max_key() const {return maxk_;}
+    IntegerType count_at(int64_t key) const {return key < mink_ || key > maxk_ ? IntegerType(0): bins_[key - offset_];}
+
     Store &operator+=(const Store &o) {
-        if(o.count_ == 0) return *this;
-        if(count_ == 0)
-            std::copy(o.begin(), o.end(), begin());
-        const bool minklt = o.mink_ < mink_;
-        if(maxk_ > o.maxk_) {
-            if(minklt) grow_left(o.mink_);
-
-            for(size_t i = std::max(mink_, o.mink_), e = o.maxk_ + 1;i < e; ++i)
-                bins_[i - mink_] += o.bins_[i - o.mink_];
-
-            if(!minklt)
-                bins_.front() += std::accumulate(o.begin(), o.begin() + (mink_ - o.mink_), IntegerType(0));
-        } else {
-            if(minklt) {
-                auto tmp = o.bins_;
-                for(size_t i = mink_; i < maxk_ + 1; ++i)
-                    tmp[i - o.mink_] += bins_[i - mink_];
-                bins_ = std::move(tmp);
-                maxk_ = o.maxk_;
-                mink_ = o.mink_;
-            } else {
-                grow_right(maxk_);
-                for(size_t i = o.mink_; i < o.maxk_ + 1; ++i)
-                    bins_[i - mink_] += o.bins_[i - o.mink_];
-            }
-        }
+        if(o.empty()) return *this;
+        cover(o.mink_, o.maxk_);
+        for(int64_t k = o.mink_; k <= o.maxk_; ++k)
+            bins_[std::max(k, mink_) - offset_] += o.bins_[k - o.offset_];
         count_ += o.count_;
+        collapsed_ |= o.collapsed_;
         return *this;
     }
-    Store operator+(const Store &o) {
+    Store operator+(const Store &o) const {
         auto ret = *this;
         ret += o;
         return ret;
     }
 
-    void addh(uint64_t key) {
-        if(unlikely(count_ == 0))
-            mink_ = maxk_ = key;
-        else {
-            if(key < mink_) grow_left(key);
-            else grow_right(key);
+    void addh(int64_t key, IntegerType weight=1) {
+        if(unlikely(empty() || key > maxk_ || key < mink_)) {
+            if(!empty() && key < mink_ && collapsed_) key = mink_;
+            else extend_range(empty() ? key: std::min(key, mink_), empty() ? key: std::max(key, maxk_));
         }
-        ++bins_[std::max(ssize_t(0), ssize_t(key - mink_))];
-        ++count_;
+        bins_[std::max(key, mink_) - offset_] += weight;
+        count_ += weight;
     }
-    size_t size() const {return bins_.size();}
-    void grow_left(uint64_t key) {
-        if(mink_ < key || size() >= maxbins_) return;
-        uint64_t tmpmink;
-        if(maxk_ - key >= maxbins_) tmpmink = maxk_ - maxbins_ + 1;
-        else {
-            tmpmink = mink_;
-            while(tmpmink > key) tmpmink -= grow_left_by;
-        }
-        bins_.insert(bins_.begin(), mink_ - key, IntegerType(0));
-        mink_ = tmpmink;
-    }
-    void grow_right(uint64_t key) {
-        if(key < maxk_) return;
-        if(key - maxk_ >= maxbins_) {
-            bins_.resize(maxbins_);
-            std::fill(std::begin(bins_) + 1, std::end(bins_), 0);
-            bins_.front() = count_;
-            maxk_ = key;
-            mink_ = key - maxbins_ + 1;
-        } else if(key - mink_ >= maxbins_) {
-            auto tmpmink = key - maxbins_ + 1;
-            auto keydiff = tmpmink - mink_;
-            auto beg = std::begin(bins_);
-            auto endit = beg + keydiff - 1;
-            auto n = std::accumulate(beg + 1, endit, *beg);
-            bins_.erase(beg, endit);
-            bins_.insert(bins_.end(), key - maxk_, IntegerType(0));
-            maxk_ = key;
-            mink_ = tmpmink;
-            bins_.front() += n;
-        } else {
-            bins_.insert(bins_.end(), key - maxk_, IntegerType(0));
-            maxk_ = key;
+    // Adds a block of keys, extending the range once for all of them.
+    template<typename KeyT>
+    void add_keys(const KeyT *keys, size_t n) {
+        if(!n) return;
+        const auto mm = std::minmax_element(keys, keys + n);
+        const int64_t lo = *mm.first, hi = *mm.second;
+        if(empty() || hi > maxk_ || (lo < mink_ && !collapsed_))
+            extend_range(empty() ? lo: std::min(lo, mink_), empty() ? hi: std::max(hi, maxk_));
+        IntegerType *const b = bins_.data() - offset_;
+        const int64_t mink = mink_;
+        for(size_t i = 0; i < n; ++i)
+            ++b[std::max(int64_t(keys[i]), mink)];
+        count_ += n;
+    }
+    // Makes room for keys lo through hi in addition to those present, collapsing the lowest if needed.
+    void cover(int64_t lo, int64_t hi) {
+        if(empty()) extend_range(lo, hi);
+        else if(lo < mink_ || hi > maxk_) extend_range(std::min(lo, mink_), std::max(hi, maxk_));
+    }
+    // Makes room for keys lo through hi, which must include [mink_, maxk_] if the store is nonempty.
+    // If they span more than maxbins_ keys, keys below hi - maxbins_ + 1 are collapsed into that key's bin.
+    void extend_range(int64_t lo, int64_t hi) {
+        if(uint64_t(hi - lo) >= maxbins_) {
+            lo = hi - int64_t(maxbins_) + 1;
+            collapsed_ = true;
         }
-        throw std::runtime_error("NotImplemented");
-    }
-    auto key_at_rank(uint64_t rank) const {
-        // If this was managed better [e.g., prefix scan] we'd look it up
-        // in log time, but whether that matters depends on the number of bins
-        auto it = std::cbegin(bins_);
-        const auto e = std::cend(bins_);
-        uint64_t n = *it++;
-        do {
-            if(n >= rank) return it - std::cbegin(bins_) + mink_;
-            n += *it++;
-        } while(it != e);
+        const int64_t nkeys = hi - lo + 1;
+        if(empty()) {
+            bins_.assign(new_length(nkeys), IntegerType(0));
+            offset_ = lo - int64_t(bins_.size() - nkeys) / 2;
+        } else if(lo < offset_ || hi >= offset_ + int64_t(bins_.size())) {
+            const size_t len = new_length(nkeys);
+            const int64_t newoff = lo - int64_t(len - nkeys) / 2;
+            if(lo > maxk_) {
+                // Every current key collapses into lo
+                const IntegerType total = std::accumulate(bins_.begin() + (mink_ - offset_), bins_.begin() + (maxk_ - offset_ + 1), IntegerType(0));
+                bins_.assign(len, IntegerType(0));
+                bins_[lo - newoff] = total;
+            } else {
+                collapse_below(lo);
+                // Slide the occupied keys into place in the (possibly larger) window, and clear the rest.
+                const int64_t from = std::max(mink_, lo);
+                if(len > bins_.size()) bins_.resize(len, IntegerType(0));
+                IntegerType *const b = bins_.data();
+                std::memmove(b + (from - newoff), b + (from - offset_), (maxk_ - from + 1) * sizeof(IntegerType));
+                std::fill(b, b + (from - newoff), IntegerType(0));
+                std::fill(b + (maxk_ - newoff + 1), b + len, IntegerType(0));
+            }
+            offset_ = newoff;
+        } else collapse_below(lo);
+        mink_ = lo;
+        maxk_ = hi;
+    }
+    int64_t key_at_rank(double rank) const {
+        double n = 0;
+        for(int64_t k = mink_; k <= maxk_; ++k)
+            if((n += bins_[k - offset_]) > rank) return k;
         return maxk_;
     }
+    template<typename F>
+    void for_each(const F &f) const {
+        for(int64_t k = mink_; !empty() && k <= maxk_; ++k)
+            if(const auto c = bins_[k - offset_]) f(k, c);
+    }
+    // Appends the number of nonzero bins, then if there are any, a collapsed flag, the range of keys
+    // (zigzag-encoded lowest key and span), and a (key delta, count) pair per nonzero bin, all as varints.
+    // Counts of a non-integral type are written as raw bytes.
+    void serialize(std::vector<uint8_t> &out) const {
+        uint64_t nnz = 0;
+        for_each([&nnz](int64_t, IntegerType) {++nnz;});
+        detail::write_varint(out, nnz);
+        if(!nnz) return;
+        out.push_back(collapsed_);
+        detail::write_varint(out, (uint64_t(mink_) << 1) ^ uint64_t(mink_ >> 63));
+        detail::write_varint(out, uint64_t(maxk_ - mink_));
+        int64_t last = mink_;
+        for_each([&](int64_t k, IntegerType c) {
+            detail::write_varint(out, uint64_t(k - last));
+            if constexpr(std::is_integral_v<IntegerType>) detail::write_varint(out, uint64_t(c));
+            else detail::write_raw(out, c);
+            last = k;
+        });
+    }
+    // Reads a store written by serialize, returning the position after it.
+    const uint8_t *deserialize(const uint8_t *p, const uint8_t *end) {
+        clear();
+        const uint64_t nnz = detail::read_varint(p, end);
+        if(!nnz) return p;
+        const bool collapsed = detail::read_raw<uint8_t>(p, end);
+        const uint64_t zz = detail::read_varint(p, end);
+        const int64_t lo = int64_t(zz >> 1) ^ -int64_t(zz & 1), hi = lo + int64_t(detail::read_varint(p, end));
+        if(uint64_t(hi - lo) >= maxbins_) throw std::runtime_error("Serialized DDSketch store exceeds its bin limit");
+        extend_range(lo, hi);
+        int64_t k = lo;
+        for(uint64_t i = 0; i < nnz; ++i) {
+            k += detail::read_varint(p, end);
+            if(k > hi) throw std::runtime_error("Corrupt DDSketch serialization: key out of range");
+            IntegerType c;
+            if constexpr(std::is_integral_v<IntegerType>) c = IntegerType(detail::read_varint(p, end));
+            else c = detail::read_raw<IntegerType>(p, end);
+            bins_[k - offset_] = c;
+            count_ += c;
+        }
+        collapsed_ = collapsed;
+        return p;
+    }
+    void clear() {
+        std::vector<IntegerType>().swap(bins_);
+        count_ = 0;
+        offset_ = mink_ = maxk_ = 0;
+        collapsed_ = false;
+    }
+private:
+    size_t new_length(int64_t nkeys) const {
+        const size_t chunked = (nkeys + grow_by - 1) / grow_by * grow_by;
+        return std::min(maxbins_, std::max({initial_nbins, 2 * bins_.size(), chunked}));
+    }
+    void collapse_below(int64_t lo) {
+        if(lo <= mink_) return;
+        IntegerType &dst = bins_[lo - offset_];
+        for(int64_t k = mink_; k < lo; ++k) {
+            dst += bins_[k - offset_];
+            bins_[k - offset_] = IntegerType(0);
+        }
+    }
 };
 
 template<typename FType=float, typename StoreT=Store<>>
 class DDSketch {
-    const size_t maxbins_;
-    FType alpha_;
-    FType gamma_;
-    FType lgamma_;
-    FType mv_;
+    size_t maxbins_;
+    double alpha_;
+    double gamma_;
+    double lgamma_;
+    double ilgamma_;
+    double mv_;
+    double mvlog_; // Smallest value whose log is taken
+    int64_t offset_;
     double sum_;
     uint64_t count_;
+    uint64_t zero_count_;
     FType lowest_, highest_;
-    int32_t offset_;
-    StoreT store_;
+    StoreT store_;    // Positive values
+    StoreT negative_; // Negative values, by the key of their magnitude
+    static constexpr size_t BATCH_SIZE = 256;
+    static constexpr bool simd_type = std::is_same_v<FType, float> || std::is_same_v<FType, double>;
 public:
     DDSketch(DDSketch &&o) = default;
     DDSketch(const DDSketch &o) = default;
-    DDSketch(FType alpha=1e-2, size_t max_bins=2048, FType min_value=1e-9):
+    DDSketch &operator=(DDSketch &&o) = default;
+    DDSketch &operator=(const DDSketch &o) = default;
+    DDSketch(double alpha=1e-2, size_t max_bins=2048, double min_value=1e-9):
         maxbins_(max_bins),
-        alpha_(alpha), gamma_(1. + 2.*alpha/(1-alpha)), lgamma_(std::log1p(2.*alpha/(1.-alpha))),
-        mv_(min_value), sum_(0), count_(0),
-        lowest_(std::numeric_limits<FType>::min()), highest_(std::numeric_limits<FType>::max()),
-        offset_(-static_cast<int32_t>(std::ceil(std::log(mv_)/lgamma_)) + 1)
+        alpha_(alpha), gamma_(1. + 2.*alpha/(1-alpha)), lgamma_(std::log1p(2.*alpha/(1.-alpha))), ilgamma_(1. / lgamma_),
+        mv_(min_value), mvlog_(std::max(min_value, std::numeric_limits<double>::min())), sum_(0), count_(0), zero_count_(0),
+        lowest_(std::numeric_limits<FType>::max()), highest_(std::numeric_limits<FType>::lowest()),
+        store_(max_bins), negative_(max_bins)
     {
+        if(alpha <= 0. || alpha >= 1.) throw std::invalid_argument("DDSketch relative accuracy must be in (0, 1)");
+        if(min_value <= 0.) throw std::invalid_argument("DDSketch min_value must be positive");
+        offset_ = 1 - static_cast<int64_t>(std::ceil(detail::dd_log(mvlog_) * ilgamma_));
+    }
+    // Values in [-min_value, min_value] have key 0; others have the key of their magnitude, negated for negative values.
+    int64_t get_key(FType val) const {
+        const double v = val;
+        const double k = std::ceil(detail::dd_log(std::max(std::abs(v), mvlog_)) * ilgamma_) + double(offset_);
+        return v > mv_ ? int64_t(k): v < -mv_ ? -int64_t(k): int64_t(0);
     }
-    int64_t get_key(FType val) const  {
-        if(val < -mv_)
-            return -static_cast<int64_t>(std::ceil(std::log(-val)/lgamma_)) - offset_;
-        if(val > mv_)
-            return static_cast<int64_t>(std::ceil(std::log(val)/lgamma_)) + offset_;
-        return 0;
+    // Representative value for a key, within relative error alpha of every value mapped to it.
+    double value(int64_t key) const {
+        if(key == 0) return 0.;
+        const double v = std::exp(double(std::abs(key) - offset_) * lgamma_) * (1. - alpha_);
+        return key > 0 ? v: -v;
     }
     void addh(FType x) {
         auto k = get_key(x);
-        store_.addh(k);
+        if(k > 0) store_.addh(k);
+        else if(k < 0) negative_.addh(-k);
+        else ++zero_count_;
         ++count_;
         sum_ += x;
         if(x < lowest_) lowest_ = x;
         if(x > highest_) highest_ = x;
     }
+    // Adds n values, computing their keys with SIMD a block at a time.
+    void add_batch(const FType *x, size_t n) {
+        int32_t keys[BATCH_SIZE], negkeys[BATCH_SIZE];
+        for(size_t i = 0; i < n; i += BATCH_SIZE) {
+            const size_t nb = std::min(BATCH_SIZE, n - i);
+            batch_keys(x + i, nb, keys);
+            if(*std::min_element(keys, keys + nb) > 0) {
+                store_.add_keys(keys, nb);
+                continue;
+            }
+            size_t npos = 0, nneg = 0;
+            for(size_t j = 0; j < nb; ++j) {
+                if(keys[j] > 0) keys[npos++] = keys[j];
+                else if(keys[j] < 0) negkeys[nneg++] = -keys[j];
+            }
+            zero_count_ += nb - npos - nneg;
+            store_.add_keys(keys, npos);
+            negative_.add_keys(negkeys, nneg);
+        }
+        count_ += n;
+    }
+    double quantile(double q) const {
+        if(!count_) return std::numeric_limits<double>::quiet_NaN();
+        if(q <= 0.) return lowest_;
+        if(q >= 1.) return highest_;
+        return std::min(std::max(value(key_at_rank(q * (count_ - 1))), double(lowest_)), double(highest_));
+    }
+    // Signed key (as from get_key) of the value at this rank, counting from the most negative value.
+    int64_t key_at_rank(double rank) const {
+        const double nneg = negative_.count();
+        if(rank < nneg) return -negative_.key_at_rank(nneg - 1. - std::floor(rank));
+        if((rank -= nneg) < zero_count_) return 0;
+        return store_.key_at_rank(rank - zero_count_);
+    }
+    DDSketch &operator+=(const DDSketch &o) {
+        if(lgamma_ != o.lgamma_ || offset_ != o.offset_)
+            throw std::invalid_argument("DDSketches must share relative accuracy and min_value to be merged");
+        store_ += o.store_;
+        negative_ += o.negative_;
+        zero_count_ += o.zero_count_;
+        count_ += o.count_;
+        sum_ += o.sum_;
+        lowest_ = std::min(lowest_, o.lowest_);
+        highest_ = std::max(highest_, o.highest_);
+        return *this;
+    }
+    DDSketch operator+(const DDSketch &o) const {
+        auto ret = *this;
+        ret += o;
+        return ret;
+    }
+    DDSketch &merge(const DDSketch &o) {return *this += o;}
+    // Merges a range of sketches (or pointers to them), sizing each store once for all of them.
+    template<typename It>
+    DDSketch &merge(It beg, It end) {
+        auto deref = [](const auto &x) -> const DDSketch & {
+            if constexpr(std::is_pointer_v<std::decay_t<decltype(x)>>) return *x;
+            else return x;
+        };
+        int64_t plo = std::numeric_limits<int64_t>::max(), phi = std::numeric_limits<int64_t>::min(), nlo = plo, nhi = phi;
+        for(It it = beg; it != end; ++it) {
+            const DDSketch &o = deref(*it);
+            if(!o.store_.empty()) plo = std::min(plo, o.store_.min_key()), phi = std::max(phi, o.store_.max_key());
+            if(!o.negative_.empty()) nlo = std::min(nlo, o.negative_.min_key()), nhi = std::max(nhi, o.negative_.max_key());
+        }
+        if(plo <= phi) store_.cover(plo, phi);
+        if(nlo <= nhi) negative_.cover(nlo, nhi);
+        for(It it = beg; it != end; ++it) *this += deref(*it);
+        return *this;
+    }
+    // Answers n quantile queries in one pass over the bins, rather than one pass per query.
+    // Results match quantile(qs[i]).
+    void quantiles(const double *qs, size_t n, double *out) const {
+        if(!count_) {
+            std::fill_n(out, n, std::numeric_limits<double>::quiet_NaN());
+            return;
+        }
+        std::vector<std::pair<double, size_t>> ranks;
+        ranks.reserve(n);
+        for(size_t i = 0; i < n; ++i) {
+            if(qs[i] <= 0.) out[i] = lowest_;
+            else if(qs[i] >= 1.) out[i] = highest_;
+            else ranks.emplace_back(std::floor(qs[i] * (count_ - 1)), i);
+        }
+        std::sort(ranks.begin(), ranks.end());
+        size_t next = 0;
+        double cum = 0.;
+        auto visit = [&](int64_t key, double c) {
+            if((cum += c) <= ranks[next].first) return;
+            const double v = std::min(std::max(value(key), double(lowest_)), double(highest_));
+            do out[ranks[next++].second] = v; while(next < ranks.size() && cum > ranks[next].first);
+        };
+        for(int64_t k = negative_.max_key(); !negative_.empty() && next < ranks.size() && k >= negative_.min_key(); --k)
+            if(const auto c = negative_.count_at(k)) visit(-k, c);
+        if(zero_count_ && next < ranks.size()) visit(0, zero_count_);
+        for(int64_t k = store_.min_key(); !store_.empty() && next < ranks.size() && k <= store_.max_key(); ++k)
+            if(const auto c = store_.count_at(k)) visit(k, c);
+        for(; next < ranks.size(); ++next) out[ranks[next].second] = highest_;
+    }
+    std::vector<double> quantiles(const std::vector<double> &qs) const {
+        std::vector<double> ret(qs.size());
+        quantiles(qs.data(), qs.size(), ret.data());
+        return ret;
+    }
+
+    // Compact binary format, in host byte order: a tag, the parameters, count, zero count, sum, minimum and
+    // maximum, then the positive and negative stores (see Store::serialize).
+    static constexpr uint32_t SERIAL_TAG = 0x31534444; // "DDS1"
+    void serialize(std::vector<uint8_t> &out) const {
+        detail::write_raw(out, SERIAL_TAG);
+        detail::write_raw(out, alpha_);
+        detail::write_raw(out, mv_);
+        detail::write_raw(out, uint64_t(maxbins_));
+        detail::write_raw(out, count_);
+        detail::write_raw(out, zero_count_);
+        detail::write_raw(out, sum_);
+        detail::write_raw(out, double(lowest_));
+        detail::write_raw(out, double(highest_));
+        store_.serialize(out);
+        negative_.serialize(out);
+    }
+    std::vector<uint8_t> serialize() const {
+        std::vector<uint8_t> ret;
+        serialize(ret);
+        return ret;
+    }
+    // Reads a sketch written by serialize. If nread is provided, it is set to the number of bytes consumed.
+    static DDSketch deserialize(const uint8_t *data, size_t n, size_t *nread=nullptr) {
+        const uint8_t *p = data, *const end = data + n;
+        if(detail::read_raw<uint32_t>(p, end) != SERIAL_TAG) throw std::runtime_error("Not a serialized DDSketch");
+        const double alpha = detail::read_raw<double>(p, end), mv = detail::read_raw<double>(p, end);
+        DDSketch ret(alpha, detail::read_raw<uint64_t>(p, end), mv);
+        ret.count_ = detail::read_raw<uint64_t>(p, end);
+        ret.zero_count_ = detail::read_raw<uint64_t>(p, end);
+        ret.sum_ = detail::read_raw<double>(p, end);
+        ret.lowest_ = detail::read_raw<double>(p, end);
+        ret.highest_ = detail::read_raw<double>(p, end);
+        p = ret.store_.deserialize(p, end);
+        p = ret.negative_.deserialize(p, end);
+        if(nread) *nread = p - data;
+        return ret;
+    }
+    void write(gzFile fp) const {
+        const auto buf = serialize();
+        const uint64_t nb = buf.size();
+        if(gzwrite(fp, &nb, sizeof(nb)) != sizeof(nb) || gzwrite(fp, buf.data(), nb) != ssize_t(nb))
+            throw ZlibError("Error writing DDSketch to file.");
+    }
+    void write(const char *path) const {
+        gzFile fp(gzopen(path, "wb"));
+        if(!fp) throw ZlibError(Z_ERRNO, std::string("Could not open file at '") + path + "' for writing");
+        write(fp);
+        gzclose(fp);
+    }
+    void write(const std::string &path) const {write(path.data());}
+    void read(gzFile fp) {
+        uint64_t nb;
+        if(gzread(fp, &nb, sizeof(nb)) != sizeof(nb)) throw ZlibError("Error reading DDSketch from file.");
+        std::vector<uint8_t> buf(nb);
+        if(gzread(fp, buf.data(), nb) != ssize_t(nb)) throw ZlibError("Error reading DDSketch from file.");
+        *this = deserialize(buf.data(), buf.size());
+    }
+    void read(const char *path) {
+        gzFile fp(gzopen(path, "rb"));
+        if(fp == nullptr) throw std::runtime_error(std::string("Could not open file at '") + path + "' for reading");
+        read(fp);
+        gzclose(fp);
+    }
+    void read(const std::string &path) {read(path.data());}
+    void clear() {
+        store_.clear();
+        negative_.clear();
+        sum_ = 0.;
+        count_ = zero_count_ = 0;
+        lowest_ = std::numeric_limits<FType>::max();
+        highest_ = std::numeric_limits<FType>::lowest();
+    }
+    uint64_t count() const {return count_;}
+    double sum() const {return sum_;}
+    FType min() const {return lowest_;}
+    FType max() const {return highest_;}
+    double alpha() const {return alpha_;}
+    uint64_t zero_count() const {return zero_count_;}
+    const StoreT &store() const {return store_;}
+    const StoreT &negative_store() const {return negative_;}
+private:
+    // Keys for n values, also folding their sum, minimum and maximum into the sketch.
+    void batch_keys(const FType *x, size_t n, int32_t *keys) {
+        size_t i = 0;
+        if constexpr(simd_type) {
+#if __AVX512F__
+            constexpr size_t nper = sizeof(__m512d) / sizeof(double);
+            __m512d vsum = _mm512_setzero_pd(), vmin = _mm512_set1_pd(lowest_), vmax = _mm512_set1_pd(highest_);
+            const __m512d mv = _mm512_set1_pd(mv_), nmv = _mm512_set1_pd(-mv_), mvlog = _mm512_set1_pd(mvlog_),
+                          ilg = _mm512_set1_pd(ilgamma_), off = _mm512_set1_pd(double(offset_));
+            for(; i + nper <= n; i += nper) {
+                __m512d v;
+                if constexpr(std::is_same_v<FType, float>) v = _mm512_cvtps_pd(_mm256_loadu_ps(x + i));
+                else v = _mm512_loadu_pd(x + i);
+                const __m512d a = _mm512_max_pd(_mm512_abs_pd(v), mvlog);
+                const __m512d k = _mm512_add_pd(_mm512_roundscale_pd(_mm512_mul_pd(detail::dd_log(a), ilg), _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC), off);
+                __m512d key = _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(v, mv, _CMP_GT_OQ), k);
+                key = _mm512_mask_sub_pd(key, _mm512_cmp_pd_mask(v, nmv, _CMP_LT_OQ), _mm512_setzero_pd(), k);
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(keys + i), _mm512_cvtpd_epi32(key));
+                vsum = _mm512_add_pd(vsum, v);
+                vmin = _mm512_min_pd(vmin, v);
+                vmax = _mm512_max_pd(vmax, v);
+            }
+            sum_ += _mm512_reduce_add_pd(vsum);
+            lowest_ = _mm512_reduce_min_pd(vmin);
+            highest_ = _mm512_reduce_max_pd(vmax);
+#elif __AVX2__ && __FMA__
+            constexpr size_t nper = sizeof(__m256d) / sizeof(double);
+            __m256d vsum = _mm256_setzero_pd(), vmin = _mm256_set1_pd(lowest_), vmax = _mm256_set1_pd(highest_);
+            const __m256d mv = _mm256_set1_pd(mv_), nmv = _mm256_set1_pd(-mv_), mvlog = _mm256_set1_pd(mvlog_),
+                          ilg = _mm256_set1_pd(ilgamma_), off = _mm256_set1_pd(double(offset_)), sign = _mm256_set1_pd(-0.);
+            for(; i + nper <= n; i += nper) {
+                __m256d v;
+                if constexpr(std::is_same_v<FType, float>) v = _mm256_cvtps_pd(_mm_loadu_ps(x + i));
+                else v = _mm256_loadu_pd(x + i);
+                const __m256d a = _mm256_max_pd(_mm256_andnot_pd(sign, v), mvlog);
+                const __m256d k = _mm256_add_pd(_mm256_ceil_pd(_mm256_mul_pd(detail::dd_log(a), ilg)), off);
+                const __m256d key = _mm256_or_pd(_mm256_and_pd(_mm256_cmp_pd(v, mv, _CMP_GT_OQ), k),
+                                                 _mm256_and_pd(_mm256_cmp_pd(v, nmv, _CMP_LT_OQ), _mm256_sub_pd(_mm256_setzero_pd(), k)));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(keys + i), _mm256_cvtpd_epi32(key));
+                vsum = _mm256_add_pd(vsum, v);
+                vmin = _mm256_min_pd(vmin, v);
+                vmax = _mm256_max_pd(vmax, v);
+            }
+            double tmp[nper];
+            _mm256_storeu_pd(tmp, vsum);
+            sum_ += (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+            _mm256_storeu_pd(tmp, vmin);
+            lowest_ = std::min(std::min(tmp[0], tmp[1]), std::min(tmp[2], tmp[3]));
+            _mm256_storeu_pd(tmp, vmax);
+            highest_ = std::max(std::max(tmp[0], tmp[1]), std::max(tmp[2], tmp[3]));
+#endif
+        }
+        for(; i < n; ++i) {
+            keys[i] = get_key(x[i]);
+            sum_ += x[i];
+            if(x[i] < lowest_) lowest_ = x[i];
+            if(x[i] > highest_) highest_ = x[i];
+        }
+    }
 }; // class DDSketch
 
 using ddf = DDSketch<float>;
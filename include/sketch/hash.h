@@ -497,9 +497,9 @@ struct MurFinHash {
 #ifndef VEC_DISABLED__
     INLINE Type operator()(VType key) const {
         key = Space::srli(key.simd_, 33) ^ key.simd_;  // h ^= h >> 33;
-        key.for_each([](auto &x) {x *= C1;});
+        key = Space::mullo(key.simd_, Space::set1(C1)); // h *= C1;
         key = Space::srli(key.simd_, 33) ^ key.simd_;  // h ^= h >> 33;
-        key.for_each([](auto &x) {x *= C2;});
+        key = Space::mullo(key.simd_, Space::set1(C2)); // h *= C2;
         key = Space::srli(key.simd_, 33) ^ key.simd_;  // h ^= h >> 33;
         return key.simd_;
     }
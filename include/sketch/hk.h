@@ -6,9 +6,8 @@
 #include "tsg.h"
 #include "flat_hash_map/flat_hash_map.hpp"
 #include "hash.h"
-#if SKETCH_THREADSAFE
+#include <memory>
 #include <mutex>
-#endif
 
 namespace sketch {
 
@@ -268,11 +267,209 @@ public:
     uint64_t n_updates() const {return n_updates_;}
     size_t size() const {return data_.size();}
 };
+
+template<size_t fpsize, size_t ctrsize=fpsize, typename Hasher=hash::WangHash, typename Policy=policy::SizePow2Policy<uint64_t>, typename RNG=wy::WyHash<uint64_t>>
+class BlockedHeavyKeeper {
+// HeavyKeeper with all of a key's buckets in one cache line.
+// Each 64-byte line holds SLOTS fingerprints in its first 32 bytes and their counters in the last 32.
+// A key hashes once to a line and to nh_ distinct slots within it (an odd stride from a random offset),
+// and one SIMD compare matches its fingerprint against every slot in the line, so an update or query
+// costs a single cache miss instead of one per subtable. Buckets follow HeavyKeeper's update rule.
+    static_assert(fpsize == ctrsize && (fpsize == 8 || fpsize == 16 || fpsize == 32), "fpsize and ctrsize must be equal and 8, 16, or 32.");
+public:
+    using fp_type  = std::conditional_t<fpsize == 8, uint8_t, std::conditional_t<fpsize == 16, uint16_t, uint32_t>>;
+    using ctr_type = fp_type;
+    static constexpr size_t LINE_BYTES = 64;
+    static constexpr size_t WORDS_PER_LINE = LINE_BYTES / sizeof(uint64_t);
+    static constexpr size_t SLOTS = LINE_BYTES / (sizeof(fp_type) + sizeof(ctr_type));
+    static constexpr uint64_t count_mask = bitmask(ctrsize);
+    using hash_type = Hasher;
+private:
+    Policy pol_; // Over lines
+    size_t nh_;
+    std::vector<uint64_t, sse::AlignedAllocator<uint64_t, sse::Alignment::KL>> data_;
+    Hasher hasher_;
+    double b_;
+    uint64_t n_updates_;
+#if SKETCH_THREADSAFE
+    static constexpr size_t NLOCKS = 64;
+    std::unique_ptr<std::mutex[]> mutexes_;
+#endif
+    fp_type  *fps(size_t line)        {return reinterpret_cast<fp_type *>(data_.data() + line * WORDS_PER_LINE);}
+    ctr_type *ctrs(size_t line)       {return reinterpret_cast<ctr_type *>(fps(line) + SLOTS);}
+    const fp_type  *fps(size_t line)  const {return reinterpret_cast<const fp_type *>(data_.data() + line * WORDS_PER_LINE);}
+    const ctr_type *ctrs(size_t line) const {return reinterpret_cast<const ctr_type *>(fps(line) + SLOTS);}
+    struct location_t {
+        size_t line;
+        fp_type fp;
+        unsigned offset, stride;
+        unsigned slot(unsigned i) const {return (offset + i * stride) & (SLOTS - 1);}
+    };
+    location_t locate(uint64_t x) const {
+        location_t ret;
+        ret.line = pol_.mod(x);
+        ret.fp = pol_.div(x) & count_mask;
+        wy::wyhash64_stateless(&x);
+        ret.offset = x & (SLOTS - 1);
+        ret.stride = ((x >> 8) & (SLOTS - 1)) | 1;
+        return ret;
+    }
+    // Bit s * sizeof(fp_type) is set if slot s holds fingerprint fp.
+    static uint32_t match(const fp_type *f, fp_type fp) {
+#if __AVX2__
+        const __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i *>(f));
+        CONST_IF(fpsize == 8) return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(fp)));
+        CONST_IF(fpsize == 16) return _mm256_movemask_epi8(_mm256_cmpeq_epi16(v, _mm256_set1_epi16(fp)));
+        return _mm256_movemask_epi8(_mm256_cmpeq_epi32(v, _mm256_set1_epi32(fp)));
+#else
+        uint32_t ret = 0;
+        for(unsigned s = 0; s < SLOTS; ++s)
+            ret |= uint32_t(f[s] == fp) << (s * sizeof(fp_type));
+        return ret;
+#endif
+    }
+    static bool matches(uint32_t mask, unsigned slot) {return (mask >> (slot * sizeof(fp_type))) & 1;}
+public:
+    BlockedHeavyKeeper(size_t requested_size, size_t subtables): BlockedHeavyKeeper(requested_size, subtables, 1.08) {}
+    // Sized to hold at least as many buckets as HeavyKeeper(requested_size, subtables).
+    template<typename...Args>
+    BlockedHeavyKeeper(size_t requested_size, size_t subtables, double pdec, Args &&...args):
+        pol_((requested_size * subtables + SLOTS - 1) / SLOTS), nh_(subtables),
+        data_(pol_.nelem() * WORDS_PER_LINE),
+        hasher_(std::forward<Args>(args)...),
+        b_(pdec), n_updates_(0)
+    {
+#if SKETCH_THREADSAFE
+        mutexes_.reset(new std::mutex[NLOCKS]);
+#endif
+        PREC_REQ(pdec >= 1., std::string("pdec is not valid (>= 1.). Value: ") + std::to_string(pdec));
+        PREC_REQ(subtables > 0 && subtables <= SLOTS, std::string("subtables must be in [1, ") + std::to_string(SLOTS) + "]");
+    }
+    BlockedHeavyKeeper(const BlockedHeavyKeeper &o): pol_(o.pol_), nh_(o.nh_), data_(o.data_), hasher_(o.hasher_), b_(o.b_), n_updates_(o.n_updates_)
+#if SKETCH_THREADSAFE
+        , mutexes_(new std::mutex[NLOCKS])
+#endif
+    {
+    }
+    BlockedHeavyKeeper& operator=(const BlockedHeavyKeeper &o) {
+        pol_ = o.pol_;
+        nh_ = o.nh_;
+        data_ = o.data_;
+        hasher_ = o.hasher_;
+        b_ = o.b_;
+        n_updates_ = o.n_updates_;
+        return *this;
+    }
+    BlockedHeavyKeeper(BlockedHeavyKeeper &&o)      = default;
+    BlockedHeavyKeeper& operator=(BlockedHeavyKeeper &&o)      = default;
+
+    template<typename T, typename=std::enable_if_t<!std::is_same<T, uint64_t>::value>>
+    uint64_t hash(const T &x) const {return hasher_(x);}
+    uint64_t hash(uint64_t x) const {return hasher_(x);}
+    uint64_t hash(uint32_t x) const {return hasher_(x);}
+    uint64_t hash(int64_t x) const {return hasher_(uint64_t(x));}
+    uint64_t hash(int32_t x) const {return hasher_(uint32_t(x));}
+
+    void clear() {
+        std::memset(data_.data(), 0, sizeof(data_[0]) * data_.size());
+    }
+    bool random_sample(size_t count) {
+        static thread_local std::uniform_real_distribution<double> gen;
+        static thread_local tsg::ThreadSeededGen<RNG> rng;
+        return count && gen(rng) <= std::pow(b_, -ssize_t(count));
+    }
+    template<typename T>
+    uint64_t addh(const T &x) {
+        return add(hash(x));
+    }
+    uint64_t add(uint64_t x) {
+        __sync_fetch_and_add(&n_updates_, 1);
+        const location_t loc = locate(x);
+#if SKETCH_THREADSAFE
+        std::unique_lock<std::mutex> lock(mutexes_[loc.line % NLOCKS]);
+#endif
+        fp_type *f = fps(loc.line);
+        ctr_type *c = ctrs(loc.line);
+        const uint32_t mask = match(f, loc.fp);
+        uint64_t maxv = 0;
+        for(unsigned i = 0; i < nh_; ++i) {
+            const unsigned s = loc.slot(i);
+            uint64_t count = c[s];
+            if(count == 0) {
+                f[s] = loc.fp, c[s] = 1;
+                maxv += maxv == 0;
+            } else if(matches(mask, s)) {
+                count += count < count_mask;
+                c[s] = count;
+                maxv = std::max(maxv, count);
+            } else if(random_sample(count)) {
+                if(--count == 0) {
+                    f[s] = loc.fp, c[s] = 1;
+                    maxv = std::max(maxv, uint64_t(1));
+                } else c[s] = count;
+            }
+        }
+        return maxv;
+    }
+    template<typename T>
+    uint64_t queryh(const T &x) const {
+        return query(hash(x));
+    }
+    uint64_t query(uint64_t x) const {
+        const location_t loc = locate(x);
+        const uint32_t mask = match(fps(loc.line), loc.fp);
+        const ctr_type *c = ctrs(loc.line);
+        uint64_t ret = 0;
+        for(unsigned i = 0; i < nh_; ++i) {
+            const unsigned s = loc.slot(i);
+            if(matches(mask, s)) ret = std::max(ret, uint64_t(c[s]));
+        }
+        return ret;
+    }
+    template<typename T>
+    uint64_t est_count(const T &x) {
+        return queryh(x);
+    }
+    // Slotwise merge with HeavyKeeper's rule: matching fingerprints add, differing ones cancel.
+    BlockedHeavyKeeper &operator|=(const BlockedHeavyKeeper &o) {
+        PREC_REQ(data_.size() == o.data_.size() && nh_ == o.nh_, "BlockedHeavyKeepers must have the same parameters");
+        for(size_t line = 0; line < pol_.nelem(); ++line) {
+            fp_type *lf = fps(line);
+            ctr_type *lc = ctrs(line);
+            const fp_type *rf = o.fps(line);
+            const ctr_type *rc = o.ctrs(line);
+            for(unsigned s = 0; s < SLOTS; ++s) {
+                if(rc[s] == 0) continue;
+                if(lc[s] == 0 || lf[s] == rf[s]) {
+                    lf[s] = rf[s];
+                    lc[s] = std::min(uint64_t(lc[s]) + rc[s], count_mask);
+                } else if(lc[s] >= rc[s]) {
+                    lc[s] -= rc[s];
+                } else {
+                    lc[s] = rc[s] - lc[s], lf[s] = rf[s];
+                }
+            }
+        }
+        n_updates_ += o.n_updates_;
+        return *this;
+    }
+    BlockedHeavyKeeper &operator+=(const BlockedHeavyKeeper &o) {return *this |= o;}
+    BlockedHeavyKeeper operator+(const BlockedHeavyKeeper &x) const {
+        BlockedHeavyKeeper cpy(*this);
+        cpy += x;
+        return cpy;
+    }
+    uint64_t n_updates() const {return n_updates_;}
+    size_t size() const {return data_.size();}
+};
+
 template<typename T>
 struct is_hk: std::false_type {};
 
 template<size_t fpsize, size_t ctrsize, typename Hasher, typename Policy, typename RNG, typename Allocator>
 struct is_hk<HeavyKeeper<fpsize,ctrsize,Hasher,Policy,RNG,Allocator>>: std::true_type {};
+template<size_t fpsize, size_t ctrsize, typename Hasher, typename Policy, typename RNG>
+struct is_hk<BlockedHeavyKeeper<fpsize,ctrsize,Hasher,Policy,RNG>>: std::true_type {};
 
 #if CXX20_CONCEPTS
 template<typename T>
@@ -337,19 +534,18 @@ public:
             } else {
                 auto yhv = hk_.hash(top());
                 const auto cmpcount = hk_.query(yhv);
-                if(std::tie(old_count, yhv) > std::tie(cmpcount, hv)) {
-                    assert(old_count >= cmpcount || hash(top()) > hash(x));
-
-                    // 3.4:Optimization 1 -- detecting fingerprint collisions
-                    if(old_count > cmpcount + 1) {
-                        old_count = 0;
-                    } else if(old_count == cmpcount + 1 || old_count == cmpcount) {
-                        // 3.4:Optimization 2 -- selective increment
-                        // Note: we will replace the top of the heap even if
-                        // cmpcount is nmin if the new hashvalue is smaller,
-                        // as the items themselves are equivalent
-                        hk_.add(hv);
-
+                // 3.4:Optimization 1 -- detecting fingerprint collisions
+                if(old_count > cmpcount + 1) {
+                    old_count = 0;
+                } else {
+                    // 3.4:Optimization 2 -- selective increment
+                    // Keys outside the heap are counted until they reach its minimum, then replace it.
+                    // Note: we will replace the top of the heap even if
+                    // cmpcount is nmin if the new hashvalue is smaller,
+                    // as the items themselves are equivalent
+                    hk_.add(hv);
+                    const auto new_count = hk_.query(hv);
+                    if(std::tie(new_count, yhv) > std::tie(cmpcount, hv)) {
                         std::pop_heap(heap_.begin(), heap_.end(), Comparator(hk_));
                         hashes_.erase(hash(heap_.back()));
                         hashes_.emplace(hv);
@@ -450,19 +646,18 @@ struct HeavyKeeperHeavyHitters: public HeavyKeeperHeap<Args...> {
             } else {
                 auto yhv = this->hk_.hash(this->top());
                 const auto cmpcount = this->hk_.query(yhv);
-                if(std::tie(old_count, yhv) > std::tie(cmpcount, hv)) {
-                    assert(old_count >= cmpcount || this->hk_.hash(this->top()) > this->hk_.hash(x));
-
-                    // 3.4:Optimization 1 -- detecting fingerprint collisions
-                    if(old_count > cmpcount + 1) {
-                        old_count = 0;
-                    }
-                    else if(old_count == cmpcount + 1 || old_count == cmpcount) {
-                        // 3.4:Optimization 2 -- selective increment
-                        // Note: we will replace the top of the heap even if
-                        // cmpcount is nmin if the new hashvalue is smaller,
-                        // as the items themselves are equivalent
-                        this->hk_.add(hv);
+                // 3.4:Optimization 1 -- detecting fingerprint collisions
+                if(old_count > cmpcount + 1) {
+                    old_count = 0;
+                } else {
+                    // 3.4:Optimization 2 -- selective increment
+                    // Keys outside the heap are counted until they reach its minimum, then replace it.
+                    // Note: we will replace the top of the heap even if
+                    // cmpcount is nmin if the new hashvalue is smaller,
+                    // as the items themselves are equivalent
+                    this->hk_.add(hv);
+                    const auto new_count = this->hk_.query(hv);
+                    if(std::tie(new_count, yhv) > std::tie(cmpcount, hv)) {
                         std::pop_heap(this->heap_.begin(), this->heap_.end(), Comparator(this->hk_));
                         this->hashes_.erase(this->hash(this->heap_.back()));
                         this->hashes_.emplace(hv);
@@ -477,6 +672,145 @@ struct HeavyKeeperHeavyHitters: public HeavyKeeperHeap<Args...> {
     }
 };
 
+template<typename HKType, typename ValueType, typename=typename std::enable_if_t<is_hk<HKType>::value>>
+class ConcurrentHeavyKeeperHeap {
+// Concurrent top-k tracking without a shared heap lock.
+// Each writer updates its own shard: a HeavyKeeper and a min-heap of at most k candidate keys.
+// Every publish_interval insertions, the writer publishes a copy of its candidates with an atomic pointer store.
+// topk() merges the latest published candidates of every shard, summing a key's counts across shards,
+// so readers never hold anything a writer waits on. Counts from shards where a key is not a candidate
+// are missing from the sum, and insertions since a shard last published are not yet visible; publish() forces it.
+public:
+    using keeper_t = HKType;
+    using value_type = ValueType;
+    struct entry_t {
+        value_type value;
+        uint64_t hv;
+        uint64_t count;
+    };
+    using snapshot_t = std::vector<entry_t>;
+private:
+    struct alignas(64) shard_t {
+        HKType hk_;
+        std::vector<entry_t> heap_; // Min-heap on count
+        ska::flat_hash_map<uint64_t, size_t> pos_; // Hash value to heap position
+        std::shared_ptr<const snapshot_t> published_;
+        uint64_t nsince_;
+        std::mutex mut_; // Only contended by writers sharing a shard
+        shard_t(const HKType &hk): hk_(hk), published_(std::make_shared<const snapshot_t>()), nsince_(0) {}
+    };
+    std::vector<std::unique_ptr<shard_t>> shards_;
+    size_t k_;
+    uint64_t publish_interval_;
+
+    void sift_up(shard_t &s, size_t i) {
+        auto &h = s.heap_;
+        while(i) {
+            const size_t parent = (i - 1) / 2;
+            if(h[parent].count <= h[i].count) break;
+            std::swap(h[parent], h[i]);
+            s.pos_[h[i].hv] = i;
+            i = parent;
+        }
+        s.pos_[h[i].hv] = i;
+    }
+    void sift_down(shard_t &s, size_t i) {
+        auto &h = s.heap_;
+        for(;;) {
+            size_t m = i;
+            const size_t l = 2 * i + 1, r = l + 1;
+            if(l < h.size() && h[l].count < h[m].count) m = l;
+            if(r < h.size() && h[r].count < h[m].count) m = r;
+            if(m == i) break;
+            std::swap(h[m], h[i]);
+            s.pos_[h[i].hv] = i;
+            i = m;
+        }
+        s.pos_[h[i].hv] = i;
+    }
+    static void publish(shard_t &s) {
+        std::atomic_store(&s.published_, std::shared_ptr<const snapshot_t>(std::make_shared<const snapshot_t>(s.heap_)));
+        s.nsince_ = 0;
+    }
+public:
+    // nshards defaults to the number of hardware threads. Each shard holds a copy of hk.
+    ConcurrentHeavyKeeperHeap(size_t k, const HKType &hk, size_t nshards=0, uint64_t publish_interval=4096):
+        k_(k), publish_interval_(publish_interval)
+    {
+        PREC_REQ(k > 0, "k must be positive");
+        if(nshards == 0) nshards = std::max(1u, std::thread::hardware_concurrency());
+        shards_.reserve(nshards);
+        while(shards_.size() < nshards) shards_.emplace_back(new shard_t(hk));
+    }
+    size_t k() const {return k_;}
+    size_t nshards() const {return shards_.size();}
+    uint64_t publish_interval() const {return publish_interval_;}
+    void set_publish_interval(uint64_t val) {publish_interval_ = val;}
+    auto hash(const value_type &x) const {return shards_[0]->hk_.hash(x);}
+
+    // Writers identify themselves by tid (e.g., kt_for's thread id, or an OpenMP thread number).
+    // Returns the shard's count estimate for x after insertion.
+    uint64_t addh(const value_type &x, unsigned tid) {
+        shard_t &s = *shards_[tid % shards_.size()];
+        const uint64_t hv = s.hk_.hash(x);
+        std::lock_guard<std::mutex> lock(s.mut_);
+        const uint64_t count = s.hk_.add(hv);
+        auto it = s.pos_.find(hv);
+        if(it != s.pos_.end()) {
+            entry_t &e = s.heap_[it->second];
+            if(count > e.count) e.count = count, sift_down(s, it->second);
+        } else if(s.heap_.size() < k_) {
+            s.heap_.push_back(entry_t{x, hv, count});
+            sift_up(s, s.heap_.size() - 1);
+        } else if(count > s.heap_.front().count) {
+            s.pos_.erase(s.heap_.front().hv);
+            s.heap_.front() = entry_t{x, hv, count};
+            sift_down(s, 0);
+        }
+        if(++s.nsince_ >= publish_interval_) publish(s);
+        return count;
+    }
+    // Without a tid, each calling thread is assigned a shard on first use.
+    uint64_t addh(const value_type &x) {return addh(x, common::detail::thread_slot());}
+    // Publishes one shard's, or every shard's, current candidates.
+    void publish(unsigned tid) {
+        shard_t &s = *shards_[tid % shards_.size()];
+        std::lock_guard<std::mutex> lock(s.mut_);
+        publish(s);
+    }
+    void publish() {
+        for(size_t i = 0; i < shards_.size(); ++i) publish(i);
+    }
+    // Up to k keys with the largest merged counts, in descending order of count (ties by ascending hash).
+    snapshot_t topk() const {
+        ska::flat_hash_map<uint64_t, entry_t> merged;
+        for(const auto &s: shards_) {
+            const auto snap = std::atomic_load(&s->published_);
+            for(const auto &e: *snap) {
+                auto it = merged.find(e.hv);
+                if(it == merged.end()) merged.emplace(e.hv, e);
+                else it->second.count += e.count;
+            }
+        }
+        snapshot_t ret;
+        ret.reserve(merged.size());
+        for(auto &pair: merged) ret.push_back(std::move(pair.second));
+        auto cmp = [](const entry_t &x, const entry_t &y) {return std::tie(y.count, x.hv) < std::tie(x.count, y.hv);};
+        if(ret.size() > k_) {
+            std::partial_sort(ret.begin(), ret.begin() + k_, ret.end(), cmp);
+            ret.resize(k_);
+        } else std::sort(ret.begin(), ret.end(), cmp);
+        return ret;
+    }
+    // Not safe to call concurrently with writers.
+    void clear() {
+        for(auto &s: shards_) {
+            s->hk_.clear(), s->heap_.clear(), s->pos_.clear();
+            publish(*s);
+        }
+    }
+};
+
 } // namespace hk
 
 } // namespace sketch
@@ -73,6 +73,10 @@ public:
 
 
     unsigned regsize() const {return r_ + q;}
+    unsigned p() const {return p_;}
+    unsigned lrszm3() const {return lrszm3_;}
+    const uint8_t *data() const {return data_.data();}
+    size_t nbytes() const {return data_.size();}
     size_t num_registers() const {return size_t(1) << p_;}
     uint64_t tr() const {return rbm_ + 1;}
     unsigned max_lremainder() const {
@@ -176,9 +180,13 @@ public:
         });
     }
     uint64_t calculate_cc_nc(const hmh_t &o) const {
-        switch(lrszm3_) {
+        return calculate_cc_nc(data_.data(), o.data_.data(), data_.size(), lrszm3_);
+    }
+    // Packed (shared << 32 | nonempty) register counts for two register arrays of nbytes each.
+    static uint64_t calculate_cc_nc(const uint8_t *lhs, const uint8_t *rhs, size_t nbytes, unsigned lrszm3) {
+        switch(lrszm3) {
 #undef CASE_U
-#define CASE_U(type, i, __unused) case i: return __calc_cc_nc<type>(o); break
+#define CASE_U(type, i, __unused) case i: return __calc_cc_nc<type>(lhs, rhs, nbytes); break
             SHOW_CASES(CASE_U)
             default: HEDLEY_UNREACHABLE();
         }
@@ -519,12 +527,17 @@ public:
     double jaccard_index(const hmh_t &o) const {
         PREC_REQ(o.p_ == this->p_ && o.r_ == this->r_, "Must have matching parameters");
         uint64_t cc_nc = calculate_cc_nc(o);
-        uint32_t cc = cc_nc >> 32, nc = cc_nc & 0xFFFFFFFFu;
-        if(!cc) return 0.;
+        if(!(cc_nc >> 32)) return 0.;
 
         auto card = cardinality_estimate();
         auto ocard = o.cardinality_estimate();
         assert(this != &o || card == ocard);
+        return jaccard_index(cc_nc, card, ocard);
+    }
+    // Jaccard index from calculate_cc_nc's counts and both cardinality estimates.
+    double jaccard_index(uint64_t cc_nc, double card, double ocard) const {
+        uint32_t cc = cc_nc >> 32, nc = cc_nc & 0xFFFFFFFFu;
+        if(!cc) return 0.;
         auto ec = approx_ec(card, ocard);
         return (1. - double(ec) / nc) * cc;
     }
@@ -534,12 +547,12 @@ public:
         return popcount((x >> 1) & x & bitmask);
     }
     template<typename IT>
-    uint64_t __calc_cc_nc(const hmh_t &o) const {
+    static uint64_t __calc_cc_nc(const uint8_t *lhs, const uint8_t *rhs, size_t nbytes) {
 
-        auto start = (const IT *)data_.data(), end = (const IT *)&data_[data_.size()];
-        auto ostart = (const IT *)o.data_.data();
+        auto start = (const IT *)lhs, end = (const IT *)(lhs + nbytes);
+        auto ostart = (const IT *)rhs;
         uint32_t cc = 0, nc = 0;
-        if(data_.size() < VECTOR_WIDTH / sizeof(IT)) {
+        if(nbytes < VECTOR_WIDTH / sizeof(IT)) {
             do {
                 cc += *start && *start == *ostart;
                 nc += *start || *ostart;
@@ -550,8 +563,8 @@ public:
         else {
 #if __AVX512BW__ // TODO: replace this with a (potentially separate) check per type
             using Type = typename vec::SIMDTypes<IT>::Type;
-            const Type *lhp = (const Type *)data_.data(), *lhe = (const Type *)&data_[data_.size()],
-                       *rhp = (const Type *)o.data_.data();
+            const Type *lhp = (const Type *)lhs, *lhe = (const Type *)(lhs + nbytes),
+                       *rhp = (const Type *)rhs;
             const Type zero = Space::set1(0);
             SK_UNROLL_4
             do { //while(lhp < lhe)
@@ -589,8 +602,8 @@ public:
 #  define __SETZERO() _mm_set1_epi32(0)
 #  define TYPE __m128i
 #endif
-            const TYPE *lhp = (const TYPE *)data_.data(), *lhe = (const TYPE *)&data_[data_.size()],
-                       *rhp = (const TYPE *)o.data_.data();
+            const TYPE *lhp = (const TYPE *)lhs, *lhe = (const TYPE *)(lhs + nbytes),
+                       *rhp = (const TYPE *)rhs;
             const TYPE zero = __SETZERO();
             SK_UNROLL_4
             do {
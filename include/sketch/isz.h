@@ -1,9 +1,116 @@
 #ifndef ISZ_H__
 #define ISZ_H__
 #include <cstdint>
+#include <cassert>
+#include <algorithm>
+#include <iterator>
+#include <functional>
+#include <type_traits>
+#include "macros.h"
+#include "intrinsics.h"
 
 namespace sketch {
 namespace isz {
+
+namespace detail {
+
+template<typename T>
+static inline std::uint64_t scalar_intersection_size(const T *a, size_t na, const T *b, size_t nb) {
+    std::uint64_t ret = 0;
+    for(size_t i = 0, j = 0; i < na && j < nb;) {
+        const T x = a[i], y = b[j];
+        ret += x == y;
+        i += !(y < x);
+        j += !(x < y);
+    }
+    return ret;
+}
+
+// Block intersection: each block of a is compared against every rotation of the current block of b
+// (Lemire, Boytsov and Kurz, "SIMD Compression and the Intersection of Sorted Integers", 2016;
+// Schlegel, Willhalm and Lehner, "Fast Sorted-Set Intersection using SIMD Instructions", 2011),
+// and whichever block ends lower advances. Values must be distinct within each input.
+template<typename T>
+static inline std::uint64_t simd_intersection_size(const T *a, size_t na, const T *b, size_t nb) {
+    static_assert(sizeof(T) == 4 || sizeof(T) == 8, "SIMD intersection requires 32- or 64-bit values");
+    std::uint64_t ret = 0;
+    size_t i = 0, j = 0;
+#if __AVX512F__
+    constexpr size_t W = 64 / sizeof(T);
+    for(; i + W <= na && j + W <= nb;) {
+        const __m512i va = _mm512_loadu_si512(a + i), vb = _mm512_loadu_si512(b + j);
+        if constexpr(sizeof(T) == 8) {
+            __mmask8 m = _mm512_cmpeq_epi64_mask(va, vb);
+            m |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 1));
+            m |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 2));
+            m |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 3));
+            m |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 4));
+            m |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 5));
+            m |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 6));
+            m |= _mm512_cmpeq_epi64_mask(va, _mm512_alignr_epi64(vb, vb, 7));
+            ret += __builtin_popcount(m);
+        } else {
+            __mmask16 m = _mm512_cmpeq_epi32_mask(va, vb);
+#define ROT32(r) m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, r))
+            ROT32(1); ROT32(2); ROT32(3); ROT32(4); ROT32(5); ROT32(6); ROT32(7); ROT32(8);
+            ROT32(9); ROT32(10); ROT32(11); ROT32(12); ROT32(13); ROT32(14); ROT32(15);
+#undef ROT32
+            ret += __builtin_popcount(m);
+        }
+        const T alast = a[i + W - 1], blast = b[j + W - 1];
+        i += !(blast < alast) * W;
+        j += !(alast < blast) * W;
+    }
+#elif __AVX2__
+    constexpr size_t W = 32 / sizeof(T);
+    for(; i + W <= na && j + W <= nb;) {
+        const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + j));
+        if constexpr(sizeof(T) == 8) {
+            __m256i m = _mm256_cmpeq_epi64(va, vb);
+            vb = _mm256_permute4x64_epi64(vb, 0x39);
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi64(va, vb));
+            vb = _mm256_permute4x64_epi64(vb, 0x39);
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi64(va, vb));
+            vb = _mm256_permute4x64_epi64(vb, 0x39);
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi64(va, vb));
+            ret += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+        } else {
+            const __m256i rot = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+            __m256i m = _mm256_cmpeq_epi32(va, vb);
+            for(unsigned r = 1; r < 8; ++r) {
+                vb = _mm256_permutevar8x32_epi32(vb, rot);
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi32(va, vb));
+            }
+            ret += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+        }
+        const T alast = a[i + W - 1], blast = b[j + W - 1];
+        i += !(blast < alast) * W;
+        j += !(alast < blast) * W;
+    }
+#endif
+    return ret + scalar_intersection_size(a + i, na - i, b + j, nb - j);
+}
+
+template<typename T>
+static constexpr bool simd_eligible = std::is_integral<T>::value && (sizeof(T) == 4 || sizeof(T) == 8);
+
+template<typename C, typename=void>
+struct is_contiguous: std::is_pointer<std::decay_t<decltype(std::begin(std::declval<const C &>()))>> {};
+template<typename C>
+struct is_contiguous<C, std::void_t<decltype(std::data(std::declval<const C &>()))>>: std::true_type {};
+
+} // namespace detail
+
+// Number of values shared by two sorted arrays of distinct values.
+template<typename T>
+std::uint64_t intersection_size(const T *a, size_t na, const T *b, size_t nb) {
+    assert(std::is_sorted(a, a + na));
+    assert(std::is_sorted(b, b + nb));
+    if constexpr(detail::simd_eligible<T>) return detail::simd_intersection_size(a, na, b, nb);
+    else return detail::scalar_intersection_size(a, na, b, nb);
+}
+
 template<typename Container, typename Cmp=std::less<>>
 std::uint64_t intersection_size(const Container &c1, const Container &c2, const Cmp &cmp=Cmp()) {
     // These containers must be sorted.
@@ -16,6 +123,11 @@ std::uint64_t intersection_size(const Container &c1, const Container &c2, const
     const auto e1 = std::cend(c1);
     const auto e2 = std::cend(c2);
     if(it1 == e1 || it2 == e2) return 0;
+    using T = std::decay_t<decltype(*it1)>;
+    if constexpr(detail::is_contiguous<Container>::value && detail::simd_eligible<T>
+                 && (std::is_same<Cmp, std::less<>>::value || std::is_same<Cmp, std::less<T>>::value)) {
+        return detail::simd_intersection_size(&*it1, size_t(e1 - it1), &*it2, size_t(e2 - it2));
+    }
     std::uint64_t ret = 0;
     FOREVER {
         if(*it1 == *it2) { // Easily predicted
@@ -29,7 +141,46 @@ std::uint64_t intersection_size(const Container &c1, const Container &c2, const
     }
     return ret;
 }
-} // common
+
+// Number of values shared by two sorted arrays of distinct values among the k smallest values of their union,
+// as used for bottom-k Jaccard estimates.
+// Each round takes the next (remaining) values of the union by a binary-searched split point
+// and intersects them with the SIMD kernel. Each round at least halves the number of values remaining,
+// and the last few are merged one at a time.
+template<typename T>
+std::uint64_t bottom_k_intersection_size(const T *a, size_t na, const T *b, size_t nb, size_t k) {
+    assert(std::is_sorted(a, a + na));
+    assert(std::is_sorted(b, b + nb));
+    std::uint64_t shared = 0;
+    while(k >= 64 && na && nb) {
+        // Split the next t values of the merged sequence into ja from a and jb from b.
+        const size_t t = std::min(k, na + nb);
+        size_t lo = t > nb ? t - nb: 0, hi = std::min(t, na);
+        while(lo < hi) {
+            const size_t mid = lo + (hi - lo) / 2;
+            if(b[t - mid - 1] < a[mid]) hi = mid;
+            else lo = mid + 1;
+        }
+        size_t ja = lo, jb = t - lo;
+        // Keep a shared value at the boundary together; the union then still holds at most k values.
+        // (The search leaves b[jb - 1] < a[ja], so the only possible tie is between a[ja - 1] and b[jb].)
+        if(ja && jb < nb && a[ja - 1] == b[jb]) ++jb;
+        const std::uint64_t s = intersection_size(a, ja, b, jb);
+        shared += s;
+        k -= ja + jb - s;
+        a += ja, na -= ja;
+        b += jb, nb -= jb;
+    }
+    for(size_t i = 0, j = 0; k && i < na && j < nb; --k) {
+        const T x = a[i], y = b[j];
+        shared += x == y;
+        i += !(y < x);
+        j += !(x < y);
+    }
+    return shared;
+}
+
+} // isz
 } // sketch
 
 #endif
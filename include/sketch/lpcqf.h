@@ -1,15 +1,18 @@
 #ifndef LP_CQF_H__
 #define LP_CQF_H__
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <climits>
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <stdexcept>
 #include <ratio>
 #include <vector>
 #include <memory>
+#include <numeric>
 
 
 #include "aesctr/wy.h"
@@ -38,7 +41,8 @@ enum LPCQFFlags {
     IS_POW2 = 1,
     IS_APPROXINC = 2,
     IS_COUNTSKETCH = 4,
-    IS_QUADRATIC_PROBING = 8
+    IS_QUADRATIC_PROBING = 8,
+    IS_RESIZABLE = 16
 };
 
 
@@ -113,6 +117,24 @@ constexpr std::array<long double, N> get_ipowers() {
 template<size_t num, size_t denom, size_t N>
 constexpr std::array<long double, N> POWERS = get_ipowers<num, denom, N>();
 
+// Allocator handing out calloc'd memory, so that value-initializing a table costs nothing up front:
+// large tables are mapped from fresh pages, which the kernel zeroes as they are first touched.
+template<typename T>
+struct ZeroedAllocator {
+    using value_type = T;
+    ZeroedAllocator() noexcept {}
+    template<typename U> ZeroedAllocator(const ZeroedAllocator<U> &) noexcept {}
+    T *allocate(size_t n) {
+        if(T *ret = static_cast<T *>(std::calloc(n, sizeof(T)))) return ret;
+        throw std::bad_alloc();
+    }
+    void deallocate(T *p, size_t) noexcept {std::free(p);}
+    template<typename U> void construct(U *) noexcept {} // Already zeroed
+    template<typename U, typename... Args> void construct(U *p, Args &&... args) {::new(static_cast<void *>(p)) U(std::forward<Args>(args)...);}
+    template<typename U> bool operator==(const ZeroedAllocator<U> &) const noexcept {return true;}
+    template<typename U> bool operator!=(const ZeroedAllocator<U> &) const noexcept {return false;}
+};
+
 union U256 {
 #ifdef __AVX2__
     __m256 fv;
@@ -144,7 +166,17 @@ struct LPCQF {
     static constexpr bool is_floating = std::is_floating_point_v<BaseT>;
     static constexpr bool is_apow2 = num == 2 && denom == 1;
     static constexpr bool is_64bit_index = sizeof(ModT) == 8;
+    static constexpr bool resizable = flags & IS_RESIZABLE;
+    // Resizable tables store the low home_bits bits of an entry's home slot in its signature, followed by the
+    // hash bits just below the slot index. This recovers an entry's home from its position while displacement
+    // stays below 1 << home_bits, and lets a doubling move the top remainder bit into the slot index.
+    // Each doubling therefore costs the signature one remainder bit; the fingerprint itself is unchanged.
+    static constexpr unsigned home_bits = resizable ? 6: 0;
+    static constexpr unsigned rembits = sigbits - home_bits;
+    static constexpr size_t max_displacement = (size_t(1) << home_bits) - 1;
+    static constexpr size_t MIGRATE_STEP = 4; // Old slots migrated per update while a resize is in progress
     static_assert(sizeof(ModT) == 4 || sizeof(ModT) == 8, "ModT must be 4 or 8 bytes");
+    static_assert(!resizable || (is_pow2 && !quadratic_probing && sigbits > home_bits), "Resizing requires a power-of-two size, linear probing, and more than 6 sigbits.");
 private:
     // Helper functions for approximate increment
     static long double ainc_increment_prob(signed long long n) {
@@ -190,10 +222,18 @@ private:
     schism::Schismatic<ModT> div_;
     //std::unique_ptr<MyType> leftovers_;
 
-    std::vector<T, sse::AlignedAllocator<T>> data_;
+    // Resizable tables allocate lazily-zeroed memory, so growing does not stall on clearing the new table.
+    using TableT = std::conditional_t<resizable, std::vector<T, ZeroedAllocator<T>>, std::vector<T, sse::AlignedAllocator<T>>>;
+    TableT data_;
     int l2n = 0;
     uint64_t bitmask = 0xFFFFFFFFFFFFFFFFull;
     size_t size_;
+    // Resizing state: the half-size table being drained into data_, the next slot of it to migrate,
+    // the number of occupied slots in data_, and the fixed number of hash bits identifying a key.
+    TableT old_;
+    size_t migrate_pos_ = 0;
+    size_t nfilled_ = 0;
+    int fpbits_ = 0;
 
 public:
     static constexpr auto hash(uint64_t key) {
@@ -216,9 +256,14 @@ public:
         }
         data_.resize(nregs);
         size_ = nregs;
+        if constexpr(resizable) {
+            fpbits_ = l2n + rembits;
+            if(fpbits_ > 64) throw std::invalid_argument("Resizable LPCQF needs log2(nregs) + sigbits - 6 <= 64.");
+        }
     }
     std::conditional_t<is_floating, double, uint64_t> inner_product(const MyType &o) const {
         if(size_ != o.size_) throw std::invalid_argument("Can't compare LPCQF of different sizes");
+        if constexpr(resizable) check_layout(o);
         std::conditional_t<is_floating, double, uint64_t> ret = 0;
         if constexpr(approx_inc) throw std::invalid_argument("Not yet implemented: approx_inc inner product.");
         if constexpr(sigbits == 0) {
@@ -299,6 +344,7 @@ public:
     }
     MyType &operator+=(const MyType &o) {
         if(o.size_ != size_) throw std::invalid_argument(std::string("Mismatched sizes: ") + std::to_string(size_) + ", vs " + std::to_string(o.size_));
+        if constexpr(resizable) check_layout(o);
         if constexpr(sigbits == 0) {
             std::transform((const BaseT *)o.data_.data(), (const BaseT *)o.data_.data() + size_, (BaseT *)data_.data(), (BaseT *)data_.data(), [](auto x, auto y) {return x + y;});
         } else {
@@ -320,6 +366,7 @@ public:
                 }
             }
         }
+        if constexpr(resizable) nfilled_ = data_.size() - std::count(data_.begin(), data_.end(), T(0));
         return *this;
     }
     INLINE BaseT extract_res(T x) const {
@@ -341,6 +388,16 @@ public:
     }
     std::conditional_t<approx_inc, long double, BaseT> count_estimate(uint64_t item) const {
         uint64_t hv = hash(item);
+        if constexpr(resizable) {
+            const T *tab = data_.data();
+            std::ptrdiff_t pos = -1;
+            if(resizing() && (pos = rs_find(old_.data(), l2n - 1, hv)) >= std::ptrdiff_t(migrate_pos_)) tab = old_.data();
+            else pos = rs_find(data_.data(), l2n, hv);
+            if(pos < 0) return 0.;
+            const BaseT ret = extract_res(tab[pos]);
+            if constexpr(approx_inc) return ainc_estimate_count(ret);
+            return ret;
+        }
         ModT hi = is_pow2 ? ModT(hv & bitmask): ModT(div_.mod(hv));
         const ModT sig = sigbits ? hv & ModT((1ull << sigbits) - 1): ModT(0);
         ModT osig;
@@ -382,52 +439,62 @@ public:
             return ret;
         } else {throw std::runtime_error("Should not happen."); return T(0);}
     }
+    template<typename CT>
+    INLINE T new_register(T sig, CT count) {
+        if constexpr(approx_inc) {
+            T insert = 1;
+            for(size_t i = 1; i < static_cast<size_t>(count); ainc(insert), ++i);
+            return (T(sig) << countbits) | insert;
+        } else {
+            T val = encode_res(count);
+            if constexpr(sigbits)
+                val |= (T(sig) << countbits);
+            return val;
+        }
+    }
+    template<typename CT>
+    INLINE void increment_register(T &reg, uint64_t hv, CT count) {
+        T osig = 0;
+        if constexpr(sigbits > 0) osig = reg >> countbits;
+        if constexpr (approx_inc) {
+            T current_count = reg & countmask;
+            if(current_count >= ((1ull << countbits) - 1)) return; // Saturated
+            for(size_t i = 0; i < size_t(count) && likely(current_count != ((1ull << countbits) - 1)); ++i)
+                ainc(current_count);
+            reg = (osig << countbits) | current_count;
+        } else if constexpr(countsketch_increment) {
+            const bool flip_sign = hv >> 63;
+            if constexpr(is_floating) {
+                reg = (osig << countbits) | encode_res(extract_res(reg) + (flip_sign ? count: -count));
+            } else {
+                T newval = (reg & countmask) + (flip_sign ? count: -count);
+                reg = (osig << countbits) | newval;
+            }
+        } else {
+            if constexpr(is_floating) {
+                if constexpr(sigbits == 0) reg = encode_res(extract_res(reg) + count);
+                else
+                    reg = (osig << countbits) | encode_res(extract_res(reg) + count);
+            } else {
+                reg += count;
+            }
+        }
+    }
     template<typename CT, typename=std::enable_if_t<std::is_arithmetic_v<CT>>>
     void update_hashed(uint64_t hv, ModT hi, CT count) {
-        T sig, osig;
+        T sig = 0, osig;
         if constexpr(sigbits > 0) sig = hv & ModT((1ull << sigbits) - 1);
         size_t step = 0;
         size_t stepnum = -1;
         for(;++stepnum < data_.size();) {
             if(!data_[hi]) {
-                if constexpr(approx_inc) {
-                    T insert = 1;
-                    for(size_t i = 1; i < static_cast<size_t>(count); ainc(insert), ++i);
-                    data_[hi] = (T(sig) << countbits) | insert;
-                    assert(data_[hi] != T(0));
-                } else {
-                    T val = encode_res(count);
-                    if constexpr(sigbits)
-                        val |= (T(sig) << countbits);
-                    data_[hi] = val;
-                }
+                data_[hi] = new_register(sig, count);
+                assert(!approx_inc || data_[hi] != T(0));
                 return;
             } else {
                 if constexpr(sigbits > 0) osig = data_[hi] >> countbits;
                 if(sigbits == 0 || osig == sig) {
-                    if constexpr (approx_inc) {
-                        T current_count = data_[hi] & countmask;
-                        if(current_count >= ((1ull << countbits) - 1)) return; // Saturated
-                        for(size_t i = 0; i < size_t(count) && likely(current_count != ((1ull << countbits) - 1)); ++i)
-                            ainc(current_count);
-                        data_[hi] = (sig << countbits) | current_count;
-                    } else if constexpr(countsketch_increment) {
-                        const bool flip_sign = hv >> 63;
-                        if constexpr(is_floating) {
-                            data_[hi] = (osig << countbits) | encode_res(extract_res(data_[hi]) + (flip_sign ? count: -count));
-                        } else {
-                            T newval = (data_[hi] & countmask) + (flip_sign ? count: -count);
-                            data_[hi] = (osig << countbits) | newval;
-                        }
-                    } else {
-                        if constexpr(is_floating) {
-                            if constexpr(sigbits == 0) data_[hi] = encode_res(extract_res(data_[hi]) + count);
-                            else
-                                data_[hi] = (osig << countbits) | encode_res(extract_res(data_[hi]) + count);
-                        } else {
-                            data_[hi] += count;
-                        }
-                    }
+                    increment_register(data_[hi], hv, count);
                     return;
                 }
             }
@@ -441,15 +508,124 @@ public:
         }
 
         std::fprintf(stderr, "Failed to find empty bucket in table of size %zu\n", data_.size());
-        throw std::runtime_error("CQF exceeded size. Resizing not yet implemented.");
+        throw std::runtime_error("CQF exceeded size. Use IS_RESIZABLE for a table which grows as it fills.");
+    }
+    bool resizing() const {return !old_.empty();}
+    size_t size() const {return size_;}
+    // Doubles the table. Entries move to the new table a few slots per update (see migrate),
+    // so the cost of rehashing is spread across subsequent updates rather than paid at once.
+    // Called automatically once the table is half full, or when a key has no free slot within the displacement bound.
+    void grow() {
+        static_assert(resizable, "grow() requires IS_RESIZABLE");
+        finish_resize();
+        if(fpbits_ == l2n) throw std::runtime_error("LPCQF cannot grow further: no remainder bits are left in the signature. Use more sigbits.");
+        if(size_ * 2 - 1 > std::numeric_limits<ModT>::max()) throw std::runtime_error("LPCQF cannot grow beyond the range of ModT. Use a 64-bit ModT.");
+        old_.swap(data_);
+        data_.resize(size_ * 2);
+        size_ *= 2;
+        ++l2n;
+        bitmask = size_ - 1;
+        div_ = schism::Schismatic<ModT>(size_);
+        migrate_pos_ = 0;
+        nfilled_ = 0;
+    }
+    // Completes a resize in progress, if any.
+    void finish_resize() {
+        if(resizing()) migrate(old_.size());
+    }
+private:
+    INLINE uint64_t rs_home(uint64_t hv, int lg) const {return lg ? hv >> (64 - lg): uint64_t(0);}
+    INLINE T rs_sig(uint64_t hv, int lg) const {
+        const int nrem = fpbits_ - lg;
+        const uint64_t rem = nrem ? (hv >> (64 - fpbits_)) & ((uint64_t(1) << nrem) - 1): uint64_t(0);
+        return T(((rs_home(hv, lg) & max_displacement) << rembits) | rem);
+    }
+    // Position of hv in a table of 2^lg slots, or -1 if it is absent.
+    std::ptrdiff_t rs_find(const T *tab, int lg, uint64_t hv) const {
+        const size_t mask = (size_t(1) << lg) - 1, home = rs_home(hv, lg);
+        const T sig = rs_sig(hv, lg);
+        for(size_t d = 0, e = std::min(max_displacement, mask); d <= e; ++d) {
+            const size_t pos = (home + d) & mask;
+            if(!tab[pos]) break;
+            if(T(tab[pos] >> countbits) == sig) return pos;
+        }
+        return -1;
+    }
+    // Returns false if hv has neither an entry nor a free slot within the displacement bound.
+    template<typename CT>
+    bool rs_update_current(uint64_t hv, CT count) {
+        const size_t home = rs_home(hv, l2n);
+        const T sig = rs_sig(hv, l2n);
+        for(size_t d = 0, e = std::min(max_displacement, size_t(bitmask)); d <= e; ++d) {
+            T &reg = data_[(home + d) & bitmask];
+            if(!reg) {
+                reg = new_register(sig, count);
+                ++nfilled_;
+                return true;
+            }
+            if(T(reg >> countbits) == sig) {
+                increment_register(reg, hv, count);
+                return true;
+            }
+        }
+        return false;
+    }
+    template<typename CT>
+    void resizable_update(uint64_t hv, CT count) {
+        for(;;) {
+            // Keys whose entries have not been migrated yet are updated in the old table.
+            if(resizing()) {
+                const std::ptrdiff_t pos = rs_find(old_.data(), l2n - 1, hv);
+                if(pos >= std::ptrdiff_t(migrate_pos_)) {
+                    increment_register(old_[pos], hv, count);
+                    break;
+                }
+            }
+            if(rs_update_current(hv, count)) break;
+            grow();
+        }
+        if(resizing()) migrate(MIGRATE_STEP);
+        else if(nfilled_ * 2 > size_) grow();
+    }
+    // Moves the next nslots slots of the old table into data_.
+    // The old table is left intact until migration completes, so probe sequences through migrated slots still
+    // find entries further on; an entry found before migrate_pos_ has already moved and is looked up in data_.
+    void migrate(size_t nslots) {
+        const size_t oldmask = old_.size() - 1;
+        const int oldrem = fpbits_ - (l2n - 1);
+        const T remmask = (T(1) << rembits) - 1, newremmask = (T(1) << (oldrem - 1)) - 1;
+        for(const size_t e = std::min(old_.size(), migrate_pos_ + nslots); migrate_pos_ < e; ++migrate_pos_) {
+            const T reg = old_[migrate_pos_];
+            if(!reg) continue;
+            const T sig = reg >> countbits, rem = sig & remmask;
+            const size_t oldhome = (migrate_pos_ - ((migrate_pos_ - (sig >> rembits)) & max_displacement)) & oldmask;
+            const size_t home = (oldhome << 1) | (rem >> (oldrem - 1));
+            const T newsig = T(((home & max_displacement) << rembits) | (rem & newremmask));
+            size_t d = 0;
+            for(;d <= max_displacement && data_[(home + d) & bitmask]; ++d);
+            if(d > max_displacement) throw std::runtime_error("LPCQF resize failed to place an entry within the displacement bound.");
+            data_[(home + d) & bitmask] = (newsig << countbits) | (reg & countmask);
+            ++nfilled_;
+        }
+        if(migrate_pos_ == old_.size()) TableT().swap(old_);
+    }
+    void check_layout(const MyType &o) const {
+        if(resizing() || o.resizing()) throw std::invalid_argument("Finish resizing (finish_resize()) before combining resizable LPCQFs.");
+        if(fpbits_ != o.fpbits_) throw std::invalid_argument("Resizable LPCQFs must have been created with the same size to be combined.");
     }
+    template<typename F>
+    void for_each_register(F &&f) const {
+        for(const T v: data_) if(v) f(v);
+        for(size_t i = migrate_pos_; i < old_.size(); ++i) if(old_[i]) f(old_[i]);
+    }
+public:
     template<typename CT, typename=std::enable_if_t<std::is_arithmetic_v<CT>>>
     void update(uint64_t item, CT count) {
         if(approx_inc && unlikely(count < CT(0))) throw std::invalid_argument(std::string("Update with negative count ") + std::to_string(count) + " is not permitted in approximate counting mode.");
         static_assert(std::is_signed_v<CT> || !countsketch_increment, "Make sure the type is signed or not countsketch");
         uint64_t hv = hash(item);
-        auto hi = is_pow2 ? ModT(hv & bitmask): ModT(div_.mod(hv));
-        update_hashed(hv, hi, count);
+        if constexpr(resizable) resizable_update(hv, count);
+        else update_hashed(hv, home_slot(hv), count);
     }
 #ifdef __AVX512F__
     static INLINE __m512d fmadd(__m512d x, __m512d y, __m512d sum) {
@@ -496,74 +672,110 @@ public:
     static INLINE void store(uint64_t *data, __m128i val) {
         _mm_storeu_si128((__m128i *)data, val);
     }
+    INLINE ModT home_slot(uint64_t hv) const {
+        return is_pow2 ? ModT(hv & bitmask): ModT(div_.mod(hv));
+    }
+    // Updates with n items, and optional per-item increments, a block at a time.
+    // Each block is hashed with SIMD. Repeats of a key within the block are coalesced as they are hashed,
+    // through a small direct-mapped table of recent keys, into one update with their summed increment.
+    // The remaining entries are radix-partitioned on the top bits of their home slot, and probed in
+    // partition order with prefetching, so that consecutive updates touch nearby parts of the table.
+    // Counts match those from updating item by item; only the placement of colliding keys within
+    // a probe sequence may differ.
+    static constexpr size_t BATCH_BLOCK = 1 << 14;
     template<typename IncT=uint32_t>
     void batch_update(const uint64_t *data, size_t n, IncT *inc = static_cast<IncT *>(nullptr)) {
-        // note: This handles batches up to 0xFFFFFFFF in size.
-        std::unique_ptr<ModT[]> tmp(new ModT[n]);
-        std::unique_ptr<uint64_t[]> hashdata(new uint64_t[n]);
-        std::unique_ptr<uint32_t[]> indices(new uint32_t[n]);
-        size_t i = 0;
-#ifdef __AVX512F__
-        constexpr size_t npersimd = sizeof(__m512i) / sizeof(uint64_t);
-        const size_t nsimd = n / npersimd;
-        const size_t scalar_index = nsimd * npersimd;
-        for(; i < scalar_index; i += npersimd) {
-            __m512i hv = hash(_mm512_loadu_si512(data + i));
-            store(&tmp[i], rem(hv));
-            store(&hashdata[i], hv);
+        if constexpr(resizable) {
+            for(size_t i = 0; i < n; ++i) inc ? update(data[i], inc[i]): update(data[i]);
+            return;
         }
+        using SumT = std::conditional_t<std::is_floating_point_v<IncT>, double, std::conditional_t<std::is_signed_v<IncT>, int64_t, uint64_t>>;
+        struct entry_t {
+            uint64_t hv;
+            SumT inc;
+            ModT slot;
+        };
+        static constexpr unsigned RADIX_BITS = 11;
+        static constexpr size_t NBUCKETS = size_t(1) << RADIX_BITS;
+        static constexpr unsigned DEDUP_BITS = 12;
+        static constexpr size_t PREFETCH_DIST = 8;
+        const unsigned slotbits = size_ > 1 ? 64 - __builtin_clzll(size_ - 1): 1;
+        const unsigned shift = slotbits > RADIX_BITS ? slotbits - RADIX_BITS: 0;
+        const size_t bufsz = std::min(n, BATCH_BLOCK);
+        std::unique_ptr<entry_t[]> entries(new entry_t[bufsz]), sorted(new entry_t[bufsz]);
+        std::unique_ptr<size_t[]> offsets(new size_t[NBUCKETS + 1]);
+        // Position in entries of the last key seen with these hash bits; validated against entries before use.
+        std::unique_ptr<uint32_t[]> recent(new uint32_t[size_t(1) << DEDUP_BITS]());
+        for(size_t start = 0; start < n; start += BATCH_BLOCK) {
+            const size_t nb = std::min(BATCH_BLOCK, n - start);
+            const uint64_t *bdata = data + start;
+            const IncT *binc = inc ? inc + start: nullptr;
+            size_t m = 0; // Distinct entries so far
+            auto append = [&](uint64_t hv, ModT slot, SumT v) {
+                uint32_t &r = recent[hv >> (64 - DEDUP_BITS)];
+                if(r < m && entries[r].hv == hv) entries[r].inc += v;
+                else entries[m] = entry_t{hv, v, slot}, r = m++;
+            };
+            size_t i = 0;
+#ifdef __AVX512F__
+            constexpr size_t npersimd = sizeof(__m512i) / sizeof(uint64_t);
+            ModT slots[npersimd];
+            uint64_t hvs[npersimd];
+            for(; i + npersimd <= nb; i += npersimd) {
+                __m512i hv = hash(_mm512_loadu_si512(bdata + i));
+                _mm512_storeu_si512(hvs, hv);
+                if constexpr(is_pow2) {
+                    const __m512i masked = _mm512_and_si512(hv, _mm512_set1_epi64(bitmask));
+                    if constexpr(is_64bit_index) _mm512_storeu_si512(slots, masked);
+                    else _mm256_storeu_si256((__m256i *)slots, _mm512_cvtepi64_epi32(masked));
+                } else for(size_t j = 0; j < npersimd; ++j) slots[j] = div_.mod(hvs[j]);
+                for(size_t j = 0; j < npersimd; ++j) append(hvs[j], slots[j], binc ? SumT(binc[i + j]): SumT(1));
+            }
 #elif __AVX2__
-        constexpr size_t npersimd = sizeof(__m256i) / sizeof(uint64_t);
-        const size_t nsimd = n / npersimd;
-        const size_t scalar_index = nsimd * npersimd;
-        for(; i < scalar_index; i += npersimd) {
-            __m256i hv = hash(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)));
-            store(&tmp[i], rem(hv));
-            store(&hashdata[i], hv);
-        }
+            constexpr size_t npersimd = sizeof(__m256i) / sizeof(uint64_t);
+            ModT slots[npersimd];
+            uint64_t hvs[npersimd];
+            for(; i + npersimd <= nb; i += npersimd) {
+                __m256i hv = hash(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(bdata + i)));
+                _mm256_storeu_si256((__m256i *)hvs, hv);
+                if constexpr(is_pow2) {
+                    const __m256i masked = _mm256_and_si256(hv, _mm256_set1_epi64x(bitmask));
+                    if constexpr(is_64bit_index) _mm256_storeu_si256((__m256i *)slots, masked);
+                    else _mm_storeu_si128((__m128i *)slots, cvtepi64_epi32_avx(masked));
+                } else for(size_t j = 0; j < npersimd; ++j) slots[j] = div_.mod(hvs[j]);
+                for(size_t j = 0; j < npersimd; ++j) append(hvs[j], slots[j], binc ? SumT(binc[i + j]): SumT(1));
+            }
 #endif
-        for(;i < n; ++i) {
-            hashdata[i] = hash(data[i]);
-            tmp[i] = div_.mod(hashdata[i]);
-        }
-        std::iota(indices.get(), indices.get() + n, 0u);
-        std::sort(indices.get(), indices.get() + n, [&tmp](auto x, auto y) {return tmp[x] < tmp[y];});
-        for(i = 0; i < n; ++i) {
-            const auto index = indices[i];
-            update_hashed(hashdata[index], tmp[index], inc ? inc[index]: IncT(1));
-        }
-    }
-    template<typename F>
-    void for_each(F &&f) {
-        for(auto &v: data_) {
-            if(!v) continue; // Skip empty buckets
-            const T rem = v >> countbits;
-            auto countv = extract_res(v);
-            if(countv > static_cast<BaseT>(0))
-                f(rem, countv);
+            for(; i < nb; ++i) {
+                const uint64_t hv = hash(bdata[i]);
+                append(hv, home_slot(hv), binc ? SumT(binc[i]): SumT(1));
+            }
+            std::fill_n(offsets.get(), NBUCKETS + 1, size_t(0));
+            for(i = 0; i < m; ++i) ++offsets[(entries[i].slot >> shift) + 1];
+            std::partial_sum(offsets.get(), offsets.get() + NBUCKETS + 1, offsets.get());
+            for(i = 0; i < m; ++i) sorted[offsets[entries[i].slot >> shift]++] = entries[i];
+            for(i = 0; i < m; ++i) {
+                if(i + PREFETCH_DIST < m) __builtin_prefetch(&data_[sorted[i + PREFETCH_DIST].slot]);
+                update_hashed(sorted[i].hv, sorted[i].slot, sorted[i].inc);
+            }
         }
     }
     template<typename F>
     void for_each(F &&f) const {
-        for(auto &v: data_) {
-            if(!v) continue; // Skip empty buckets
+        for_each_register([this, &f](T v) {
             const T rem = v >> countbits;
             auto countv = extract_res(v);
             if(countv > static_cast<BaseT>(0))
                 f(rem, countv);
-        }
+        });
     }
     template<typename F>
     void for_each_sig(F &&f) const {
-        for(auto &v: data_) {
-            if(v) f(v >> countbits);
-        }
+        for_each_register([&f](T v) {f(v >> countbits);});
     }
     template<typename F>
     void for_each_count(F &&f) const {
-        for(auto &v: data_) {
-            if(v) f(extract_res(v));
-        }
+        for_each_register([this, &f](T v) {f(extract_res(v));});
     }
     void update(uint64_t item) {
         static constexpr std::conditional_t<is_floating, double, std::conditional_t<countsketch_increment, std::make_signed_t<T>, std::make_unsigned_t<T>>> inc = 1;
@@ -571,6 +783,8 @@ public:
     }
     void reset() {
         std::fill_n(data_.data(), size_, T(0));
+        TableT().swap(old_);
+        migrate_pos_ = nfilled_ = 0;
     }
 #if __AVX2__
     INLINE __m128i cvtepi64_epi32_avx(__m256i v)
@@ -54,6 +54,106 @@ public:
 
 
 
+// Flat bottom-k store: keeps the k entries which come last in Cmp order (the k smallest for std::greater)
+// in a sorted vector rather than a node-based set.
+// A candidate which cannot beat the current k-th entry is rejected with one comparison.
+// The rest go to a small unsorted buffer, which is sorted and merged into the vector once full.
+// Entries with equal keys are kept once; entries with counts (.first and .second) have their counts summed.
+// Iteration, size and the other queries flush the buffer first, and begin() to end() runs in Cmp order,
+// as a std::set<Entry, Cmp> would.
+template<typename T, typename Cmp=std::greater<T>, typename Entry=T>
+class FlatBottomK {
+    static constexpr bool counted = !std::is_same<Entry, T>::value;
+    size_t k_;
+    Cmp cmp_;
+    mutable bool full_ = false;
+    mutable T worst_{}; // The k-th best key once full_
+    mutable std::vector<Entry> kept_; // Best first, i.e., in reverse Cmp order
+    mutable std::vector<Entry> buf_, spare_;
+
+    static const T &key(const Entry &e) {
+        if constexpr(counted) return e.first;
+        else return e;
+    }
+    bool better(const T &a, const T &b) const {return cmp_(b, a);}
+    size_t buffer_limit() const {return std::max(size_t(16), k_ / 4);}
+    // Sorts a buffer best-first and combines equal keys.
+    void sort_unique(std::vector<Entry> &v) const {
+        common::sort::default_sort(v.begin(), v.end(), [this](const Entry &a, const Entry &b) {return better(key(a), key(b));});
+        size_t o = 0;
+        for(size_t i = 1; i < v.size(); ++i) {
+            if(key(v[i]) == key(v[o])) {
+                if constexpr(counted) v[o].second += v[i].second;
+            } else if(++o != i) v[o] = v[i];
+        }
+        if(!v.empty()) v.erase(v.begin() + o + 1, v.end());
+    }
+public:
+    using key_compare = Cmp;
+    using value_type = Entry;
+    FlatBottomK(size_t k=0, const Cmp &cmp=Cmp()): k_(k), cmp_(cmp) {}
+    size_t k() const {return k_;}
+    void insert(const Entry &e) {
+        // Counted entries equal to the k-th still add to its count.
+        if(full_ && (counted ? cmp_(key(e), worst_): !cmp_(worst_, key(e)))) return;
+        buf_.push_back(e);
+        if(buf_.size() >= buffer_limit()) flush();
+    }
+    template<typename It>
+    void insert(It beg, It end) {
+        for(; beg != end; insert(*beg++));
+    }
+    // Merges the buffer into the kept entries, keeping the best k.
+    void flush() const {
+        if(buf_.empty()) return;
+        sort_unique(buf_);
+        spare_.clear();
+        spare_.reserve(std::min(k_, kept_.size() + buf_.size()));
+        auto i1 = kept_.cbegin(), e1 = kept_.cend(), i2 = buf_.cbegin(), e2 = buf_.cend();
+        while(spare_.size() < k_ && (i1 != e1 || i2 != e2)) {
+            if(i2 == e2 || (i1 != e1 && better(key(*i1), key(*i2)))) spare_.push_back(*i1++);
+            else if(i1 == e1 || better(key(*i2), key(*i1))) spare_.push_back(*i2++);
+            else {
+                spare_.push_back(*i1++);
+                if constexpr(counted) spare_.back().second += i2->second;
+                ++i2;
+            }
+        }
+        kept_.swap(spare_);
+        buf_.clear();
+        if((full_ = k_ && kept_.size() == k_)) worst_ = key(kept_.back());
+    }
+    size_t size() const {flush(); return kept_.size();}
+    bool empty() const {return size() == 0;}
+    // Kept entries best first, i.e., in reverse Cmp order (ascending for std::greater).
+    const std::vector<Entry> &sorted_best() const {flush(); return kept_;}
+    auto begin() {flush(); return kept_.rbegin();}
+    auto end() {flush(); return kept_.rend();}
+    auto begin() const {flush(); return kept_.crbegin();}
+    auto end() const {flush(); return kept_.crend();}
+    auto cbegin() const {return begin();}
+    auto cend() const {return end();}
+    auto rbegin() {flush(); return kept_.begin();}
+    auto rend() {flush(); return kept_.end();}
+    auto rbegin() const {flush(); return kept_.cbegin();}
+    auto rend() const {flush(); return kept_.cend();}
+    void clear() {
+        full_ = false;
+        std::vector<Entry>().swap(kept_);
+        std::vector<Entry>().swap(buf_);
+        std::vector<Entry>().swap(spare_);
+    }
+    void swap(FlatBottomK &o) {
+        std::swap(k_, o.k_);
+        std::swap(cmp_, o.cmp_);
+        std::swap(full_, o.full_);
+        std::swap(worst_, o.worst_);
+        kept_.swap(o.kept_);
+        buf_.swap(o.buf_);
+        spare_.swap(o.spare_);
+    }
+};
+
 template<typename T, typename Cmp=std::greater<T>, typename Hasher=WangHash>
 class KMinHash: public AbstractMinHash<T, Cmp> {
     std::vector<uint64_t, common::Allocator<uint64_t>> seeds_;
@@ -100,13 +200,13 @@ struct RangeMinHash: public AbstractMinHash<T, Cmp> {
 protected:
     Hasher hf_;
     Cmp cmp_;
-    std::set<T, Cmp> minimizers_; // using std::greater<T> so that we can erase from begin()
+    FlatBottomK<T, Cmp> minimizers_; // In Cmp order, so that begin() is the entry to be displaced next
 
 public:
     using final_type = FinalRMinHash<T, Allocator>;
     using Compare = Cmp;
     RangeMinHash(size_t sketch_size, Hasher &&hf=Hasher(), Cmp &&cmp=Cmp()):
-        AbstractMinHash<T, Cmp>(sketch_size), hf_(std::move(hf)), cmp_(std::move(cmp))
+        AbstractMinHash<T, Cmp>(sketch_size), hf_(std::move(hf)), cmp_(std::move(cmp)), minimizers_(sketch_size, cmp_)
     {
     }
     void show() {
@@ -127,16 +227,16 @@ public:
     DBSKETCH_READ_STRING_MACROS
     DBSKETCH_WRITE_STRING_MACROS
     ssize_t read(gzFile fp) {
-        ssize_t ret = gzread(fp, this, sizeof(*this));
+        char tmp[sizeof(*this)];
+        ssize_t ret = gzread(fp, tmp, sizeof(tmp));
+        std::memcpy(&this->ss_, tmp + (reinterpret_cast<const char *>(&this->ss_) - reinterpret_cast<const char *>(this)), sizeof(this->ss_));
+        minimizers_ = decltype(minimizers_)(this->ss_, cmp_);
         T v;
         for(ssize_t read; (read = gzread(fp, &v, sizeof(v))) == sizeof(v);minimizers_.insert(v), ret += read);
         return ret;
     }
     RangeMinHash &operator+=(const RangeMinHash &o) {
         minimizers_.insert(o.begin(), o.end());
-        while(minimizers_.size() > this->ss_) {
-            minimizers_.erase(minimizers_.begin());
-        }
         return *this;
     }
     RangeMinHash operator+(const RangeMinHash &o) const {
@@ -171,13 +271,7 @@ public:
         add(hf_(val));
     }
     INLINE void add(T val) {
-        if(minimizers_.size() == this->ss_) {
-            if(cmp_(max_element(), val)) {
-                minimizers_.insert(val);
-                if(minimizers_.size() > this->ss_)
-                    minimizers_.erase(minimizers_.begin());
-            }
-        } else minimizers_.insert(val);
+        minimizers_.insert(val);
     }
     template<typename T2>
     INLINE void addh(T2 val) {
@@ -200,6 +294,10 @@ public:
     }
     double jaccard_index(const RangeMinHash &o) const {
         //assert(o.size() == minimizers_.size());
+        if constexpr(std::is_same<Cmp, std::greater<T>>::value && std::is_integral<T>::value) {
+            const auto &l = minimizers_.sorted_best(), &r = o.minimizers_.sorted_best();
+            return double(isz::bottom_k_intersection_size(l.data(), l.size(), r.data(), r.size(), l.size())) / l.size();
+        }
         auto lit = minimizers_.rbegin(), rit = o.minimizers_.rbegin(), lend = minimizers_.rend(), rend = o.minimizers_.rend();
         const size_t n = minimizers_.size();
         size_t nused = 0, shared = 0;
@@ -220,16 +318,17 @@ public:
     }
     template<typename Container>
     Container to_container() const {
+        Container ret(minimizers_.rbegin(), minimizers_.rend());
         if(this->ss_ != size()) // If the sketch isn't full, add max to the end until it is.
-            minimizers_.resize(this->ss_, std::numeric_limits<T>::max());
-        return Container(std::rbegin(minimizers_), std::rend(minimizers_.end()));
+            ret.resize(this->ss_, std::numeric_limits<T>::max());
+        return ret;
     }
     void clear() {
-        decltype(minimizers_)().swap(minimizers_);
+        minimizers_.clear();
     }
     void free() {clear();}
     final_type cfinalize() const {
-        std::vector<T> reta(minimizers_.begin(), minimizers_.end());
+        std::vector<T> reta(minimizers_.rbegin(), minimizers_.rend());
         return final_type(std::move(reta));
     }
     final_type finalize() & {
@@ -242,7 +341,7 @@ public:
         return static_cast<const RangeMinHash &&>(*this).finalize();
     }
     final_type finalize() const && {
-        std::vector<T> reta(minimizers_.begin(), minimizers_.end());
+        std::vector<T> reta(minimizers_.rbegin(), minimizers_.rend());
         if(reta.size() < this->ss_) {
             reta.insert(reta.end(), this->ss_ - reta.size(), std::numeric_limits<uint64_t>::max());
         }
@@ -286,24 +385,10 @@ struct FinalRMinHash {
     size_t intersection_size(const FinalRMinHash &o) const {
         return isz::intersection_size(first, o.first);
     }
+    // Fraction of the first size() values of the union which both sketches share.
     double jaccard_index(const FinalRMinHash &o) const {
-        auto lit = begin(), rit = o.begin(), lend = end(), rend = o.end();
         const size_t n = size();
-        size_t nused = 0, shared = 0;
-        while(nused++ < n) {
-            if(*lit == *rit) {
-                ++shared;
-                if(++lit == lend) break;
-                if(++rit == rend) break;
-            } else {
-                if(*lit < *rit) {
-                    if(++lit == lend) break;
-                } else {
-                    if(++rit == rend) break;
-                }
-            }
-        }
-        return double(shared) / n;
+        return double(isz::bottom_k_intersection_size(first.data(), n, o.first.data(), o.size(), n)) / n;
         //double is = intersection_size(o);
         //return is / ((size() << 1) - is);
     }
@@ -502,13 +587,14 @@ class CountingRangeMinHash: public AbstractMinHash<T, Cmp> {
         VType &operator=(const VType &o) {
             this->first = o.first;
             this->second = o.second;
+            return *this;
         }
         VType(gzFile fp) {if(gzread(fp, this, sizeof(*this)) != sizeof(*this)) throw ZlibError("Failed to read");}
     };
     Hasher hf_;
     Cmp cmp_;
     mutable CountType cached_sum_sq_ = 0, cached_sum_ = 0;
-    std::set<VType> minimizers_; // using std::greater<T> so that we can erase from begin()
+    FlatBottomK<T, Cmp, VType> minimizers_; // In Cmp order, so that begin() is the entry to be displaced next
 public:
     const auto &min() const {return minimizers_;}
     using size_type = CountType;
@@ -523,24 +609,15 @@ public:
     auto rend() {return minimizers_.rend();}
     auto rend() const {return minimizers_.rend();}
     void free() {
-        std::set<VType> tmp;
-        std::swap(tmp, minimizers_);
+        minimizers_.clear();
     }
-    CountingRangeMinHash(size_t n, Hasher &&hf=Hasher(), Cmp &&cmp=Cmp()): AbstractMinHash<T, Cmp>(n), hf_(std::move(hf)), cmp_(std::move(cmp)) {}
+    CountingRangeMinHash(size_t n, Hasher &&hf=Hasher(), Cmp &&cmp=Cmp()): AbstractMinHash<T, Cmp>(n), hf_(std::move(hf)), cmp_(std::move(cmp)), minimizers_(n, cmp_) {}
     CountingRangeMinHash(std::string s): CountingRangeMinHash(0) {throw NotImplementedError("");}
     double cardinality_estimate(MHCardinalityMode mode=ARITHMETIC_MEAN) const {
         return double(std::numeric_limits<T>::max()) / std::max_element(minimizers_.begin(), minimizers_.end(), [](auto x, auto y) {return x.first < y.first;})->first * minimizers_.size();
     }
     INLINE void add(T val) {
-        if(minimizers_.size() == this->ss_) {
-            if(cmp_(begin()->first, val)) {
-                auto it = minimizers_.find(VType(val, 0));
-                if(it == minimizers_.end()) {
-                    minimizers_.erase(begin());
-                    minimizers_.insert(VType(val, CountType(1)));
-                } else ++it->second;
-            }
-        } else minimizers_.insert(VType(val, CountType(1)));
+        minimizers_.insert(VType(val, CountType(1)));
     }
     INLINE void addh(T val) {
         val = hf_(val);
@@ -632,8 +709,7 @@ public:
     }
 
     void clear() {
-        decltype(minimizers_) tmp;
-        std::swap(tmp, minimizers_);
+        minimizers_.clear();
     }
     template<typename WeightFn=weight::EqualWeight>
     double tf_idf(const CountingRangeMinHash &o, const WeightFn &fn) const {
@@ -970,6 +1046,10 @@ struct FinalCRMinHash: public FinalRMinHash<T> {
     double jaccard_index(const FinalCRMinHash &o) const {
         return tf_idf(o);
     }
+    // Unweighted Jaccard over the hashes alone, ignoring counts.
+    double set_jaccard_index(const FinalCRMinHash &o) const {
+        return super::jaccard_index(o);
+    }
     double containment_index(const FinalCRMinHash &o) const {
         const size_t lsz = this->size();
         const size_t rsz = o.size();
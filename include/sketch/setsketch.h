@@ -262,6 +262,36 @@ INLINE double broadcast_reduce_sum(__m256d x) {
 }
 #endif
 
+namespace detail {
+// Smallest 64-bit hash whose first exponential variate, scale * -log(hash * 2^-64), can be at most lim.
+// Smaller hashes fail update's first test. The bound is conservative, so update still makes the final decision.
+static inline uint64_t first_hash_bound(long double lim, long double scale) {
+    if(!(lim > 0.L)) return 0;
+    const long double t = std::exp(-lim / scale) * (1.L - 1e-9L) * 0x1p64L;
+    return t >= 2.L ? uint64_t(t) - 1: uint64_t(0);
+}
+// Bit j of the result is set if rv[j] >= bound, for j < n <= 64.
+static inline uint64_t hash_survivors(const uint64_t *rv, size_t n, uint64_t bound) {
+    uint64_t ret = 0;
+    size_t j = 0;
+    if(bound == 0) return n == 64 ? uint64_t(-1): (uint64_t(1) << n) - 1;
+#if __AVX512F__
+    const __m512i vb = _mm512_set1_epi64(bound);
+    for(; j + 8 <= n; j += 8)
+        ret |= uint64_t(_mm512_cmpge_epu64_mask(_mm512_loadu_si512(rv + j), vb)) << j;
+#elif __AVX2__
+    const __m256i flip = _mm256_set1_epi64x(int64_t(1) << 63), vb = _mm256_xor_si256(_mm256_set1_epi64x(bound - 1), flip);
+    for(; j + 4 <= n; j += 4) {
+        const __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(rv + j)), flip);
+        ret |= uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, vb)))) << j;
+    }
+#endif
+    for(; j < n; ++j) ret |= uint64_t(rv[j] >= bound) << j;
+    return ret;
+}
+static constexpr size_t UPDATE_BATCH_BLOCK = 64;
+} // namespace detail
+
 static inline long double g_b(long double b, long double arg) {
     return (1.L - std::pow(b, -arg)) / (1.L - 1.L / b);
 }
@@ -315,7 +345,7 @@ public:
         if(track_counts)         idcounts_.resize(m_);
         //generate_betas();
     }
-    CSetSketch(const CSetSketch &o): m_(o.m_), data_(allocate(o.m_)), ls_(m_), mvt_(m_, o.mvt_.mv()), ids_(o.ids_), idcounts_(o.idcounts_) {
+    CSetSketch(const CSetSketch &o): m_(o.m_), data_(allocate(o.m_)), ls_(m_), mvt_(m_, o.mvt_.mv()), ids_(o.ids_), idcounts_(o.idcounts_), total_updates_(o.total_updates_) {
         mvt_.assign(data_.get(), m_, o.mvt_.mv());
         std::copy(o.data_.get(), &o.data_[2 * m_ - 1], data_.get());
         //generate_betas();
@@ -419,6 +449,30 @@ public:
             }
         }
     }
+    /*
+     * Equivalent to calling update on each of ids[0, n).
+     * Ids are hashed a block at a time, and those whose first variate already exceeds max(),
+     * which after warm-up is nearly all of them, are dropped by a vector compare on the raw hashes.
+     * Only the survivors pay for the logarithm and the shuffler.
+     */
+    void update_batch(const uint64_t *ids, size_t n) {
+        uint64_t rv[detail::UPDATE_BATCH_BLOCK];
+        FT lim = -1;
+        uint64_t bound = 0;
+        for(size_t i = 0; i < n; i += detail::UPDATE_BATCH_BLOCK) {
+            const size_t nb = std::min(detail::UPDATE_BATCH_BLOCK, n - i);
+            for(size_t j = 0; j < nb; ++j) rv[j] = sketch::hash::CEHasher()(ids[i + j] ^ uint64_t(0xb2069fc679a8da0buLL));
+            if(lim != max()) bound = detail::first_hash_bound(lim = max(), 1.L / m_);
+            uint64_t mask = detail::hash_survivors(rv, nb, bound);
+            total_updates_ += nb - __builtin_popcountll(mask);
+            for(; mask; mask &= mask - 1) {
+                const size_t j = __builtin_ctzll(mask);
+                if(rv[j] < bound) {++total_updates_; continue;} // max() may have dropped since the block was filtered
+                update(ids[i + j]);
+                if(lim != max()) bound = detail::first_hash_bound(lim = max(), 1.L / m_);
+            }
+        }
+    }
     bool operator==(const CSetSketch<FT> &o) const {
         return same_params(o) && std::equal(data(), data() + m_, o.data());
     }
@@ -430,7 +484,7 @@ public:
     void merge(const CSetSketch<FT> &o) {
         if(!same_params(o)) throw std::runtime_error("Can't merge sets with differing parameters");
         if(ids().empty()) {
-            std::transform(data(), data() + m_, o.data(), data(), [](auto x, auto y) {return std::min(x, y);});
+            for(size_t i = 0; i < m_; ++i) mvt_.update(i, o.data_[i]);
         } else {
             for(size_t i = 0; i < size(); ++i) {
                 if(!idcounts_.empty() && !ids_.empty() && ids_[i] == o.ids_[i]) {
@@ -666,6 +720,7 @@ public:
     size_t size() const {return m_;}
     double b() const {return b_;}
     double a() const {return a_;}
+    QType q() const {return q_;}
     ResT &operator[](size_t i) {return data_[i];}
     const ResT &operator[](size_t i) const {return data_[i];}
     int klow() const {return lowkh_.klow();}
@@ -710,6 +765,31 @@ public:
             rv = wy::wyhash64_stateless(&hid);
         }
     }
+    /*
+     * Equivalent to calling update on each of ids[0, n).
+     * Ids are hashed a block at a time, and those whose first variate already exceeds explim(),
+     * which after warm-up is nearly all of them, are dropped by a vector compare on the raw hashes.
+     * Only the survivors pay for the logarithm and the shuffler.
+     */
+    void update_batch(const uint64_t *ids, size_t n) {
+        uint64_t rv[detail::UPDATE_BATCH_BLOCK];
+        double lim = -1.;
+        uint64_t bound = 0;
+        for(size_t i = 0; i < n; i += detail::UPDATE_BATCH_BLOCK) {
+            const size_t nb = std::min(detail::UPDATE_BATCH_BLOCK, n - i);
+            for(size_t j = 0; j < nb; ++j) {
+                uint64_t hid = ids[i + j];
+                rv[j] = wy::wyhash64_stateless(&hid);
+            }
+            if(lim != explim()) bound = detail::first_hash_bound(lim = explim(), -lbetas_[0]);
+            for(uint64_t mask = detail::hash_survivors(rv, nb, bound); mask; mask &= mask - 1) {
+                const size_t j = __builtin_ctzll(mask);
+                if(rv[j] < bound) continue; // explim() may have dropped since the block was filtered
+                update(ids[i + j]);
+                if(lim != explim()) bound = detail::first_hash_bound(lim = explim(), -lbetas_[0]);
+            }
+        }
+    }
     bool operator==(const SetSketch<ResT, FT> &o) const {
         return same_params(o) && std::equal(data(), data() + m_, o.data());
     }
@@ -767,7 +847,8 @@ public:
     }
     void merge(const SetSketch<ResT, FT> &o) {
         if(!same_params(o)) throw std::runtime_error("Can't merge sets with differing parameters");
-        std::transform(data(), data() + m_, o.data(), data(), [](auto x, auto y) {return std::max(x, y);});
+        // Update through the tree so that explim() stays current for later updates
+        for(size_t i = 0; i < m_; ++i) lowkh_.update(i, o.data_[i]);
         mycard_ = -1.;
     }
     SetSketch &operator+=(const SetSketch<ResT, FT> &o) {merge(o); return *this;}
@@ -152,7 +152,7 @@ public:
         assert(std::accumulate(usum.begin(), usum.end(), 0u, std::plus<>()) == size_t(1) << p_);
         std::array<double, 3> ret;
         double myrep = this->report(), orep = hll.creport(), us = hll::detail::ertl_ml_estimate(usum, p_, q());
-        double is = myrep + orep - us;
+        double is = std::max(myrep + orep - us, 0.);
         ret[0] = std::max(myrep - is, 0.);
         ret[1] = std::max(orep - is, 0.);
         ret[2] = std::max(is, 0.);
@@ -228,7 +228,7 @@ inline std::array<double, 3> pair_query(const Container &con, const hll::hllbase
     lsum[0] = (1ul << hll.p()) - con.size();
     auto hcore = hll.core();
     for(const auto &pair: con) {
-        const auto oval = hcore[pair.second];
+        const auto oval = hcore[pair.first];
         if(hcore[pair.first] < pair.second)
             --usum[oval], ++usum[pair.second];
         ++lsum[pair.second];
@@ -241,7 +241,7 @@ inline std::array<double, 3> pair_query(const Container &con, const hll::hllbase
     double myrep = hll::detail::ertl_ml_estimate(lsum, p, 64 - p),
             orep = hll.creport(),
               us = hll::detail::ertl_ml_estimate(usum, p, 64 - p),
-              is = myrep + orep - us;
+              is = std::max(myrep + orep - us, 0.);
     return std::array<double, 3>{std::max(myrep - is, 0.), std::max(orep - is, 0.), std::max(is, 0.)};
 }
 
@@ -257,7 +257,7 @@ inline std::array<double, 3> pair_query(const Container &con, const Container &c
             ++usum[ir->second];
             ++ir;
         } else if(ir->first > il->first) {
-            ++rsum[il->second];
+            ++lsum[il->second];
             ++usum[il->second];
             ++il;
         } else {
@@ -267,18 +267,50 @@ inline std::array<double, 3> pair_query(const Container &con, const Container &c
             ++ir; ++il;
         }
     }
-    while(il != el) {
+    for(; il != el; ++il) {
         ++usum[il->second];
         ++lsum[il->second];
     }
-    while(ir != er) {
+    for(; ir != er; ++ir) {
         ++usum[ir->second];
         ++rsum[ir->second];
     }
     double myrep = hll::detail::ertl_ml_estimate(lsum, p, 64 - p),
             orep = hll::detail::ertl_ml_estimate(rsum, p, 64 - p),
               us = hll::detail::ertl_ml_estimate(usum, p, 64 - p),
-              is = myrep + orep - us;
+              is = std::max(myrep + orep - us, 0.);
+    return std::array<double, 3>{std::max(myrep - is, 0.), std::max(orep - is, 0.), std::max(is, 0.)};
+}
+// As pair_query over two containers, but for flattened, sorted SparseHLL32-encoded values.
+template<typename A1, typename A2>
+inline std::array<double, 3> packed_pair_query(const std::vector<uint32_t, A1> &con, const std::vector<uint32_t, A2> &c2, const int p) {
+    std::array<uint32_t, 64> lsum{0}, rsum{0}, usum{0};
+    lsum[0] = (1ul << p) - con.size();
+    rsum[0] = (1ul << p) - c2.size();
+    size_t nu = 0;
+    auto il = con.begin(), ir = c2.begin(), el = con.end(), er = c2.end();
+    while(il != el && ir != er) {
+        const uint32_t li = SparseHLL32::get_index(*il), ri = SparseHLL32::get_index(*ir);
+        if(li > ri) {
+            ++rsum[SparseHLL32::get_value(*ir)];
+            ++usum[SparseHLL32::get_value(*ir++)];
+        } else if(ri > li) {
+            ++lsum[SparseHLL32::get_value(*il)];
+            ++usum[SparseHLL32::get_value(*il++)];
+        } else {
+            ++lsum[SparseHLL32::get_value(*il)];
+            ++rsum[SparseHLL32::get_value(*ir)];
+            ++usum[SparseHLL32::get_value(std::max(*il++, *ir++))];
+        }
+        ++nu;
+    }
+    for(; il != el; ++nu) ++lsum[SparseHLL32::get_value(*il)], ++usum[SparseHLL32::get_value(*il++)];
+    for(; ir != er; ++nu) ++rsum[SparseHLL32::get_value(*ir)], ++usum[SparseHLL32::get_value(*ir++)];
+    usum[0] = (1ul << p) - nu;
+    double myrep = hll::detail::ertl_ml_estimate(lsum, p, 64 - p),
+            orep = hll::detail::ertl_ml_estimate(rsum, p, 64 - p),
+              us = hll::detail::ertl_ml_estimate(usum, p, 64 - p),
+              is = std::max(myrep + orep - us, 0.);
     return std::array<double, 3>{std::max(myrep - is, 0.), std::max(orep - is, 0.), std::max(is, 0.)};
 }
 template<typename Allocator>
@@ -361,10 +393,252 @@ inline std::array<double, 3> flatten_and_query(std::vector<uint32_t, Allocator>
     double myrep = hll::detail::ertl_ml_estimate(lsum, p, 64 - p),
             orep = hll::detail::ertl_ml_estimate(osum, p, 64 - p),
               us = hll::detail::ertl_ml_estimate(usum, p, 64 - p),
-              is = myrep + orep - us;
+              is = std::max(myrep + orep - us, 0.);
     return std::array<double, 3>{std::max(myrep - is, 0.), std::max(orep - is, 0.), std::max(is, 0.)};
 }
 
+// HyperLogLog which starts sparse and promotes itself to a dense hllbase_t.
+// While sparse, nonzero registers are kept as SparseHLL32-encoded values, sorted and stored as varint deltas,
+// using a few bytes per register instead of one byte for each of the 2^p.
+// New values are appended to a small unsorted buffer, which is flattened and merged into the list once full.
+// Once the list exceeds max_sparse_bytes (by default, 1/4 of the dense size), the registers move to a dense sketch.
+// Both forms use the same p, so promotion is exact and estimates do not change with the representation.
+// Not threadsafe. Const queries flush the buffer, so they must not run concurrently either.
+template<typename HashStruct=hash::WangHash>
+class AdaptiveHLL {
+public:
+    using dense_type = hll::hllbase_t<HashStruct>;
+private:
+    mutable std::vector<uint8_t> packed_;
+    mutable std::vector<uint32_t> buf_;
+    mutable uint32_t nentries_ = 0;
+    uint32_t p_;
+    size_t max_sparse_bytes_;
+    std::unique_ptr<dense_type> dense_;
+    HashStruct hf_;
+
+    static void append_varint(std::vector<uint8_t> &out, uint32_t x) {
+        for(; x >= 0x80; x >>= 7) out.push_back(uint8_t(x) | 0x80);
+        out.push_back(uint8_t(x));
+    }
+    static uint32_t next_varint(const uint8_t *&p) {
+        uint32_t ret = *p & 0x7F;
+        for(unsigned shift = 7; *p++ & 0x80; shift += 7) ret |= uint32_t(*p & 0x7F) << shift;
+        return ret;
+    }
+    size_t buffer_limit() const {
+        return std::max(size_t(16), std::min(size_t(nentries_ / 4), max_sparse_bytes_ / sizeof(uint32_t)));
+    }
+    // Merges buffered values into the sorted list, keeping the maximum rank for each register.
+    void flush() const {
+        if(buf_.empty()) return;
+        flatten(buf_);
+        std::vector<uint8_t> out;
+        out.reserve(packed_.size() + 3 * buf_.size());
+        uint32_t last = 0, n = 0;
+        auto emit = [&](uint32_t v) {append_varint(out, v - last); last = v; ++n;};
+        auto bit = buf_.cbegin(), be = buf_.cend();
+        uint32_t cur = 0;
+        for(const uint8_t *p = packed_.data(), *pe = p + packed_.size(); p != pe;) {
+            cur += next_varint(p);
+            const uint32_t ci = SparseHLL32::get_index(cur);
+            while(bit != be && SparseHLL32::get_index(*bit) < ci) emit(*bit++);
+            // For equal indices, the larger encoded value holds the larger rank.
+            if(bit != be && SparseHLL32::get_index(*bit) == ci) emit(std::max(cur, *bit++));
+            else emit(cur);
+        }
+        while(bit != be) emit(*bit++);
+        if(out.capacity() > out.size() + out.size() / 4) out.shrink_to_fit();
+        packed_.swap(out);
+        nentries_ = n;
+        buf_.clear();
+    }
+    void flush_and_check() {
+        flush();
+        if(packed_.size() > max_sparse_bytes_) promote();
+    }
+public:
+    static size_t default_sparse_bytes(size_t p) {return (size_t(1) << p) / 4;}
+    AdaptiveHLL(size_t p, size_t max_sparse_bytes, HashStruct &&hf): p_(p), max_sparse_bytes_(max_sparse_bytes), hf_(std::move(hf)) {
+        if(p < 4 || p > SparseHLL32::max_p()) throw std::runtime_error(std::string("p must be between 4 and ") + std::to_string(SparseHLL32::max_p()));
+    }
+    explicit AdaptiveHLL(size_t p, size_t max_sparse_bytes=size_t(-1)):
+        AdaptiveHLL(p, max_sparse_bytes == size_t(-1) ? default_sparse_bytes(p): max_sparse_bytes, HashStruct()) {}
+    AdaptiveHLL(const AdaptiveHLL &o): packed_(o.packed_), buf_(o.buf_), nentries_(o.nentries_), p_(o.p_), max_sparse_bytes_(o.max_sparse_bytes_),
+        dense_(o.dense_ ? new dense_type(*o.dense_): nullptr), hf_(o.hf_) {}
+    AdaptiveHLL &operator=(const AdaptiveHLL &o) {
+        if(this != &o) *this = AdaptiveHLL(o);
+        return *this;
+    }
+    AdaptiveHLL(AdaptiveHLL &&o) = default;
+    AdaptiveHLL &operator=(AdaptiveHLL &&o) = default;
+
+    unsigned p() const {return p_;}
+    unsigned q() const {return 64 - p_;}
+    uint64_t m() const {return uint64_t(1) << p_;}
+    bool is_sparse() const {return !dense_;}
+    // Null while sparse.
+    const dense_type *dense() const {return dense_.get();}
+    uint64_t hash(uint64_t val) const {return hf_(val);}
+    std::pair<size_t, size_t> est_memory_usage() const {
+        return std::make_pair(sizeof(*this), dense_ ? dense_->est_memory_usage().first + dense_->size()
+                                                    : packed_.capacity() + buf_.capacity() * sizeof(uint32_t));
+    }
+
+    void add(uint64_t hashval) {
+        if(dense_) {
+            dense_->add(hashval);
+            return;
+        }
+        const uint8_t lzt = clz(((hashval << 1)|1) << (p_ - 1)) + 1;
+        buf_.push_back(SparseHLL32::encode_value(hashval >> q(), lzt));
+        if(buf_.size() >= buffer_limit()) flush_and_check();
+    }
+    void addh(uint64_t element) {add(hf_(element));}
+    void add_batch(const uint64_t *hashes, size_t n) {
+        uint32_t idx[dense_type::BATCH_SIZE];
+        uint8_t rank[dense_type::BATCH_SIZE];
+        for(size_t i = 0; i < n; i += dense_type::BATCH_SIZE) {
+            const size_t nb = std::min(size_t(dense_type::BATCH_SIZE), n - i);
+            if(dense_) {
+                dense_->add_batch(hashes + i, n - i);
+                return;
+            }
+            hll::detail::batch_index_rank(hashes + i, nb, p_, idx, rank);
+            for(size_t j = 0; j < nb; ++j) {
+                if(dense_) {
+                    dense_->add_batch(hashes + i + j, n - i - j);
+                    return;
+                }
+                buf_.push_back(SparseHLL32::encode_value(idx[j], rank[j]));
+                if(buf_.size() >= buffer_limit()) flush_and_check();
+            }
+        }
+    }
+    void addh_batch(const uint64_t *keys, size_t n) {
+        alignas(64) uint64_t hv[dense_type::BATCH_SIZE];
+        for(size_t i = 0; i < n; i += dense_type::BATCH_SIZE) {
+            const size_t nb = std::min(size_t(dense_type::BATCH_SIZE), n - i);
+            hll::detail::hash_block(hf_, keys + i, hv, nb);
+            add_batch(hv, nb);
+        }
+    }
+
+    // Calls func on each SparseHLL32-encoded nonzero register, in index order. Requires the sketch to be sparse.
+    template<typename Functor>
+    void for_each_sparse(const Functor &func) const {
+        assert(is_sparse());
+        flush();
+        uint32_t cur = 0;
+        for(const uint8_t *p = packed_.data(), *pe = p + packed_.size(); p != pe; func(cur += next_varint(p)));
+    }
+    // Sorted SparseHLL32-encoded registers, as used by flatten_and_query and packed_pair_query.
+    std::vector<uint32_t> sparse_values() const {
+        std::vector<uint32_t> ret;
+        flush();
+        ret.reserve(nentries_);
+        for_each_sparse([&ret](uint32_t v) {ret.push_back(v);});
+        return ret;
+    }
+    void promote() {
+        if(dense_) return;
+        std::unique_ptr<dense_type> d(new dense_type(p_, HashStruct(hf_)));
+        auto &core = d->mutable_core();
+        for_each_sparse([&core](uint32_t v) {core[SparseHLL32::get_index(v)] = SparseHLL32::get_value(v);});
+        dense_ = std::move(d);
+        std::vector<uint8_t>().swap(packed_);
+        std::vector<uint32_t>().swap(buf_);
+        nentries_ = 0;
+    }
+    // Merges the buffer and releases its memory, leaving only the sorted list, e.g. once a sketch is complete.
+    void compact() {
+        if(dense_) return;
+        flush_and_check();
+        std::vector<uint32_t>().swap(buf_);
+    }
+    dense_type to_dense() const {
+        if(dense_) return *dense_;
+        AdaptiveHLL tmp(*this);
+        tmp.promote();
+        return std::move(*tmp.dense_);
+    }
+
+    std::array<uint32_t, 64> sum_counts() const {
+        if(dense_) return hll::detail::sum_counts(dense_->core());
+        std::array<uint32_t, 64> ret{0};
+        for_each_sparse([&ret](uint32_t v) {++ret[SparseHLL32::get_value(v)];});
+        ret[0] = m() - nentries_;
+        return ret;
+    }
+    double report() const {
+        if(dense_) return dense_->creport();
+        return hll::detail::ertl_ml_estimate(sum_counts(), p_, q());
+    }
+    double creport() const {return report();}
+    double cardinality_estimate() const {return report();}
+
+    // Estimated sizes of {this \ o, o \ this, this & o}.
+    std::array<double, 3> full_set_comparison(const AdaptiveHLL &o) const {
+        PREC_REQ(p_ == o.p_, "mismatched sketch sizes.");
+        if(dense_ && o.dense_) return dense_->full_set_comparison(*o.dense_);
+        if(dense_) {
+            auto vals = o.sparse_values();
+            const auto ret = flatten_and_query(vals, *dense_, nullptr, true);
+            return std::array<double, 3>{ret[1], ret[0], ret[2]};
+        }
+        if(o.dense_) {
+            auto vals = sparse_values();
+            return flatten_and_query(vals, *o.dense_, nullptr, true);
+        }
+        return packed_pair_query(sparse_values(), o.sparse_values(), p_);
+    }
+    double union_size(const AdaptiveHLL &o) const {
+        const auto fsc = full_set_comparison(o);
+        return fsc[0] + fsc[1] + fsc[2];
+    }
+    double jaccard_index(const AdaptiveHLL &o) const {
+        const auto fsc = full_set_comparison(o);
+        return fsc[2] / (fsc[0] + fsc[1] + fsc[2]);
+    }
+    double containment_index(const AdaptiveHLL &o) const {
+        const auto fsc = full_set_comparison(o);
+        return fsc[2] / (fsc[0] + fsc[2]);
+    }
+
+    AdaptiveHLL &operator+=(const AdaptiveHLL &o) {
+        PREC_REQ(p_ == o.p_, "mismatched sketch sizes.");
+        if(o.dense_) {
+            promote();
+            *dense_ += *o.dense_;
+        } else if(dense_) {
+            auto &core = dense_->mutable_core();
+            o.for_each_sparse([&core](uint32_t v) {
+                const uint8_t val = SparseHLL32::get_value(v);
+                auto &reg = core[SparseHLL32::get_index(v)];
+                reg = std::max(reg, val);
+            });
+            if(dense_->incremental()) dense_->set_incremental();
+            dense_->not_ready();
+        } else {
+            o.for_each_sparse([this](uint32_t v) {buf_.push_back(v);});
+            flush_and_check();
+        }
+        return *this;
+    }
+    AdaptiveHLL operator+(const AdaptiveHLL &o) const {
+        AdaptiveHLL ret(*this);
+        ret += o;
+        return ret;
+    }
+    // Empties the sketch and returns it to the sparse representation.
+    void clear() {
+        dense_.reset();
+        std::vector<uint8_t>().swap(packed_);
+        std::vector<uint32_t>().swap(buf_);
+        nentries_ = 0;
+    }
+};
+
 } // sparse
 
 } // sketch
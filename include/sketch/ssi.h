@@ -12,8 +12,16 @@
 #include "sketch/div.h"
 #include "sketch/integral.h"
 #include "sketch/hash.h"
+#include "sketch/count_eq.h"
 #include <mutex>
 #include <optional>
+#include <thread>
+#include <memory>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <numeric>
 
 
 namespace sketch {
@@ -33,6 +41,541 @@ static inline constexpr uint64_t wyhash64_stateless(uint64_t *seed) {
   return _wymum(*seed ^ 0xe7037ed1a0b428dbull, *seed);
 }
 
+namespace detail {
+
+/*
+ * Epoch-based reclamation for memory which lock-free readers may still be using.
+ * Readers pin the current epoch for the duration of a query.
+ * Writers retire memory after unpublishing it, and it is freed once every pinned reader
+ * entered after the retirement.
+ */
+class EpochDomain {
+public:
+    static constexpr size_t NSLOTS = 256;
+    class Guard {
+        std::atomic<uint64_t> *slot_;
+    public:
+        explicit Guard(std::atomic<uint64_t> *slot=nullptr): slot_(slot) {}
+        Guard(Guard &&o): slot_(o.slot_) {o.slot_ = nullptr;}
+        Guard(const Guard &) = delete;
+        ~Guard() {if(slot_) slot_->store(0, std::memory_order_release);}
+    };
+private:
+    struct alignas(64) slot_t {std::atomic<uint64_t> epoch{0};};
+    std::atomic<uint64_t> global_{1};
+    std::unique_ptr<slot_t[]> slots_;
+    std::mutex retired_mutex_;
+    std::vector<std::tuple<void *, void (*)(void *), uint64_t>> retired_;
+public:
+    EpochDomain(): slots_(new slot_t[NSLOTS]) {}
+    EpochDomain(const EpochDomain &) = delete;
+    ~EpochDomain() {
+        for(auto &r: retired_) std::get<1>(r)(std::get<0>(r));
+    }
+    Guard pin() {
+        for(size_t i = std::hash<std::thread::id>()(std::this_thread::get_id());; ++i) {
+            auto &s = slots_[i % NSLOTS].epoch;
+            uint64_t expected = 0;
+            if(s.load(std::memory_order_relaxed) == 0 && s.compare_exchange_strong(expected, global_.load()))
+                return Guard(&s);
+        }
+    }
+    // ptr must already be unreachable for readers which pin after this call.
+    void retire(void *ptr, void (*deleter)(void *)) {
+        const uint64_t epoch = global_.fetch_add(1);
+        std::lock_guard<std::mutex> lock(retired_mutex_);
+        retired_.emplace_back(ptr, deleter, epoch);
+        uint64_t minpinned = uint64_t(-1);
+        for(size_t i = 0; i < NSLOTS; ++i)
+            if(const uint64_t e = slots_[i].epoch.load(); e && e < minpinned) minpinned = e;
+        auto it = std::partition(retired_.begin(), retired_.end(), [minpinned](const auto &x) {return std::get<2>(x) >= minpinned;});
+        for(auto fit = it; fit != retired_.end(); ++fit) std::get<1>(*fit)(std::get<0>(*fit));
+        retired_.erase(it, retired_.end());
+    }
+};
+
+/*
+ * Open-addressing map from keys to append-only posting lists, supporting lock-free readers
+ * concurrently with one writer at a time.
+ * Posting lists are chains of chunks whose sizes are published with release stores, so they are never moved or freed
+ * while the table lives. Growing the slot array publishes a new array and retires the old one to an EpochDomain.
+ */
+template<typename KeyT, typename IdT>
+class PostingTable {
+    struct chunk_t {
+        std::atomic<uint32_t> n;
+        uint32_t cap;
+        std::atomic<chunk_t *> next;
+        chunk_t *tail; // Last chunk of the list, only used by the writer
+        IdT *ids() {return reinterpret_cast<IdT *>(this + 1);}
+        const IdT *ids() const {return reinterpret_cast<const IdT *>(this + 1);}
+        static chunk_t *make(uint32_t cap, IdT id) {
+            chunk_t *ret = static_cast<chunk_t *>(::operator new(sizeof(chunk_t) + cap * sizeof(IdT)));
+            ret->n.store(1, std::memory_order_relaxed);
+            ret->cap = cap;
+            ret->next.store(nullptr, std::memory_order_relaxed);
+            ret->tail = ret;
+            ret->ids()[0] = id;
+            return ret;
+        }
+    };
+    static_assert(sizeof(chunk_t) % alignof(IdT) == 0, "IDs must be aligned after the chunk header");
+    static constexpr uint32_t MAX_CHUNK = 4096;
+    struct slot_t {
+        std::atomic<KeyT> key;
+        std::atomic<chunk_t *> head;
+    };
+    struct array_t {
+        unsigned shift;
+        size_t mask;
+        std::unique_ptr<slot_t[]> slots;
+        explicit array_t(unsigned logcap): shift(64 - logcap), mask((size_t(1) << logcap) - 1), slots(new slot_t[size_t(1) << logcap]()) {}
+        size_t capacity() const {return mask + 1;}
+        size_t index(KeyT key) const {return (uint64_t(key) * 0x9E3779B97F4A7C15ull) >> shift;}
+        static void destroy(void *ptr) {delete static_cast<array_t *>(ptr);}
+    };
+    std::atomic<array_t *> tab_;
+    size_t nkeys_ = 0;
+
+    const chunk_t *find(KeyT key) const {
+        const array_t *a = tab_.load(std::memory_order_seq_cst);
+        for(size_t i = a->index(key);; i = (i + 1) & a->mask) {
+            const chunk_t *c = a->slots[i].head.load(std::memory_order_acquire);
+            if(!c || a->slots[i].key.load(std::memory_order_relaxed) == key) return c;
+        }
+    }
+    static void push(chunk_t *head, IdT id) {
+        chunk_t *t = head->tail;
+        const uint32_t n = t->n.load(std::memory_order_relaxed);
+        if(n == t->cap) {
+            chunk_t *nc = chunk_t::make(std::min(t->cap * 2, MAX_CHUNK), id);
+            t->next.store(nc, std::memory_order_release);
+            head->tail = nc;
+        } else {
+            t->ids()[n] = id;
+            t->n.store(n + 1, std::memory_order_release);
+        }
+    }
+    static void place(array_t *a, KeyT key, chunk_t *head) {
+        size_t i = a->index(key);
+        while(a->slots[i].head.load(std::memory_order_relaxed)) i = (i + 1) & a->mask;
+        a->slots[i].key.store(key, std::memory_order_relaxed);
+        a->slots[i].head.store(head, std::memory_order_release);
+    }
+    void free_all() {
+        array_t *a = tab_.load(std::memory_order_relaxed);
+        if(!a) return;
+        for(size_t i = 0; i < a->capacity(); ++i) {
+            for(chunk_t *c = a->slots[i].head.load(std::memory_order_relaxed), *nc; c; c = nc) {
+                nc = c->next.load(std::memory_order_relaxed);
+                ::operator delete(c);
+            }
+        }
+        delete a;
+    }
+public:
+    PostingTable(): tab_(new array_t(4)) {}
+    PostingTable(PostingTable &&o) noexcept: tab_(o.tab_.exchange(nullptr)), nkeys_(o.nkeys_) {o.nkeys_ = 0;}
+    PostingTable(const PostingTable &) = delete;
+    ~PostingTable() {free_all();}
+    size_t size() const {return nkeys_;}
+    size_t memory_usage() const {
+        const array_t *a = tab_.load(std::memory_order_acquire);
+        size_t ret = sizeof(*this) + sizeof(array_t) + a->capacity() * sizeof(slot_t);
+        for(size_t i = 0; i < a->capacity(); ++i)
+            for(const chunk_t *c = a->slots[i].head.load(std::memory_order_acquire); c; c = c->next.load(std::memory_order_acquire))
+                ret += sizeof(chunk_t) + c->cap * sizeof(IdT);
+        return ret;
+    }
+    // Calls f(id) on the IDs for key in insertion order until f returns false.
+    // Returns false if iteration was stopped. Readers must hold a Guard from the EpochDomain passed to append.
+    template<typename F>
+    bool visit(KeyT key, const F &f) const {
+        for(const chunk_t *c = find(key); c; c = c->next.load(std::memory_order_acquire)) {
+            const uint32_t n = c->n.load(std::memory_order_acquire);
+            const IdT *ids = c->ids();
+            for(uint32_t i = 0; i < n; ++i)
+                if(!f(ids[i])) return false;
+        }
+        return true;
+    }
+    // Calls f(key, ids) for every key, with ids a std::vector<IdT>.
+    template<typename F>
+    void for_each(const F &f) const {
+        const array_t *a = tab_.load(std::memory_order_seq_cst);
+        std::vector<IdT> ids;
+        for(size_t i = 0; i < a->capacity(); ++i) {
+            const chunk_t *c = a->slots[i].head.load(std::memory_order_acquire);
+            if(!c) continue;
+            ids.clear();
+            visit(a->slots[i].key.load(std::memory_order_relaxed), [&ids](IdT id) {ids.push_back(id); return true;});
+            f(a->slots[i].key.load(std::memory_order_relaxed), ids);
+        }
+    }
+    // Writers must be serialized externally.
+    void append(KeyT key, IdT id, EpochDomain &domain) {
+        array_t *a = tab_.load(std::memory_order_relaxed);
+        for(size_t i = a->index(key);; i = (i + 1) & a->mask) {
+            chunk_t *c = a->slots[i].head.load(std::memory_order_relaxed);
+            if(!c) break;
+            if(a->slots[i].key.load(std::memory_order_relaxed) == key) {
+                push(c, id);
+                return;
+            }
+        }
+        if((nkeys_ + 1) * 2 > a->capacity()) {
+            array_t *na = new array_t(64 - a->shift + 1);
+            for(size_t i = 0; i < a->capacity(); ++i)
+                if(chunk_t *c = a->slots[i].head.load(std::memory_order_relaxed))
+                    place(na, a->slots[i].key.load(std::memory_order_relaxed), c);
+            tab_.store(na, std::memory_order_seq_cst);
+            domain.retire(a, &array_t::destroy);
+            a = na;
+        }
+        place(a, key, chunk_t::make(4, id));
+        ++nkeys_;
+    }
+};
+
+// Returns the index of key in sorted array keys[0, n), or n if absent.
+// Binary search narrows the range to one vector's worth of keys, which are then compared at once.
+template<typename KeyT>
+inline size_t find_sorted(const KeyT *keys, size_t n, const KeyT key) {
+#if __AVX512F__
+    static constexpr size_t W = sizeof(KeyT) >= 4 ? 64 / sizeof(KeyT): 1;
+#elif __AVX2__
+    static constexpr size_t W = sizeof(KeyT) >= 4 ? 32 / sizeof(KeyT): 1;
+#else
+    static constexpr size_t W = 1;
+#endif
+    const KeyT *base = keys;
+    size_t len = n;
+    while(len > W) {
+        const size_t half = len / 2;
+        base = base[half] <= key ? base + half: base;
+        len -= half;
+    }
+    if(!len) return n;
+#if __AVX512F__
+    CONST_IF(sizeof(KeyT) == 8) {
+        const __mmask8 lm = (1u << len) - 1;
+        const __mmask8 hit = _mm512_mask_cmpeq_epi64_mask(lm, _mm512_maskz_loadu_epi64(lm, base), _mm512_set1_epi64(key));
+        return hit ? size_t(base - keys) + __builtin_ctz(hit): n;
+    }
+    CONST_IF(sizeof(KeyT) == 4) {
+        const __mmask16 lm = (1u << len) - 1;
+        const __mmask16 hit = _mm512_mask_cmpeq_epi32_mask(lm, _mm512_maskz_loadu_epi32(lm, base), _mm512_set1_epi32(key));
+        return hit ? size_t(base - keys) + __builtin_ctz(hit): n;
+    }
+#elif __AVX2__
+    CONST_IF(sizeof(KeyT) == 8) {
+        const __m256i lm = _mm256_cmpgt_epi64(_mm256_set1_epi64x(len), _mm256_setr_epi64x(0, 1, 2, 3));
+        const __m256i eq = _mm256_cmpeq_epi64(_mm256_maskload_epi64((const long long *)base, lm), _mm256_set1_epi64x(key));
+        const unsigned hit = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_and_si256(eq, lm)));
+        return hit ? size_t(base - keys) + __builtin_ctz(hit): n;
+    }
+    CONST_IF(sizeof(KeyT) == 4) {
+        const __m256i lm = _mm256_cmpgt_epi32(_mm256_set1_epi32(len), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        const __m256i eq = _mm256_cmpeq_epi32(_mm256_maskload_epi32((const int *)base, lm), _mm256_set1_epi32(key));
+        const unsigned hit = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(eq, lm)));
+        return hit ? size_t(base - keys) + __builtin_ctz(hit): n;
+    }
+#endif
+    for(size_t i = 0; i < len; ++i)
+        if(base[i] == key) return base - keys + i;
+    return n;
+}
+
+static inline void write_varint(std::vector<uint8_t> &out, uint64_t x) {
+    for(; x >= 0x80; x >>= 7) out.push_back(uint8_t(x) | 0x80);
+    out.push_back(uint8_t(x));
+}
+static inline uint64_t read_varint(const uint8_t *&p) {
+    uint64_t ret = 0;
+    for(unsigned shift = 0;; shift += 7) {
+        const uint8_t c = *p++;
+        ret |= uint64_t(c & 0x7F) << shift;
+        if(!(c & 0x80)) return ret;
+    }
+}
+
+/*
+ * Read-only CSR layout of an index's tables in one contiguous buffer, which can be written and memory-mapped as-is.
+ *
+ * Layout (host byte order):
+ *   header_t
+ *   uint64_t regs_per_reg[nlevels], uint64_t tables_per_level[nlevels]
+ *   table_t[ntables], in (level, subtable) order
+ *   For each table, 64-byte aligned:
+ *     KeyT keys[nkeys] (sorted), uint32_t offsets[nkeys + 1] into the table's ID bytes, ID bytes,
+ *     uint32_t directory[(1 << dir_bits) + 1]: the first key index for each value of the keys' top dir_bits bits
+ * Keys are hashes, so the directory narrows a lookup to a few keys, which are compared with SIMD.
+ * Each posting list stores its IDs in insertion order as zigzag-encoded deltas in LEB128 varints.
+ */
+template<typename KeyT, typename IdT>
+class FrozenTables {
+public:
+    struct header_t {
+        char magic[8];
+        uint32_t version;
+        uint8_t key_size, id_size, bottomk, pad_;
+        uint64_t m, total_ids, nlevels, ntables, nbytes, reserved_;
+        static constexpr const char *MAGIC() {return "SSIFROZ";}
+    };
+    static_assert(sizeof(header_t) == 64, "header_t must be 64 bytes");
+    struct table_t {
+        uint64_t nkeys, keys_offset, offsets_offset, ids_offset, ids_bytes, dir_offset, dir_bits;
+    };
+    static constexpr uint32_t VERSION = 1;
+private:
+    std::vector<uint64_t> buf_;
+    const uint8_t *data_ = nullptr;
+    size_t mapsz_ = 0; // Nonzero if data_ is a mapping
+    std::vector<size_t> level_starts_;
+
+    static uint64_t zigzag(int64_t x) {return (uint64_t(x) << 1) ^ uint64_t(x >> 63);}
+    static int64_t unzigzag(uint64_t x) {return int64_t(x >> 1) ^ -int64_t(x & 1);}
+    static size_t roundup64(size_t x) {return (x + 63) & ~size_t(63);}
+    static constexpr unsigned KEYBITS = sizeof(KeyT) * CHAR_BIT;
+    // About four keys per directory entry
+    static unsigned dir_bits(size_t nkeys) {
+        return nkeys < 8 ? 0u: std::min(unsigned(integral::ilog2(nkeys)) - 2, KEYBITS);
+    }
+    static size_t dir_index(KeyT key, unsigned bits) {return bits ? size_t(uint64_t(key) >> (KEYBITS - bits)): size_t(0);}
+    void index_levels() {
+        level_starts_.assign(1, 0);
+        for(size_t i = 0; i < header().nlevels; ++i) level_starts_.push_back(level_starts_.back() + tables_per_level()[i]);
+    }
+public:
+    /*
+     * for_each(i, j, f) must call f(key, ids) for every key in table j of level i.
+     * tables_per_level[i] gives the number of tables in level i.
+     */
+    template<typename ForEach>
+    FrozenTables(uint64_t m, uint64_t total_ids, bool bottomk, const std::vector<uint64_t> &regs_per_reg, const std::vector<uint64_t> &tables_per_level, const ForEach &for_each) {
+        const size_t nlevels = regs_per_reg.size();
+        const size_t ntables = std::accumulate(tables_per_level.begin(), tables_per_level.end(), size_t(0));
+        std::vector<table_t> dir(ntables);
+        std::vector<std::vector<uint8_t>> sections(ntables);
+        size_t offset = roundup64(sizeof(header_t) + nlevels * 2 * sizeof(uint64_t) + ntables * sizeof(table_t));
+        std::vector<std::pair<KeyT, std::vector<IdT>>> lists;
+        std::vector<uint8_t> ids;
+        for(size_t i = 0, ti = 0; i < nlevels; ++i) {
+            for(size_t j = 0; j < tables_per_level[i]; ++j, ++ti) {
+                lists.clear();
+                for_each(i, j, [&lists](KeyT key, const std::vector<IdT> &l) {lists.emplace_back(key, l);});
+                std::sort(lists.begin(), lists.end(), [](const auto &x, const auto &y) {return x.first < y.first;});
+                ids.clear();
+                std::vector<uint32_t> offsets{0};
+                for(const auto &l: lists) {
+                    int64_t last = 0;
+                    for(const auto id: l.second) {
+                        write_varint(ids, zigzag(int64_t(id) - last));
+                        last = id;
+                    }
+                    if(ids.size() > std::numeric_limits<uint32_t>::max()) throw std::runtime_error("Frozen SetSketchIndex tables are limited to 4GB of IDs each");
+                    offsets.push_back(ids.size());
+                }
+                auto &t = dir[ti];
+                auto &sec = sections[ti];
+                t.nkeys = lists.size();
+                t.keys_offset = offset;
+                t.offsets_offset = t.keys_offset + roundup64(t.nkeys * sizeof(KeyT));
+                t.ids_offset = t.offsets_offset + roundup64(offsets.size() * sizeof(uint32_t));
+                t.ids_bytes = ids.size();
+                t.dir_offset = t.ids_offset + roundup64(ids.size());
+                t.dir_bits = dir_bits(lists.size());
+                std::vector<uint32_t> directory((size_t(1) << t.dir_bits) + 1);
+                for(const auto &l: lists) ++directory[dir_index(l.first, t.dir_bits) + 1];
+                std::partial_sum(directory.begin(), directory.end(), directory.begin());
+                sec.resize(t.dir_offset + roundup64(directory.size() * sizeof(uint32_t)) - offset);
+                std::memcpy(&sec[t.dir_offset - offset], directory.data(), directory.size() * sizeof(uint32_t));
+                for(size_t k = 0; k < lists.size(); ++k)
+                    std::memcpy(&sec[k * sizeof(KeyT)], &lists[k].first, sizeof(KeyT));
+                std::memcpy(&sec[t.offsets_offset - offset], offsets.data(), offsets.size() * sizeof(uint32_t));
+                if(ids.size()) std::memcpy(&sec[t.ids_offset - offset], ids.data(), ids.size());
+                offset += sec.size();
+            }
+        }
+        buf_.resize((offset + 7) / 8);
+        uint8_t *p = reinterpret_cast<uint8_t *>(buf_.data());
+        header_t h{};
+        std::memcpy(h.magic, header_t::MAGIC(), sizeof(h.magic));
+        h.version = VERSION;
+        h.key_size = sizeof(KeyT); h.id_size = sizeof(IdT); h.bottomk = bottomk;
+        h.m = m; h.total_ids = total_ids; h.nlevels = nlevels; h.ntables = ntables; h.nbytes = offset;
+        std::memcpy(p, &h, sizeof(h));
+        std::memcpy(p + sizeof(h), regs_per_reg.data(), nlevels * sizeof(uint64_t));
+        std::memcpy(p + sizeof(h) + nlevels * sizeof(uint64_t), tables_per_level.data(), nlevels * sizeof(uint64_t));
+        if(ntables) std::memcpy(p + sizeof(h) + 2 * nlevels * sizeof(uint64_t), dir.data(), ntables * sizeof(table_t));
+        for(size_t ti = 0; ti < ntables; ++ti)
+            if(sections[ti].size()) std::memcpy(p + dir[ti].keys_offset, sections[ti].data(), sections[ti].size());
+        data_ = p;
+        index_levels();
+    }
+    // Maps a file written by write(path).
+    explicit FrozenTables(const std::string &path) {
+        const int fd = ::open(path.data(), O_RDONLY);
+        if(fd < 0) throw std::runtime_error(std::string("Could not open file at '") + path + "' for reading");
+        struct stat st;
+        if(::fstat(fd, &st) || size_t(st.st_size) < sizeof(header_t)) {
+            ::close(fd);
+            throw std::runtime_error(std::string("File at '") + path + "' is too small to be a frozen SetSketchIndex");
+        }
+        void *ptr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(ptr == MAP_FAILED) throw std::runtime_error(std::string("Failed to mmap '") + path + "'");
+        data_ = static_cast<const uint8_t *>(ptr);
+        mapsz_ = st.st_size;
+        const header_t &h = header();
+        std::string err;
+        if(std::memcmp(h.magic, header_t::MAGIC(), sizeof(h.magic))) err = "not a frozen SetSketchIndex";
+        else if(h.version != VERSION) err = "unsupported version " + std::to_string(h.version);
+        else if(h.key_size != sizeof(KeyT) || h.id_size != sizeof(IdT)) err = "key or ID type mismatch";
+        else if(h.nbytes > mapsz_ || sizeof(header_t) + 2 * h.nlevels * sizeof(uint64_t) + h.ntables * sizeof(table_t) > mapsz_) err = "file is truncated";
+        if(err.size()) {
+            ::munmap(ptr, mapsz_);
+            throw std::runtime_error(std::string("Could not map '") + path + "': " + err);
+        }
+        index_levels();
+    }
+    FrozenTables(const FrozenTables &) = delete;
+    ~FrozenTables() {
+        if(mapsz_) ::munmap(const_cast<uint8_t *>(data_), mapsz_);
+    }
+    void write(const std::string &path) const {
+        std::FILE *fp = std::fopen(path.data(), "wb");
+        if(!fp) throw std::runtime_error(std::string("Could not open file at '") + path + "' for writing");
+        const bool ok = std::fwrite(data_, 1, nbytes(), fp) == nbytes();
+        std::fclose(fp);
+        if(!ok) throw std::runtime_error(std::string("Failed to write frozen index to ") + path);
+    }
+    const header_t &header() const {return *reinterpret_cast<const header_t *>(data_);}
+    size_t nbytes() const {return header().nbytes;}
+    const uint64_t *regs_per_reg() const {return reinterpret_cast<const uint64_t *>(data_ + sizeof(header_t));}
+    const uint64_t *tables_per_level() const {return regs_per_reg() + header().nlevels;}
+    const table_t &table(size_t i, size_t j) const {
+        return reinterpret_cast<const table_t *>(tables_per_level() + header().nlevels)[level_starts_[i] + j];
+    }
+    const KeyT *keys(const table_t &t) const {return reinterpret_cast<const KeyT *>(data_ + t.keys_offset);}
+    size_t nkeys(size_t i, size_t j) const {return table(i, j).nkeys;}
+    // Calls f(id) for key's IDs in insertion order until f returns false; returns false if stopped.
+    template<typename F>
+    bool visit_at(const table_t &t, size_t k, const F &f) const {
+        const uint32_t *offsets = reinterpret_cast<const uint32_t *>(data_ + t.offsets_offset);
+        const uint8_t *p = data_ + t.ids_offset + offsets[k], *const e = data_ + t.ids_offset + offsets[k + 1];
+        for(int64_t id = 0; p < e;) {
+            id += unzigzag(read_varint(p));
+            if(!f(static_cast<IdT>(id))) return false;
+        }
+        return true;
+    }
+    /*
+     * Finds qkeys[j] in table j0 + j of level i for j in [0, n), writing key indices (or -1 if absent) to pos.
+     * Each stage runs over all tables before the next, prefetching what the next stage reads,
+     * so that the cache misses of different tables overlap.
+     */
+    void locate(size_t i, size_t j0, const KeyT *qkeys, size_t n, int64_t *pos) const {
+        const table_t *tabs = &table(i, j0);
+        for(size_t j = 0; j < n; ++j) {
+            const uint32_t *directory = reinterpret_cast<const uint32_t *>(data_ + tabs[j].dir_offset);
+            __builtin_prefetch(directory + dir_index(qkeys[j], tabs[j].dir_bits));
+        }
+        for(size_t j = 0; j < n; ++j) {
+            const uint32_t *directory = reinterpret_cast<const uint32_t *>(data_ + tabs[j].dir_offset) + dir_index(qkeys[j], tabs[j].dir_bits);
+            pos[j] = (int64_t(directory[0]) << 32) | (directory[1] - directory[0]);
+            __builtin_prefetch(keys(tabs[j]) + directory[0]);
+        }
+        for(size_t j = 0; j < n; ++j) {
+            const size_t start = pos[j] >> 32, nk = pos[j] & 0xFFFFFFFFu;
+            const size_t k = find_sorted(keys(tabs[j]) + start, nk, qkeys[j]);
+            pos[j] = k == nk ? int64_t(-1): int64_t(start + k);
+            if(pos[j] >= 0) __builtin_prefetch(reinterpret_cast<const uint32_t *>(data_ + tabs[j].offsets_offset) + pos[j]);
+        }
+    }
+    // Visits the IDs at key index pos of table j in level i, as found by locate.
+    template<typename F>
+    bool visit_located(size_t i, size_t j, int64_t pos, const F &f) const {
+        return pos < 0 || visit_at(table(i, j), pos, f);
+    }
+    template<typename F>
+    bool visit(size_t i, size_t j, KeyT key, const F &f) const {
+        const table_t &t = table(i, j);
+        const uint32_t *directory = reinterpret_cast<const uint32_t *>(data_ + t.dir_offset);
+        const size_t b = dir_index(key, t.dir_bits), start = directory[b], n = directory[b + 1] - start;
+        const size_t k = find_sorted(keys(t) + start, n, key);
+        return k == n || visit_at(t, start + k, f);
+    }
+    template<typename F>
+    void for_each(size_t i, size_t j, const F &f) const {
+        const table_t &t = table(i, j);
+        std::vector<IdT> ids;
+        for(size_t k = 0; k < t.nkeys; ++k) {
+            ids.clear();
+            visit_at(t, k, [&ids](IdT id) {ids.push_back(id); return true;});
+            f(keys(t)[k], ids);
+        }
+    }
+};
+
+// Fraction of registers two sketches share, which estimates the probability that a one-register key collides.
+// Registers are compared bitwise, using the SIMD kernel for their width.
+struct SharedRegisterFraction {
+    template<typename RegT>
+    double operator()(const RegT *lhs, const RegT *rhs, size_t m) const {
+        using U = std::conditional_t<sizeof(RegT) == 1, uint8_t, std::conditional_t<sizeof(RegT) == 2, uint16_t,
+                  std::conditional_t<sizeof(RegT) == 4, uint32_t, uint64_t>>>;
+        static_assert(sizeof(U) == sizeof(RegT), "Registers must be 1, 2, 4, or 8 bytes");
+        return eq::count_eq(reinterpret_cast<const U *>(lhs), reinterpret_cast<const U *>(rhs), m) / double(m);
+    }
+};
+
+// One row of a contiguous register matrix, indexable like a sketch.
+template<typename RegT>
+struct RegisterRow {
+    const RegT *data_;
+    size_t n_;
+    const RegT &operator[](size_t i) const {return data_[i];}
+    size_t size() const {return n_;}
+    const RegT *begin() const {return data_;}
+    const RegT *end() const {return data_ + n_;}
+};
+
+// Runs func(i) for i in [0, n), handing out indices dynamically to nthreads threads.
+template<typename Func>
+inline void parallel_for(unsigned nthreads, size_t n, const Func &func) {
+    if(nthreads <= 1 || n <= 1) {
+        for(size_t i = 0; i < n; ++i) func(i);
+        return;
+    }
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for(size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < n; func(i));
+    };
+    std::vector<std::thread> threads;
+    for(unsigned t = 1; t < std::min<size_t>(nthreads, n); ++t) threads.emplace_back(worker);
+    worker();
+    for(auto &t: threads) t.join();
+}
+
+} // namespace detail
+
+/*
+ * Candidates for a batch of queries, in compressed sparse row form.
+ * Query q's candidates are ids[indptr[q]:indptr[q + 1]], with counts holding the number of tables each matched,
+ * and items_per_row[rowptr[q]:rowptr[q + 1]] the number of new candidates found at each level probed.
+ * Each query's entries match query_candidates for the same row.
+ */
+template<typename IdT>
+struct BatchCandidates {
+    std::vector<IdT> ids;
+    std::vector<uint32_t> counts;
+    std::vector<size_t> indptr;
+    std::vector<uint32_t> items_per_row;
+    std::vector<size_t> rowptr;
+    size_t size() const {return indptr.empty() ? 0: indptr.size() - 1;}
+};
+
 
 template<typename KeyT=uint64_t, typename IdT=uint32_t>
 struct SetSketchIndex {
@@ -49,13 +592,148 @@ private:
     size_t total_ids_;
     std::vector<std::vector<std::mutex>> mutexes_;
     bool is_bottomk_only_ = false;
+    // Concurrent mode: posting lists live in ctables_ and packed_maps_ only holds empty tables.
+    using PostingTable = detail::PostingTable<KeyT, IdT>;
+    std::unique_ptr<detail::EpochDomain> epoch_;
+    std::vector<std::vector<PostingTable>> ctables_;
+    // Frozen mode: read-only tables, shared between copies.
+    using FrozenTables = detail::FrozenTables<KeyT, IdT>;
+    std::shared_ptr<const FrozenTables> frozen_;
+
+    std::unique_lock<std::mutex> lock_table(size_t i, size_t j) {
+        return mutexes_.size() > i ? std::unique_lock<std::mutex>(mutexes_[i][j]): std::unique_lock<std::mutex>();
+    }
+    detail::EpochDomain::Guard pin() const {
+        return epoch_ ? epoch_->pin(): detail::EpochDomain::Guard();
+    }
+    // Calls f(id) for each ID stored under key in table (i, j) until f returns false.
+    // Returns false if f stopped the iteration.
+    template<typename F>
+    bool visit_ids(size_t i, size_t j, KeyT key, const F &f) const {
+        if(frozen_) return frozen_->visit(i, j, key, f);
+        if(concurrent()) return ctables_[i][j].visit(key, f);
+        auto &map = packed_maps_[i][j];
+        if(auto it = map.find(key); it != map.end())
+            for(const auto id: it->second)
+                if(!f(id)) return false;
+        return true;
+    }
+    // Callers must hold the lock for table (i, j), if the index is locked.
+    void append_id(size_t i, size_t j, KeyT key, IdT id) {
+        if(concurrent()) ctables_[i][j].append(key, id, *epoch_);
+        else packed_maps_[i][j][key].push_back(id);
+    }
+    // Calls f(key, ids) for each key in table (i, j).
+    template<typename F>
+    void for_each_list(size_t i, size_t j, const F &f) const {
+        if(frozen_) frozen_->for_each(i, j, f);
+        else if(concurrent()) ctables_[i][j].for_each(f);
+        else for(const auto &pair: packed_maps_[i][j]) f(pair.first, pair.second);
+    }
+    size_t nkeys(size_t i, size_t j) const {
+        return frozen_ ? frozen_->nkeys(i, j): concurrent() ? ctables_[i][j].size(): packed_maps_[i][j].size();
+    }
+    void check_writable() const {
+        if(frozen_) throw std::runtime_error("A frozen SetSketchIndex is read-only");
+    }
+    void copy_tables(const SetSketchIndex &o) {
+        frozen_ = o.frozen_;
+        ctables_.clear();
+        epoch_.reset();
+        if(!o.concurrent()) return;
+        epoch_.reset(new detail::EpochDomain);
+        ctables_.resize(o.ctables_.size());
+        for(size_t i = 0; i < ctables_.size(); ++i) {
+            ctables_[i].resize(o.ctables_[i].size());
+            for(size_t j = 0; j < ctables_[i].size(); ++j)
+                o.for_each_list(i, j, [&](KeyT key, const std::vector<IdT> &ids) {for(const auto id: ids) append_id(i, j, key, id);});
+        }
+    }
 public:
     using key_type = KeyT;
     using id_type = IdT;
     size_t m() const {return m_;}
-    size_t size() const {return total_ids_;}
+    size_t size() const {return reinterpret_cast<const std::atomic<size_t> *>(&total_ids_)->load(std::memory_order_relaxed);}
     size_t size(size_t total_ids) {return total_ids_ = total_ids;}
     size_t ntables() const {return packed_maps_.size();}
+    bool concurrent() const {return !ctables_.empty();}
+    /*
+     * Switches to concurrent mode, where queries never take locks and may run concurrently with updates.
+     * Posting lists move to append-only per-table structures; writers still serialize on per-table mutexes
+     * unless unlock() has been called. Must not be called concurrently with other operations.
+     */
+    void make_concurrent() {
+        if(concurrent()) return;
+        check_writable();
+        epoch_.reset(new detail::EpochDomain);
+        ctables_.resize(packed_maps_.size());
+        for(size_t i = 0; i < packed_maps_.size(); ++i) {
+            ctables_[i].resize(packed_maps_[i].size());
+            for(size_t j = 0; j < packed_maps_[i].size(); ++j) {
+                for(const auto &pair: packed_maps_[i][j])
+                    for(const auto id: pair.second)
+                        ctables_[i][j].append(pair.first, id, *epoch_);
+                HashMap().swap(packed_maps_[i][j]);
+            }
+        }
+    }
+    bool frozen() const {return static_cast<bool>(frozen_);}
+    /*
+     * Converts the index to a compact read-only form: per table, sorted keys, offsets,
+     * and delta-varint encoded posting lists in one contiguous buffer.
+     * Queries return the same results as before freezing; updates throw.
+     * Must not be called concurrently with other operations.
+     */
+    void freeze() {
+        if(frozen_) return;
+        std::vector<uint64_t> tables_per_level(packed_maps_.size());
+        for(size_t i = 0; i < packed_maps_.size(); ++i) tables_per_level[i] = packed_maps_[i].size();
+        frozen_ = std::make_shared<const FrozenTables>(m_, total_ids_, is_bottomk_only_, regs_per_reg_, tables_per_level,
+            [this](size_t i, size_t j, const auto &f) {for_each_list(i, j, f);});
+        ctables_.clear();
+        epoch_.reset();
+        for(auto &level: packed_maps_)
+            for(auto &map: level) HashMap().swap(map);
+    }
+    // Bytes used by the frozen tables, or 0 if not frozen.
+    size_t frozen_bytes() const {return frozen_ ? frozen_->nbytes(): size_t(0);}
+    // Estimated bytes used by posting lists and their tables, excluding allocator overhead.
+    size_t memory_usage() const {
+        if(frozen_) return frozen_->nbytes();
+        size_t ret = 0;
+        for(size_t i = 0; i < packed_maps_.size(); ++i) {
+            for(size_t j = 0; j < packed_maps_[i].size(); ++j) {
+                if(concurrent()) {
+                    ret += ctables_[i][j].memory_usage();
+                    continue;
+                }
+                const auto &map = packed_maps_[i][j];
+                ret += sizeof(map) + map.bucket_count() * (sizeof(typename HashMap::value_type) + 1);
+                for(const auto &pair: map) ret += pair.second.capacity() * sizeof(IdT);
+            }
+        }
+        return ret;
+    }
+    // Writes the frozen tables in a form which open_frozen maps without parsing.
+    void write_frozen(const std::string &path) const {
+        if(!frozen_) throw std::runtime_error("write_frozen requires a frozen SetSketchIndex");
+        frozen_->write(path);
+    }
+    static SetSketchIndex open_frozen(const std::string &path) {
+        auto tables = std::make_shared<const FrozenTables>(path);
+        const auto &h = tables->header();
+        SetSketchIndex ret;
+        ret.m_ = h.m;
+        ret.total_ids_ = h.total_ids;
+        ret.is_bottomk_only_ = h.bottomk;
+        ret.regs_per_reg_.assign(tables->regs_per_reg(), tables->regs_per_reg() + h.nlevels);
+        ret.packed_maps_.clear();
+        ret.mutexes_.clear();
+        for(size_t i = 0; i < h.nlevels; ++i)
+            ret.packed_maps_.emplace_back(HashV(tables->tables_per_level()[i]));
+        ret.frozen_ = std::move(tables);
+        return ret;
+    }
     template<typename IT, typename Alloc, typename OIT, typename OAlloc>
     SetSketchIndex(size_t m, const std::vector<IT, Alloc> &nperhashes, const std::vector<OIT, OAlloc> &nperrows): m_(m) {
         if(nperhashes.size() != nperrows.size()) throw std::invalid_argument("SetSketchIndex requires nperrows and nperhashes have the same size");
@@ -102,9 +780,11 @@ public:
     }
 
     SetSketchIndex &operator=(const SetSketchIndex &o) {
+        m_ = o.m_;
         total_ids_ = o.total_ids_;
         regs_per_reg_ = o.regs_per_reg_;
         packed_maps_ = o.packed_maps_;
+        copy_tables(o);
         mutexes_.resize(o.mutexes_.size());
         for(size_t i = 0; i < o.mutexes_.size(); ++i) {
             mutexes_[i] = std::vector<std::mutex>(o.mutexes_[i].size());
@@ -114,10 +794,20 @@ public:
     }
     SetSketchIndex(const SetSketchIndex &o) {*this = o;}
     bool operator==(const SetSketchIndex &o) {
-        return total_ids_ == o.total_ids_ &&
-            regs_per_reg_.size() == o.regs_per_reg_.size() &&
-            packed_maps_.size() == o.packed_maps_.size() &&
-            std::equal(packed_maps_.begin(), packed_maps_.end(), o.packed_maps_.begin());
+        if(total_ids_ != o.total_ids_ || regs_per_reg_.size() != o.regs_per_reg_.size() || packed_maps_.size() != o.packed_maps_.size())
+            return false;
+        if(!concurrent() && !o.concurrent() && !frozen_ && !o.frozen_)
+            return std::equal(packed_maps_.begin(), packed_maps_.end(), o.packed_maps_.begin());
+        for(size_t i = 0; i < packed_maps_.size(); ++i) {
+            if(packed_maps_[i].size() != o.packed_maps_[i].size()) return false;
+            for(size_t j = 0; j < packed_maps_[i].size(); ++j) {
+                HashMap lhs, rhs;
+                for_each_list(i, j, [&lhs](KeyT key, const auto &ids) {lhs.emplace(key, std::vector<IdT>(ids.begin(), ids.end()));});
+                o.for_each_list(i, j, [&rhs](KeyT key, const auto &ids) {rhs.emplace(key, std::vector<IdT>(ids.begin(), ids.end()));});
+                if(lhs != rhs) return false;
+            }
+        }
+        return true;
     }
 
     SetSketchIndex &operator=(SetSketchIndex &&o) = default;
@@ -130,9 +820,11 @@ public:
         is_bottomk_only_ = true;
     }
     static SetSketchIndex clone_like(const SetSketchIndex &o) {
-        if(o.is_bottomk_only_)
-            return SetSketchIndex();
         SetSketchIndex res;
+        if(o.is_bottomk_only_) {
+            if(o.concurrent()) res.make_concurrent();
+            return res;
+        }
         res.packed_maps_.resize(o.packed_maps_.size());
         res.regs_per_reg_ = o.regs_per_reg_;
         for(size_t i = 0; i < o.packed_maps_.size(); ++i) {
@@ -142,6 +834,8 @@ public:
         for(size_t i = 0; i < o.mutexes_.size(); ++i)
             res.mutexes_.emplace_back(o.mutexes_[i].size());
         res.is_bottomk_only_ = o.is_bottomk_only_;
+        if(o.concurrent()) res.make_concurrent();
+        res.m_ = o.m_;
         assert(res.is_bottomk_only_ == o.is_bottomk_only_);
         assert(res.mutexes_.size() == o.mutexes_.size() || !std::fprintf(stderr, "mutex sizes: %zu, %zu\n", res.mutexes_.size(), o.mutexes_.size()));
 #ifndef NDEBUG
@@ -157,6 +851,7 @@ public:
     template<typename Sketch>
     std::tuple<std::vector<IdT>, std::vector<uint32_t>, std::vector<uint32_t>>
     update_query(const Sketch &item, size_t maxcand, size_t starting_idx = size_t(-1)) {
+        check_writable();
         if(item.size() < m_) throw std::invalid_argument(std::string("Item has wrong size: ") + std::to_string(item.size()) + ", expected" + std::to_string(m_));
         if(starting_idx == size_t(-1) || starting_idx > regs_per_reg_.size()) starting_idx = regs_per_reg_.size();
         const size_t my_id = std::atomic_fetch_add(reinterpret_cast<std::atomic<size_t> *>(&total_ids_), size_t(1));
@@ -165,39 +860,25 @@ public:
         std::vector<IdT> passing_ids;
         std::vector<uint32_t> items_per_row;
         rset.reserve(maxcand); passing_ids.reserve(maxcand); items_per_row.reserve(starting_idx);
+        auto guard = pin();
         for(size_t i = 0; i < n_subtable_lists; ++i) {
-            auto &subtab = packed_maps_[i];
-            auto &submut = mutexes_[i];
-            std::vector<std::mutex> *mptr = nullptr;
-            if(mutexes_.size() > i) mptr = &mutexes_[i];
-            const size_t nsubs = subtab.size();
+            const size_t nsubs = packed_maps_[i].size();
             for(size_t j = 0; j < nsubs; ++j) {
-                assert(j < subtab.size());
-                auto &table = subtab[j];
                 KeyT myhash = hash_index(item, i, j);
-                std::optional<std::lock_guard<std::mutex>> lock(mptr ? std::optional<std::lock_guard<std::mutex>>((*mptr)[j]): std::optional<std::lock_guard<std::mutex>>());
-                auto it = table.find(myhash);
-                if(it == table.end()) {
-                    table.emplace(myhash, std::vector<IdT>{static_cast<IdT>(my_id)});
-                    //std::fprintf(stderr, "my hash %zu has a new key %zu\n", size_t(myhash), my_id);
-                } else {
-                    //std::fprintf(stderr, "my key %zu has %zu neighbors:", my_id, it->second.size());
-                    for(const auto id: it->second) {
-                        //std::fprintf(stderr, "%u now in use\t", id);
-                        assert(id < total_ids_);
-                        auto rit2 = rset.find(id);
-                        if(rit2 == rset.end()) {
-                            //std::fprintf(stderr, "ID %u is present now with new weight of 1\n");
-                            rset.emplace(id, 1);
-                            passing_ids.push_back(id);
-                        } else {
-                            assert(std::find(passing_ids.begin(), passing_ids.end(), id) != passing_ids.end());
-                            ++rit2->second;
-                            //std::fprintf(stderr, "ID %u has new count of %u\n", id, rit2->second);
-                        }
+                auto lock = lock_table(i, j);
+                visit_ids(i, j, myhash, [&](IdT id) {
+                    assert(id < total_ids_);
+                    auto rit2 = rset.find(id);
+                    if(rit2 == rset.end()) {
+                        rset.emplace(id, 1);
+                        passing_ids.push_back(id);
+                    } else {
+                        assert(std::find(passing_ids.begin(), passing_ids.end(), id) != passing_ids.end());
+                        ++rit2->second;
                     }
-                    it->second.emplace_back(my_id);
-                }
+                    return true;
+                });
+                append_id(i, j, myhash, my_id);
             }
         }
         std::vector<uint32_t> passing_counts;
@@ -210,16 +891,14 @@ public:
     template<typename Sketch>
     std::tuple<std::vector<IdT>, std::vector<uint32_t>, std::vector<uint32_t>> update_query_bottomk(const Sketch &item, size_t maxtoquery=-1) {
         std::fprintf(stderr, "Warning: bottom-k update-query is untested\n");
+        check_writable();
         std::map<IdT, uint32_t> matches;
-        auto &map = packed_maps_.front().front();
         const size_t my_id = std::atomic_fetch_add(reinterpret_cast<std::atomic<size_t> *>(&total_ids_), size_t(1));
+        auto guard = pin();
+        auto lock = lock_table(0, 0);
         for(const auto v: item) {
-            auto it = map.find(v);
-            if(it == map.end()) map.emplace(v, std::vector<IdT>{static_cast<IdT>(my_id)});
-            else {
-                for(const auto v: it->second) ++matches[v];
-                it->second.emplace_back(my_id);
-            }
+            visit_ids(0, 0, v, [&matches](IdT id) {++matches[id]; return true;});
+            append_id(0, 0, v, my_id);
         }
         std::tuple<std::vector<IdT>, std::vector<uint32_t>, std::vector<uint32_t>> ret;
         std::vector<std::pair<IdT, int32_t>> mvec(matches.begin(), matches.end());
@@ -238,20 +917,13 @@ public:
     }
     template<typename Sketch>
     void insert_bottomk(const Sketch &item, size_t my_id) {
-        auto &map = packed_maps_.front().front();
-        std::optional<std::lock_guard<std::mutex>> lock(
-            !mutexes_.empty() && !mutexes_.front().empty()
-            ? std::optional<std::lock_guard<std::mutex>>(mutexes_.front().front())
-            : std::optional<std::lock_guard<std::mutex>>());
-        for(const auto v: item) {
-            auto it = map.find(v);
-            if(it == map.end()) {
-                map.emplace(v, std::vector<IdT>{IdT(my_id)});
-            } else it->second.emplace_back(my_id);
-        }
+        check_writable();
+        auto lock = lock_table(0, 0);
+        for(const auto v: item) append_id(0, 0, v, my_id);
     }
     template<typename Sketch>
     size_t update_mt(const Sketch &item) {
+        check_writable();
         if(item.size() < m_) throw std::invalid_argument(std::string("Item has wrong size: ") + std::to_string(item.size()) + ", expected" + std::to_string(m_));
         const size_t my_id = std::atomic_fetch_add(reinterpret_cast<std::atomic<size_t> *>(&total_ids_), size_t(1));
         if(is_bottomk_only_) {
@@ -260,18 +932,12 @@ public:
         }
         const size_t n_subtable_lists = regs_per_reg_.size();
         for(size_t i = 0; i < n_subtable_lists; ++i) {
-            auto &subtab = packed_maps_[i];
-            std::vector<std::mutex> *mptr = nullptr;
-            if(mutexes_.size() > i) mptr = &mutexes_[i];
-            const size_t nsubs = subtab.size();
+            const size_t nsubs = packed_maps_[i].size();
             OMP_PFOR
             for(size_t j = 0; j < nsubs; ++j) {
                 KeyT myhash = hash_index(item, i, j);
-                auto &subsub = subtab[j];
-                std::optional<std::lock_guard<std::mutex>> lock(mptr ? std::optional<std::lock_guard<std::mutex>>((*mptr)[j]): std::optional<std::lock_guard<std::mutex>>());
-                auto it = subsub.find(myhash);
-                if(it == subsub.end()) subsub.emplace(myhash, std::vector<IdT>{static_cast<IdT>(my_id)});
-                else it->second.push_back(my_id);
+                auto lock = lock_table(i, j);
+                append_id(i, j, myhash, my_id);
             }
         }
         return my_id;
@@ -279,6 +945,7 @@ public:
     static constexpr size_t DEFAULT_ID = size_t(0xFFFFFFFFFFFFFFFF);
     template<typename Sketch>
     size_t update(const Sketch &item, size_t my_id = DEFAULT_ID) {
+        check_writable();
         if(item.size() < m_) throw std::invalid_argument(std::string("Item has wrong size: ") + std::to_string(item.size()) + ", expected" + std::to_string(m_));
         if(my_id == DEFAULT_ID)
             my_id = std::atomic_fetch_add(reinterpret_cast<std::atomic<size_t> *>(&total_ids_), size_t(1));
@@ -288,19 +955,73 @@ public:
         }
         const size_t n_subtable_lists = regs_per_reg_.size();
         for(size_t i = 0; i < n_subtable_lists; ++i) {
-            auto &subtab = packed_maps_[i];
-            std::vector<std::mutex> *mptr = nullptr;
-            if(mutexes_.size() > i) mptr = &mutexes_[i];
-            const size_t nsubs = subtab.size();
+            const size_t nsubs = packed_maps_[i].size();
             for(size_t j = 0; j < nsubs; ++j) {
                 KeyT myhash = hash_index(item, i, j);
-                assert(j < subtab.size());
-                std::optional<std::lock_guard<std::mutex>> lock(mptr ? std::optional<std::lock_guard<std::mutex>>((*mptr)[j]): std::optional<std::lock_guard<std::mutex>>());
-                subtab[j][myhash].push_back(my_id);
+                auto lock = lock_table(i, j);
+                append_id(i, j, myhash, my_id);
             }
         }
         return my_id;
     }
+    /*
+     * Inserts the n rows of regs, a row-major matrix with m() registers per row, as consecutive IDs.
+     * Work is partitioned by table: each thread hashes every row for the tables it owns and appends
+     * them under a single lock acquisition, so threads never contend on a table.
+     * The resulting index matches calling update on each row in order. Returns the first row's ID.
+     */
+    template<typename RegT>
+    size_t insert_batch(const RegT *regs, size_t n, unsigned nthreads=1) {
+        check_writable();
+        if(is_bottomk_only_) throw std::invalid_argument("insert_batch requires a register-based index, not bottom-k");
+        const size_t first_id = std::atomic_fetch_add(reinterpret_cast<std::atomic<size_t> *>(&total_ids_), n);
+        std::vector<std::pair<uint32_t, uint32_t>> tables;
+        for(size_t i = 0; i < packed_maps_.size(); ++i)
+            for(size_t j = 0; j < packed_maps_[i].size(); ++j)
+                tables.emplace_back(i, j);
+        detail::parallel_for(nthreads, tables.size(), [&](size_t t) {
+            const size_t i = tables[t].first, j = tables[t].second;
+            std::vector<KeyT> keys(n);
+            for(size_t r = 0; r < n; ++r) keys[r] = hash_index(regs + r * m_, i, j);
+            auto lock = lock_table(i, j);
+            for(size_t r = 0; r < n; ++r) append_id(i, j, keys[r], first_id + r);
+        });
+        return first_id;
+    }
+    /*
+     * Runs query_candidates on each of the n rows of regs, a row-major matrix with m() registers per row.
+     * Queries are read-only and stop early independently, so work is partitioned by row rather than by table.
+     */
+    template<typename RegT>
+    BatchCandidates<IdT> query_batch(const RegT *regs, size_t n, size_t maxcand, size_t starting_idx = size_t(-1), bool early_stop=true, unsigned nthreads=1) const {
+        static constexpr size_t CHUNK = 64;
+        if(is_bottomk_only_) throw std::invalid_argument("query_batch requires a register-based index, not bottom-k");
+        std::vector<std::tuple<std::vector<IdT>, std::vector<uint32_t>, std::vector<uint32_t>>> res(n);
+        detail::parallel_for(nthreads, (n + CHUNK - 1) / CHUNK, [&](size_t c) {
+            for(size_t r = c * CHUNK, e = std::min(n, r + CHUNK); r < e; ++r)
+                res[r] = query_candidates(detail::RegisterRow<RegT>{regs + r * m_, m_}, maxcand, starting_idx, early_stop);
+        });
+        BatchCandidates<IdT> ret;
+        ret.indptr.resize(n + 1);
+        ret.rowptr.resize(n + 1);
+        ret.indptr[0] = ret.rowptr[0] = 0;
+        for(size_t r = 0; r < n; ++r) {
+            ret.indptr[r + 1] = ret.indptr[r] + std::get<0>(res[r]).size();
+            ret.rowptr[r + 1] = ret.rowptr[r] + std::get<2>(res[r]).size();
+        }
+        ret.ids.resize(ret.indptr[n]);
+        ret.counts.resize(ret.indptr[n]);
+        ret.items_per_row.resize(ret.rowptr[n]);
+        detail::parallel_for(nthreads, (n + CHUNK - 1) / CHUNK, [&](size_t c) {
+            for(size_t r = c * CHUNK, e = std::min(n, r + CHUNK); r < e; ++r) {
+                std::copy(std::get<0>(res[r]).begin(), std::get<0>(res[r]).end(), ret.ids.data() + ret.indptr[r]);
+                std::copy(std::get<1>(res[r]).begin(), std::get<1>(res[r]).end(), ret.counts.data() + ret.indptr[r]);
+                std::copy(std::get<2>(res[r]).begin(), std::get<2>(res[r]).end(), ret.items_per_row.data() + ret.rowptr[r]);
+                res[r] = {};
+            }
+        });
+        return ret;
+    }
     INLINE KeyT hashmem256(const uint64_t *x) const {
         sketch::hash::CEHasher ceh;
         uint64_t v[4];
@@ -390,48 +1111,44 @@ public:
          *  Returns ids matching input minhash sketches, in order from most specific/least sensitive
          *  to least specific/most sensitive
          *  Can be then used, along with sketches, to select nearest neighbors
+         *  In concurrent mode, this takes no locks and may run alongside updates.
          *  */
+        auto guard = pin();
         ska::flat_hash_map<IdT, uint32_t> rset;
         std::vector<IdT> passing_ids;
         std::vector<uint32_t> items_per_row;
         rset.reserve(maxcand); passing_ids.reserve(maxcand); items_per_row.reserve(starting_idx);
+        // Returns false once maxcand IDs have been found, if early_stop is set
+        auto add_id = [&](IdT id) {
+            if(auto rit2 = rset.find(id); rit2 == rset.end()) {
+                rset.emplace(id, 1);
+                passing_ids.push_back(id);
+                if(early_stop && rset.size() == maxcand)
+                    return false;
+            } else ++rit2->second;
+            return true;
+        };
         if(is_bottomk_only_) {
-            auto &m = packed_maps_.front().front();
-            for(size_t j = 0; j < item.size() && rset.size() < maxcand; ++j) {
-                if(auto it = m.find(item[j]); it != m.end()) {
-                    for(const auto id: it->second) {
-                        auto rit2 = rset.find(id);
-                        if(rit2 == rset.end()) {
-                            rset.emplace(id, 1);
-                            passing_ids.push_back(id);
-                            if(early_stop && rset.size() == maxcand)
-                                goto bk_end;
-                        } else ++rit2->second;
-                    }
-                }
-            }
-            bk_end:
+            for(size_t j = 0; j < item.size() && rset.size() < maxcand; ++j)
+                if(!visit_ids(0, 0, item[j], add_id)) break;
             items_per_row.push_back(passing_ids.size());
         } else {
+            static constexpr size_t LOCATE_BLOCK = 16;
+            KeyT hashes[LOCATE_BLOCK];
+            int64_t positions[LOCATE_BLOCK];
             for(std::ptrdiff_t i = starting_idx;--i >= 0 && rset.size() < maxcand;) {
-                auto &m = packed_maps_[i];
-                const size_t nsubs = m.size();
+                const size_t nsubs = packed_maps_[i].size();
                 const size_t items_before = passing_ids.size();
                 for(size_t j = 0; j < nsubs; ++j) {
-                    KeyT myhash = hash_index(item, i, j);
-                    auto it = m[j].find(myhash);
-                    if(it != m[j].end()) {
-                        for(const auto id: it->second) {
-                            //auto rit2 = rset.find(id);
-                            if(auto rit2 = rset.find(id); rit2 == rset.end()) {
-                                rset.emplace(id, 1);
-                                passing_ids.push_back(id);
-                                if(early_stop && rset.size() == maxcand) {
-                                    items_per_row.push_back(passing_ids.size() - items_before);
-                                    goto end;
-                                }
-                            } else ++rit2->second;
-                        }
+                    if(frozen_ && j % LOCATE_BLOCK == 0) {
+                        // Look up a block of the level's keys at once to overlap cache misses
+                        const size_t nb = std::min(LOCATE_BLOCK, nsubs - j);
+                        for(size_t b = 0; b < nb; ++b) hashes[b] = hash_index(item, i, j + b);
+                        frozen_->locate(i, j, hashes, nb, positions);
+                    }
+                    if(!(frozen_ ? frozen_->visit_located(i, j, positions[j % LOCATE_BLOCK], add_id): visit_ids(i, j, hash_index(item, i, j), add_id))) {
+                        items_per_row.push_back(passing_ids.size() - items_before);
+                        goto end;
                     }
                 }
                 items_per_row.push_back(passing_ids.size() - items_before);
@@ -442,6 +1159,65 @@ public:
         std::transform(passing_ids.begin(), passing_ids.end(), passing_counts.begin(), [&rset](auto x) {return rset[x];});
         return std::make_tuple(passing_ids, passing_counts, items_per_row);
     }
+    /*
+     * Returns the k indexed IDs most similar to item, and their scores, by descending score (then ascending ID).
+     * store holds the indexed sketches' registers contiguously, m() per row, row r belonging to ID r.
+     * Tables are walked from most to least specific, re-ranking each table's new candidates with score,
+     * which should estimate the probability that a register matches (the fraction of shared registers by default).
+     * The walk stops once a sketch scoring at least the current k-th best score would have
+     * collided in some probed table with probability at least 1 - miss_prob, or after maxcand candidates.
+     */
+    template<typename Sketch, typename RegT, typename Score=detail::SharedRegisterFraction>
+    std::pair<std::vector<IdT>, std::vector<double>>
+    query_topk(const Sketch &item, size_t k, const RegT *store, double miss_prob=1e-3, size_t maxcand=size_t(-1), const Score &score=Score()) const {
+        if(is_bottomk_only_) throw std::invalid_argument("query_topk requires a register-based index, not bottom-k");
+        auto guard = pin();
+        const RegT *const query = &item[0];
+        const double logmiss_bound = std::log(miss_prob);
+        ska::flat_hash_set<IdT> seen;
+        std::vector<IdT> fresh;
+        std::vector<std::pair<double, IdT>> top; // Heap of the best k (score, ID) pairs, worst on top
+        auto better = [](const auto &x, const auto &y) {return x.first > y.first || (x.first == y.first && x.second < y.second);};
+        std::vector<std::pair<uint64_t, size_t>> probed; // (registers per key, number of tables probed) per level
+        for(size_t i = regs_per_reg_.size(); k && i--;) {
+            const size_t nsubs = packed_maps_[i].size();
+            probed.emplace_back(regs_per_reg_[i], 0);
+            for(size_t j = 0; j < nsubs; ++j) {
+                fresh.clear();
+                visit_ids(i, j, hash_index(item, i, j), [&](IdT id) {
+                    if(seen.insert(id).second) fresh.push_back(id);
+                    return true;
+                });
+                // Re-rank the table's new candidates in one pass over the store
+                for(size_t c = 0; c < fresh.size(); ++c) {
+                    if(c + 4 < fresh.size()) __builtin_prefetch(store + size_t(fresh[c + 4]) * m_);
+                    const std::pair<double, IdT> cand(score(query, store + size_t(fresh[c]) * m_, m_), fresh[c]);
+                    if(top.size() < k) {
+                        top.push_back(cand);
+                        std::push_heap(top.begin(), top.end(), better);
+                    } else if(better(cand, top.front())) {
+                        std::pop_heap(top.begin(), top.end(), better);
+                        top.back() = cand;
+                        std::push_heap(top.begin(), top.end(), better);
+                    }
+                }
+                ++probed.back().second;
+                if(seen.size() >= maxcand) goto done;
+                if(top.size() == k) {
+                    // Log probability that a sketch scoring top.front().first missed every table so far
+                    const double s = top.front().first;
+                    double logmiss = 0.;
+                    for(const auto &p: probed) logmiss += p.second * std::log1p(-std::pow(s, double(p.first)));
+                    if(logmiss <= logmiss_bound) goto done;
+                }
+            }
+        }
+        done:
+        std::sort(top.begin(), top.end(), better);
+        std::pair<std::vector<IdT>, std::vector<double>> ret;
+        for(const auto &p: top) ret.first.push_back(p.second), ret.second.push_back(p.first);
+        return ret;
+    }
     void write(std::string path) const {
         gzFile fp = gzopen(&path[0], "w");
         write(fp);
@@ -461,15 +1237,14 @@ public:
         gzwrite(fp, &islocked, 1);
         for(size_t i = 0; i < packed_maps_.size(); ++i) {
             for(size_t j = 0; j < packed_maps_[i].size(); ++j) {
-                auto &map = packed_maps_[i][j];
-                uint64_t sz = map.size();
+                uint64_t sz = nkeys(i, j);
                 gzwrite(fp, &sz, sizeof(sz));
-                for(auto &pair: map) {
-                    uint64_t psz = pair.second.size();
+                for_each_list(i, j, [fp](const KeyT key, const std::vector<IdT> &ids) {
+                    uint64_t psz = ids.size();
                     gzwrite(fp, &psz, sizeof(psz));
-                    gzwrite(fp, &pair.first, sizeof(pair.first));
-                    gzwrite(fp, pair.second.data(), sizeof(KeyT) * pair.second.size());
-                }
+                    gzwrite(fp, &key, sizeof(key));
+                    gzwrite(fp, ids.data(), sizeof(IdT) * ids.size());
+                });
             }
         }
     }
@@ -507,9 +1282,9 @@ public:
                     KeyT key;
                     gzread(fp, &psz, sizeof(psz));
                     gzread(fp, &key, sizeof(key));
-                    std::vector<KeyT> vals(psz);
-                    gzread(fp, vals.data(), sizeof(KeyT) * vals.size());
-                    map.emplace(key, vals);
+                    std::vector<IdT> vals(psz);
+                    gzread(fp, vals.data(), sizeof(IdT) * vals.size());
+                    map.emplace(key, std::move(vals));
                 }
             }
         }
@@ -523,6 +1298,9 @@ public:
     SetSketchIndex(std::string path): SetSketchIndex(gzopen(path.data(), "r"), true) {}
     void clear() {
         total_ids_ = 0;
+        frozen_.reset();
+        ctables_.clear();
+        epoch_.reset();
         packed_maps_.clear();
         mutexes_.clear();
         regs_per_reg_.clear();
@@ -46,14 +46,44 @@ void update_one(SSI &index, py::array_t<TYPE, FLAGS> &arr) {
     minispan<TYPE> myspan(arr.data(), nc);
     index.update(myspan);
 }
-template<typename SSI, typename TYPE, int FLAGS>
-void update_all(SSI &index, py::array_t<TYPE, FLAGS> &arr) {
-    auto arrinf = arr.request();
-    const py::ssize_t nc = arrinf.shape[1];
-    for(py::ssize_t i = 0; i < arrinf.shape[0]; ++i) {
-        minispan<TYPE> myspan(arr.data(i, 0), nc);
-        index.update(myspan);
+template<typename SSI, typename TYPE>
+void update_all(SSI &index, py::array arr, unsigned nthreads) {
+    py::array_t<TYPE, py::array::forcecast | py::array::c_style> carr(arr);
+    py::gil_scoped_release release;
+    index.insert_batch(carr.data(), carr.shape(0), nthreads);
+}
+
+template<typename SSI, typename TYPE>
+py::dict query_all(const SSI &index, py::array arr, size_t maxcand, size_t startidx, unsigned nthreads) {
+    py::array_t<TYPE, py::array::forcecast | py::array::c_style> carr(arr);
+    sketch::lsh::BatchCandidates<typename SSI::id_type> res;
+    {
+        py::gil_scoped_release release;
+        res = index.query_batch(carr.data(), carr.shape(0), maxcand, startidx, true, nthreads);
     }
+    py::array_t<typename SSI::id_type> ids(res.ids.size());
+    py::array_t<uint32_t> counts(res.counts.size()), items_per_row(res.items_per_row.size());
+    py::array_t<uint64_t> indptr(res.indptr.size()), rowptr(res.rowptr.size());
+    std::copy(res.ids.begin(), res.ids.end(), ids.mutable_data());
+    std::copy(res.counts.begin(), res.counts.end(), counts.mutable_data());
+    std::copy(res.items_per_row.begin(), res.items_per_row.end(), items_per_row.mutable_data());
+    std::copy(res.indptr.begin(), res.indptr.end(), indptr.mutable_data());
+    std::copy(res.rowptr.begin(), res.rowptr.end(), rowptr.mutable_data());
+    return py::dict("ids"_a = ids, "counts"_a = counts, "indptr"_a = indptr, "per_row"_a = items_per_row, "rowptr"_a = rowptr);
+}
+
+template<typename T, typename SSI>
+py::dict query_topk(const SSI &index, py::array item, size_t k, py::array store, double miss_prob, size_t maxcand) {
+    py::array_t<T, py::array::forcecast | py::array::c_style> qarr(item), sarr(store);
+    if(qarr.size() != py::ssize_t(index.m())) throw std::invalid_argument("Wrong dimension");
+    if(sarr.ndim() != 2 || sarr.shape(1) != py::ssize_t(index.m())) throw std::invalid_argument("store must be a 2-D array with m columns");
+    if(size_t(sarr.shape(0)) < index.size()) throw std::invalid_argument("store must have a row for every indexed ID");
+    auto res = index.query_topk(minispan<T>(qarr.data(), qarr.size()), k, sarr.data(), miss_prob, maxcand);
+    py::array_t<typename SSI::id_type> ids(res.first.size());
+    py::array_t<double> scores(res.second.size());
+    std::copy(res.first.begin(), res.first.end(), ids.mutable_data());
+    std::copy(res.second.begin(), res.second.end(), scores.mutable_data());
+    return py::dict("ids"_a = ids, "scores"_a = scores);
 }
 
 template<typename SSI>
@@ -64,7 +94,12 @@ void declare_lsh_table(py::class_<SSI> &cls) {
     .def(py::init<size_t, py::array_t<int64_t, py::array::forcecast>, py::array_t<int64_t, py::array::forcecast>>(), py::arg("m"), py::arg("persig"), py::arg("persigsize"))
     .def("m", &SSI::m)
     .def("size", [](const SSI& index) {return index.size();})
-    .def("add", [](SSI &index, py::object item) {
+    .def("freeze", &SSI::freeze, "Converts the index to a compact read-only layout. Further additions throw.")
+    .def("frozen", &SSI::frozen)
+    .def("memory_usage", &SSI::memory_usage)
+    .def("write_frozen", &SSI::write_frozen, py::arg("path"))
+    .def_static("open_frozen", [](std::string path) {return SSI(SSI::open_frozen(path));}, py::arg("path"))
+    .def("add", [](SSI &index, py::object item, unsigned nthreads) {
         if(py::isinstance<py::array>(item)) {
             auto arr = py::cast<py::array>(item);
             auto inf = arr.request();
@@ -83,24 +118,33 @@ void declare_lsh_table(py::class_<SSI> &cls) {
             } else if(inf.ndim == 2) {
                 if(inf.shape[1] != py::ssize_t(index.m())) throw std::invalid_argument("Wrong dimension on 2-D array");
                 switch(inf.format[0]) {
-                    case 'L': case 'l': {py::array_t<uint64_t, py::array::forcecast> arr64(arr); update_all(index, arr64);} break;
-                    case 'I': case 'i': {py::array_t<uint32_t, py::array::forcecast> arr32(arr); update_all(index, arr32);} break;
-                    case 'H': case 'h': {py::array_t<uint16_t, py::array::forcecast> arr16(arr); update_all(index, arr16);} break;
-                    case 'B': case 'b': {py::array_t<uint8_t, py::array::forcecast> arr8(arr); update_all(index, arr8);} break;
-                    case 'd': {py::array_t<double, py::array::forcecast> arrd(arr); update_all(index, arrd);} break;
-                    case 'f': {py::array_t<float, py::array::forcecast> arrf(arr); update_all(index, arrf);} break;
+                    case 'L': case 'l': update_all<SSI, uint64_t>(index, arr, nthreads); break;
+                    case 'I': case 'i': update_all<SSI, uint32_t>(index, arr, nthreads); break;
+                    case 'H': case 'h': update_all<SSI, uint16_t>(index, arr, nthreads); break;
+                    case 'B': case 'b': update_all<SSI, uint8_t>(index, arr, nthreads); break;
+                    case 'd': update_all<SSI, double>(index, arr, nthreads); break;
+                    case 'f': update_all<SSI, float>(index, arr, nthreads); break;
                     default: throw std::invalid_argument(std::string("Unexpected dtype: ") + inf.format);
                 }
             } else throw std::invalid_argument("Cannot process arrays with > 2 dimensions");
         } else throw std::invalid_argument("Can only add numpy arrays to the sketch");
-    }, py::arg("item"))
-    .def("query", [](SSI &index, py::array arr, py::ssize_t maxcand, py::ssize_t startidx) {
+    }, "Adds a sketch, or each row of a 2-D array of sketches, using nthreads threads for 2-D arrays.", py::arg("item"), py::arg("nthreads") = 1)
+    .def("query", [](SSI &index, py::array arr, py::ssize_t maxcand, py::ssize_t startidx, unsigned nthreads) {
         auto inf = arr.request();
         std::tuple<std::vector<typename SSI::id_type>, std::vector<uint32_t>, std::vector<uint32_t>> ret;
         if(inf.format.size() > 1) throw std::invalid_argument(std::string("Required: simple dtype of one character length. Found: ") + inf.format);
         if(inf.ndim > 2) throw std::invalid_argument("too many (> 2) dimensions");
         else if(inf.ndim == 2) {
-           throw std::invalid_argument("Currently not supported: 2-d queries");
+            if(inf.shape[1] != py::ssize_t(index.m())) throw std::invalid_argument("Wrong dimension on 2-D array");
+            switch(inf.format[0]) {
+                case 'L': case 'l': return query_all<SSI, uint64_t>(index, arr, maxcand, startidx, nthreads);
+                case 'I': case 'i': return query_all<SSI, uint32_t>(index, arr, maxcand, startidx, nthreads);
+                case 'H': case 'h': return query_all<SSI, uint16_t>(index, arr, maxcand, startidx, nthreads);
+                case 'B': case 'b': return query_all<SSI, uint8_t>(index, arr, maxcand, startidx, nthreads);
+                case 'f': return query_all<SSI, float>(index, arr, maxcand, startidx, nthreads);
+                case 'd': return query_all<SSI, double>(index, arr, maxcand, startidx, nthreads);
+                default: throw std::invalid_argument(std::string("Unexpected dtype: ") + inf.format);
+            }
         } else {
             const py::ssize_t nc = inf.size;
             switch(inf.format[0]) {
@@ -124,7 +168,22 @@ void declare_lsh_table(py::class_<SSI> &cls) {
         std::copy(countsref.data(), countsref.data() + countsref.size(), counts.mutable_data());
         std::copy(iprref.data(), iprref.data() + iprref.size(), items_per_row.mutable_data());
         return py::dict("ids"_a = ids, "per_row"_a = items_per_row, "counts"_a = counts);
-    }, py::arg("item"), py::arg("maxcand") = 50, py::arg("start") = py::ssize_t(-1));
+    }, "Queries a sketch, or each row of a 2-D array of sketches with nthreads threads. 2-D results are in CSR form: row i's candidates are ids[indptr[i]:indptr[i + 1]].",
+       py::arg("item"), py::arg("maxcand") = 50, py::arg("start") = py::ssize_t(-1), py::arg("nthreads") = 1)
+    .def("query_topk", [](const SSI &index, py::array item, size_t k, py::array store, double miss_prob, size_t maxcand) {
+        auto inf = store.request();
+        if(inf.format.size() > 1) throw std::invalid_argument(std::string("Required: simple dtype of one character length. Found: ") + inf.format);
+        switch(inf.format[0]) {
+            case 'L': case 'l': return query_topk<uint64_t>(index, item, k, store, miss_prob, maxcand);
+            case 'I': case 'i': return query_topk<uint32_t>(index, item, k, store, miss_prob, maxcand);
+            case 'H': case 'h': return query_topk<uint16_t>(index, item, k, store, miss_prob, maxcand);
+            case 'B': case 'b': return query_topk<uint8_t>(index, item, k, store, miss_prob, maxcand);
+            case 'f': return query_topk<float>(index, item, k, store, miss_prob, maxcand);
+            case 'd': return query_topk<double>(index, item, k, store, miss_prob, maxcand);
+            default: throw std::invalid_argument(std::string("Unexpected dtype: ") + inf.format);
+        }
+    }, "Returns the k IDs with the most registers in common with item, re-ranked against store, a 2-D array with the indexed sketches as rows.",
+       py::arg("item"), py::arg("k"), py::arg("store"), py::arg("miss_prob") = 1e-3, py::arg("maxcand") = size_t(-1));
 }
 
 void init_lsh_table(py::module &m) {
@@ -70,10 +70,14 @@ struct AsymmetricCmpFunc {
     }
 };
 
+struct JIF;
 struct CmpFunc {
     template<typename Func>
     static py::array_t<float> apply(py::list l, const Func &func) {
         py::handle first_item = l[0];
+        CONST_IF(std::is_same<Func, JIF>::value) {
+            if(py::isinstance<hll_t>(first_item)) return apply_hll_jaccard(l);
+        }
         TRY_APPLY(hll_t);
         TRY_APPLY(mh::BBitMinHasher<uint64_t>);
 #ifndef VEC_DISABLED__
@@ -86,6 +90,19 @@ struct CmpFunc {
         throw std::runtime_error("Unsupported type");
         HEDLEY_UNREACHABLE();
     }
+    // HLLs use the blocked all-pairs engine rather than comparing a pair at a time.
+    static py::array_t<float> apply_hll_jaccard(py::list l) {
+        std::vector<const hll_t *> ptrs(l.size(), nullptr);
+        size_t i = 0;
+        for(py::handle ob: l) {
+            auto lp = ob.cast<hll_t *>();
+            if(!lp) throw std::runtime_error("Failed to coerce to HLL");
+            ptrs[i++] = lp;
+        }
+        py::array_t<float> ret(nchoose2(l.size()));
+        hll::jaccard_matrix(ptrs.data(), ptrs.size(), static_cast<float *>(ret.request().ptr), omp_get_max_threads());
+        return ret;
+    }
     template<typename Func, typename Sketch=hll_t>
     static py::array_t<float> apply_sketch(py::list l, const Func &func) {
         std::vector<Sketch *> ptrs(l.size(), nullptr);
@@ -104,7 +121,7 @@ struct CmpFunc {
             for(size_t j = i + 1; j < lsz; ++j) {
                 const size_t access_index = ((i * (lsz * 2 - i - 1)) / 2 + j - (i + 1));
                 float& destination = ptr[access_index];
-                const Sketch& rhr = *ptrs[i];
+                const Sketch& rhr = *ptrs[j];
                 destination = func(lhr, rhr);
             }
         }
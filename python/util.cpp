@@ -2,17 +2,6 @@
 #include "sketch/isz.h"
 #include "xxHash/xxh3.h"
 
-template<typename T>
-struct dumbrange {
-    T beg, e_;
-    dumbrange(T beg, T end): beg(beg), e_(end) {}
-    auto begin() const {return beg;}
-    auto end()   const {return e_;}
-};
-
-template<typename T>
-inline dumbrange<T> make_dumbrange(T beg, T end) {return dumbrange<T>(beg, end);}
-
 inline uint64_t xxhash(py::str x, const uint64_t seed) {
     Py_ssize_t sz;
     const char*const cstr = PyUnicode_AsUTF8AndSize(x.ptr(), &sz);
@@ -81,9 +70,7 @@ PYBIND11_MODULE(sketch_util, m) {
         size_t ret;
 #define PERF_ISZ__(type) \
         if(py::isinstance<py::array_t<type>>(lhs)) { \
-            auto lhrange = make_dumbrange((const type *)lhinfo.ptr, (const type *)lhinfo.ptr + lhinfo.size);\
-            auto rhrange = make_dumbrange((const type *)rhinfo.ptr, (const type *)rhinfo.ptr + rhinfo.size);\
-            ret = sketch::isz::intersection_size(lhrange, rhrange); \
+            ret = sketch::isz::intersection_size((const type *)lhinfo.ptr, lhinfo.size, (const type *)rhinfo.ptr, rhinfo.size); \
             goto end; \
         }
         PERF_ISZ__(uint64_t)
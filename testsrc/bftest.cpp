@@ -20,6 +20,27 @@ int main(int argc, char *argv[]) {
     for(const auto &el: s2) ncfalse += cbf.may_contain(el);
     std::fprintf(stderr, "Error rate: %lf\n", static_cast<double>(nfalse) / nels);
     std::fprintf(stderr, "Counting error rate: %lf\n", static_cast<double>(ncfalse) / nels);
+    {
+        // Batched lookups agree with one-at-a-time lookups.
+        std::vector<uint64_t> q(s1.begin(), s1.end());
+        q.insert(q.end(), s2.begin(), s2.end());
+        q.resize(q.size() - 7); // Leave a partial block
+        std::vector<uint8_t> out(q.size());
+        bf1.may_contain_batch(q.data(), q.size(), out.data());
+        for(size_t i = 0; i < q.size(); ++i) assert(out[i] == bf1.may_contain(q[i]));
+        cbf.may_contain_batch(q.data(), q.size(), out.data());
+        for(size_t i = 0; i < q.size(); ++i) assert(out[i] == cbf.may_contain(q[i]));
+        bf_t bf5(20, 5, 13);
+        for(size_t i = 0; i < q.size(); i += 3) bf5.addh(q[i]);
+        bf5.may_contain_batch(q.data(), q.size(), out.data());
+        for(size_t i = 0; i < q.size(); ++i) assert(out[i] == bf5.may_contain(q[i]));
+        pcbf_t pcbf(4, 20, 3, 137);
+        for(size_t i = 0; i < q.size(); i += 2) pcbf.addh(q[i]), pcbf.addh(q[i / 3]);
+        pcbf.may_contain_batch(q.data(), q.size(), out.data());
+        size_t npresent = 0;
+        for(size_t i = 0; i < q.size(); ++i) assert(out[i] == pcbf.may_contain(q[i])), npresent += out[i];
+        std::fprintf(stderr, "Batched lookups match; %zu/%zu present in all pcbf stages\n", npresent, q.size());
+    }
     uint64_t s1c = 0, s2c = 0, s1f = 0;
     auto bf4(bf1);
     bf4 ^= bf2;
@@ -51,6 +72,28 @@ int main(int argc, char *argv[]) {
             assert(std::find(srs.begin(), srs.end(), i) != srs.end());
     }
     sparsebf_t<uint32_t> sbf(bfl);
+    {
+        // Split-block filter: no false negatives, comparable error, and consistent set estimates.
+        blockedbf_t bbf(25), bbf2(25);
+        for(const auto &el: s1) bbf.addh(el);
+        for(const auto &el: s1) assert(bbf.may_contain(el));
+        size_t nbfalse = 0;
+        for(const auto &el: s2) nbfalse += bbf.may_contain(el), bbf2.addh(el);
+        std::fprintf(stderr, "Blocked error rate: %lf. Estimated: %lf\n", static_cast<double>(nbfalse) / nels, bbf.est_err());
+        assert(nbfalse <= 10 * bbf.est_err() * nels + 10);
+        assert(std::abs(bbf.cardinality_estimate() - nels) < 0.05 * nels);
+        std::vector<uint8_t> bout(s2.size());
+        std::vector<uint64_t> bq(s2.begin(), s2.end());
+        bbf.may_contain_batch(bq.data(), bq.size(), bout.data());
+        for(size_t i = 0; i < bq.size(); ++i) assert(bout[i] == bbf.may_contain(bq[i]));
+        assert(bbf.jaccard_index(bbf) == 1.);
+        assert(bbf.jaccard_index(bbf2) < 0.01);
+        auto bu = bbf + bbf2;
+        for(const auto &el: s2) assert(bu.may_contain(el));
+        assert(std::abs(bu.cardinality_estimate() - 2 * nels) < 0.05 * 2 * nels);
+        assert(std::abs(bbf.union_size(bbf2) - bu.cardinality_estimate()) < 1e-6 * nels);
+        std::fprintf(stderr, "Blocked cardinality: %lf, union: %lf\n", bbf.cardinality_estimate(), bu.cardinality_estimate());
+    }
 #if 0
     sketch::common::for_each_delta_decode(srs, [&bfl](size_t x) {
         assert(bfl.is_set(x));});
@@ -0,0 +1,46 @@
+#include "sketch/build.h"
+
+using namespace sketch;
+
+// Parallel builds with any thread or partition count match the serial build, and remain updatable afterwards.
+template<typename Factory>
+void check(const char *name, const std::vector<uint64_t> &keys, const Factory &factory) {
+    auto serial = factory();
+    for(const auto k: keys) serial.addh(k);
+    for(const unsigned nthreads: {1u, 2u, 3u, 8u}) {
+        for(const size_t nparts: {size_t(0), size_t(1), size_t(5), size_t(64)}) {
+            auto par = build::parallel_build(keys, factory, nthreads, nparts);
+            assert(par == serial);
+        }
+    }
+    auto par = build::parallel_build(keys.data(), keys.data() + keys.size() / 2, factory, 3);
+    for(size_t i = keys.size() / 2; i < keys.size(); ++i) par.addh(keys[i]);
+    assert(par == serial);
+    std::fprintf(stderr, "%s parallel builds match\n", name);
+}
+
+int main(int argc, char **argv) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 200000;
+    std::vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = hash::WangHash::hash(i);
+    check("SetSketch<uint16_t>", keys, []() {return setsketch::SetSketch<uint16_t>(256, 1.001, 30., 65534);});
+    check("SetSketch<uint8_t>", keys, []() {return setsketch::SetSketch<uint8_t>(256, 1.2, 20., 254);});
+    check("CSetSketch<double>", keys, []() {return setsketch::CSetSketch<double>(256);});
+    check("hll_t", keys, []() {return hll::hll_t(12);});
+    check("BBitMinHasher<uint64_t>", keys, []() {return minhash::BBitMinHasher<uint64_t>(10, 32);});
+    {
+        auto css = build::parallel_build(keys, []() {return setsketch::CSetSketch<double>(256);}, 4);
+        assert(css.total_updates() == n);
+    }
+    {
+        std::FILE *fp = std::fopen("buildtest.u64", "wb");
+        std::fwrite(keys.data(), sizeof(uint64_t), keys.size(), fp);
+        std::fclose(fp);
+        auto factory = []() {return setsketch::SetSketch<uint16_t>(256, 1.001, 30., 65534);};
+        assert(build::parallel_build_file("buildtest.u64", factory, 4) == build::parallel_build(keys, factory, 1, 1));
+        std::remove("buildtest.u64");
+        bool threw = false;
+        try {build::parallel_build_file("buildtest.u64", factory);} catch(const std::runtime_error &) {threw = true;}
+        assert(threw);
+    }
+}
@@ -0,0 +1,103 @@
+#include "sketch/collection.h"
+#include <cinttypes>
+
+using namespace sketch;
+
+// Builds n sketches of overlapping sets of size ~card, where neighbours share half their elements.
+template<typename Sketch, typename Factory>
+std::vector<Sketch> make_sketches(size_t n, size_t card, const Factory &f) {
+    std::vector<Sketch> ret;
+    for(size_t i = 0; i < n; ++i) {
+        ret.emplace_back(f());
+        for(size_t j = i * card / 2; j < i * card / 2 + card; ++j) ret.back().addh(uint64_t(j));
+    }
+    return ret;
+}
+
+template<typename Sketch, typename Cmp>
+void check_collection(const std::vector<Sketch> &sketches, const char *path, const Cmp &cmp) {
+    coll::write_collection(path, sketches);
+    coll::collection_t<Sketch> c(path);
+    assert(c.size() == sketches.size());
+    assert(c.header().data_offset % coll::ALIGNMENT == 0 && c.header().stride % coll::ALIGNMENT == 0);
+    for(size_t i = 0; i < c.size(); ++i) {
+        assert((reinterpret_cast<uintptr_t>(c.record(i)) & (coll::ALIGNMENT - 1)) == 0);
+        for(size_t j = 0; j < c.size(); ++j)
+            cmp(sketches[i], sketches[j], c[i], c.at(j));
+    }
+    bool threw = false;
+    try {c.at(c.size());} catch(const std::out_of_range &) {threw = true;}
+    assert(threw);
+    std::remove(path);
+}
+
+int main() {
+    const size_t n = 6, card = 20000;
+    for(const unsigned p: {10u, 14u}) {
+        auto hlls = make_sketches<hll::hll_t>(n, card, [p]() {return hll::hll_t(p);});
+        check_collection(hlls, "colltest.skc", [](auto &x, auto &y, auto vx, auto vy) {
+            assert(vx.cardinality_estimate() == x.creport());
+            assert(vx.union_size(vy) == x.union_size(y));
+            assert(vx.jaccard_index(vy) == x.jaccard_index(y));
+        });
+        auto jhlls = make_sketches<hll::hll_t>(n, card, [p]() {return hll::hll_t(p, hll::ERTL_MLE, hll::ERTL_JOINT_MLE);});
+        check_collection(jhlls, "colltest.skc", [](auto &x, auto &y, auto vx, auto vy) {
+            assert(vx.jaccard_index(vy) == x.jaccard_index(y));
+            assert(vx.full_set_comparison(vy) == hll::ertl_joint(x, y));
+        });
+        // Collections are typed: opening one as another kind must fail.
+        coll::write_collection("colltest.skc", hlls);
+        bool threw = false;
+        try {coll::collection_t<setsketch::CSetSketch<double>> bad("colltest.skc");} catch(const std::runtime_error &) {threw = true;}
+        assert(threw);
+        std::remove("colltest.skc");
+        std::fprintf(stderr, "HLL collection with p = %u passed\n", p);
+    }
+    {
+        auto ss = make_sketches<setsketch::SetSketch<uint16_t>>(n, card, []() {return setsketch::SetSketch<uint16_t>(512, 1.001, 30., 65534);});
+        check_collection(ss, "colltest.skc", [](auto &x, auto &y, auto vx, auto vy) {
+            assert(vx.cardinality_estimate() == x.getcard());
+            assert(vx.shared_registers(vy) == x.shared_registers(y));
+            assert(vx.jaccard_index(vy) == x.jaccard_index(y));
+            assert(vx.jointmle(vy) == x.jointmle(y));
+        });
+        auto css = make_sketches<setsketch::CSetSketch<double>>(n, card, []() {return setsketch::CSetSketch<double>(512);});
+        check_collection(css, "colltest.skc", [](auto &x, auto &y, auto vx, auto vy) {
+            assert(vx.cardinality_estimate() == x.getcard());
+            assert(vx.jaccard_index(vy) == x.jaccard_index(y));
+            assert(vx.union_size(vy) == x.union_size(y));
+            assert(vx.intersection_size(vy) == x.intersection_size(y));
+            assert(vx.containment_index(vy) == x.containment_index(y));
+        });
+        std::fprintf(stderr, "SetSketch collections passed\n");
+    }
+    for(const unsigned b: {8u, 16u, 32u}) {
+        std::vector<minhash::FinalBBitMinHash> fb;
+        for(size_t i = 0; i < n; ++i) {
+            minhash::BBitMinHasher<uint64_t> h(10, b);
+            for(size_t j = i * card / 2; j < i * card / 2 + card; ++j) h.addh(uint64_t(j));
+            fb.emplace_back(h.finalize());
+        }
+        check_collection(fb, "colltest.skc", [](auto &x, auto &y, auto vx, auto vy) {
+            assert(vx.cardinality_estimate() == x.cardinality_estimate());
+            assert(vx.equal_bblocks(vy) == x.equal_bblocks(y));
+            assert(vx.jaccard_index(vy) == x.jaccard_index(y));
+        });
+        std::fprintf(stderr, "b-bit minhash collection with b = %u passed\n", b);
+    }
+#ifndef VEC_DISABLED__
+    for(const unsigned rsize: {8u, 16u}) {
+        std::vector<hmh::hmh_t> hmhs;
+        for(size_t i = 0; i < n; ++i) {
+            hmhs.emplace_back(10, rsize);
+            for(size_t j = i * card / 2; j < i * card / 2 + card; ++j)
+                hmhs.back().add(hash::WangHash::hash(j), hash::WangHash::hash(j ^ 0x9e3779b97f4a7c15ull));
+        }
+        check_collection(hmhs, "colltest.skc", [](auto &x, auto &y, auto vx, auto vy) {
+            assert(vx.cardinality_estimate() == x.cardinality_estimate());
+            assert(vx.jaccard_index(vy) == x.jaccard_index(y));
+        });
+        std::fprintf(stderr, "HyperMinHash collection with rsize = %u passed\n", rsize);
+    }
+#endif
+}
@@ -1,4 +1,121 @@
 #include "dd.h"
+#include <random>
+#include <cassert>
+#include <cstdio>
+#include <cmath>
+
+using namespace sketch;
+
+template<typename FT>
+void test_accuracy(const std::vector<FT> &vals, double alpha, size_t maxbins=2048) {
+    DDSketch<FT> looped(alpha, maxbins), batched(alpha, maxbins);
+    for(const auto v: vals) looped.addh(v);
+    batched.add_batch(vals.data(), vals.size());
+    // add_batch assigns every value the same key as addh
+    assert(looped.count() == batched.count());
+    assert(looped.min() == batched.min() && looped.max() == batched.max());
+    assert(std::abs(looped.sum() - batched.sum()) <= 1e-9 * std::abs(looped.sum()) + 1e-6);
+    assert(looped.zero_count() == batched.zero_count());
+    looped.store().for_each([&](int64_t k, auto c) {assert(batched.store().count_at(k) == c);});
+    looped.negative_store().for_each([&](int64_t k, auto c) {assert(batched.negative_store().count_at(k) == c);});
+    std::vector<FT> sorted(vals);
+    std::sort(sorted.begin(), sorted.end());
+    for(const double q: {0., .001, .01, .1, .25, .5, .75, .9, .99, .999, 1.}) {
+        const double exact = sorted[size_t(q * (sorted.size() - 1))], est = batched.quantile(q);
+        if(std::abs(est - exact) > alpha * 1.000001 * std::abs(exact)) {
+            std::fprintf(stderr, "q %g: estimate %g vs exact %g\n", q, est, exact);
+            std::abort();
+        }
+    }
+}
 
 int main() {
+    std::mt19937_64 mt(1337);
+    std::lognormal_distribution<double> lnd(0., 2.);
+    std::vector<double> dvals(1000003);
+    for(auto &v: dvals) v = lnd(mt);
+    for(size_t i = 0; i < dvals.size(); i += 17) dvals[i] = -dvals[i];
+    for(size_t i = 0; i < dvals.size(); i += 101) dvals[i] = 0.;
+    test_accuracy(dvals, 0.01);
+    test_accuracy(dvals, 0.001, 1 << 14);
+    std::vector<float> fvals(dvals.begin(), dvals.end());
+    test_accuracy(fvals, 0.01);
+
+    // Merging shards gives the same quantiles as one sketch over everything.
+    ddd whole, merged;
+    whole.add_batch(dvals.data(), dvals.size());
+    const size_t nshards = 7, per = dvals.size() / nshards + 1;
+    for(size_t i = 0; i < nshards; ++i) {
+        ddd shard;
+        shard.add_batch(dvals.data() + i * per, std::min(per, dvals.size() - i * per));
+        merged += shard;
+    }
+    assert(merged.count() == whole.count());
+    for(const double q: {.01, .5, .99}) assert(merged.quantile(q) == whole.quantile(q));
+
+    // A small collapsing store holds its size and keeps the upper quantiles accurate.
+    DDSketch<double> small(0.01, 512);
+    small.add_batch(dvals.data(), dvals.size());
+    assert(small.store().size() <= 512);
+    assert(small.store().collapsed());
+    std::vector<double> sorted(dvals);
+    std::sort(sorted.begin(), sorted.end());
+    for(const double q: {.9, .99, .999}) {
+        const double exact = sorted[size_t(q * (sorted.size() - 1))];
+        assert(std::abs(small.quantile(q) - exact) <= 0.01 * 1.000001 * exact);
+    }
+    ddd small_merged(0.01, 512);
+    small_merged += small;
+    small_merged += small;
+    assert(small_merged.store().size() <= 512 && small_merged.count() == 2 * small.count());
+
+    // Batch quantile queries match single queries, in any order.
+    const std::vector<double> qs{.99, 0., .5, .001, 1., .25, .5, .9999, .01, -1., 2.};
+    for(const auto *sk: {&whole, &small}) {
+        const auto batch = sk->quantiles(qs);
+        for(size_t i = 0; i < qs.size(); ++i) assert(batch[i] == sk->quantile(qs[i]));
+    }
+    assert(std::isnan(ddd().quantiles(qs)[0]));
+
+    // Serialization round trips, in memory and through a file.
+    for(const auto *sk: {&whole, &small, &small_merged}) {
+        const auto buf = sk->serialize();
+        size_t nread;
+        const auto back = ddd::deserialize(buf.data(), buf.size(), &nread);
+        assert(nread == buf.size());
+        assert(back.count() == sk->count() && back.zero_count() == sk->zero_count() && back.sum() == sk->sum());
+        assert(back.store().collapsed() == sk->store().collapsed());
+        assert(back.store().count() == sk->store().count() && back.negative_store().count() == sk->negative_store().count());
+        sk->store().for_each([&](int64_t k, auto c) {assert(back.store().count_at(k) == c);});
+        sk->negative_store().for_each([&](int64_t k, auto c) {assert(back.negative_store().count_at(k) == c);});
+        assert(back.quantiles(qs) == sk->quantiles(qs));
+    }
+    const auto empty_buf = ddd().serialize();
+    assert(ddd::deserialize(empty_buf.data(), empty_buf.size()).count() == 0);
+    const auto wbuf = whole.serialize();
+    bool threw = false;
+    try {ddd::deserialize(wbuf.data(), wbuf.size() / 2);} catch(const std::runtime_error &) {threw = true;}
+    assert(threw);
+    whole.write("ddtest.dd.gz");
+    ddd fromfile;
+    fromfile.read("ddtest.dd.gz");
+    std::remove("ddtest.dd.gz");
+    assert(fromfile.count() == whole.count() && fromfile.quantiles(qs) == whole.quantiles(qs));
+
+    // Merging a range of sketches matches merging them one at a time.
+    std::vector<ddd> shards;
+    for(size_t i = 0; i < nshards; ++i) {
+        shards.emplace_back(0.01, 512);
+        shards.back().add_batch(dvals.data() + i * per, std::min(per, dvals.size() - i * per));
+    }
+    ddd seq(0.01, 512), ranged(0.01, 512);
+    for(const auto &s: shards) seq += s;
+    ranged.merge(shards.begin(), shards.end());
+    std::vector<const ddd *> ptrs{&whole, &small};
+    ddd fromptrs;
+    fromptrs.merge(ptrs.begin(), ptrs.end());
+    assert(ranged.count() == seq.count() && fromptrs.count() == whole.count() + small.count());
+    assert(ranged.store().size() <= 512);
+    assert(ranged.quantiles(qs) == seq.quantiles(qs));
+    std::fprintf(stderr, "DDSketch quantiles within relative accuracy; collapsed store uses %zu bins\n", small.store().size());
 }
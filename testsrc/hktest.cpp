@@ -1,6 +1,7 @@
 #include "hk.h"
 #include "heap.h"
 #include <set>
+#include <thread>
 #include <unordered_map>
 
 using namespace sketch::hk;
@@ -12,6 +13,8 @@ unsigned nelem = 500;
 void run_hk_point();
 void run_hkh();
 void run_random();
+void run_blocked();
+void run_concurrent();
 int main(int argc, char *argv[]) {
     if(argc > 1) tbsz = std::atoi(argv[1]);
     if(argc > 2) nh =   std::atoi(argv[2]);
@@ -19,6 +22,8 @@ int main(int argc, char *argv[]) {
     run_hk_point();
     run_random();
     run_hkh();
+    run_blocked();
+    run_concurrent();
 }
 
 namespace std {
@@ -61,6 +66,85 @@ void run_random() {
     }
 }
 
+// Heavy-hitter accuracy of the cache-line-blocked layout against HeavyKeeper with the same number of buckets.
+void run_blocked() {
+    const size_t d = std::max(nelem, 20000u);
+    std::vector<uint64_t> keys(d), vals;
+    std::vector<uint32_t> n(d);
+    wy::WyRand<uint64_t, 2> wy(d);
+    for(auto &k: keys) k = wy();
+    for(size_t i = 0; i < d; ++i) n[i] = std::max(1., 100000. / std::pow(i + 1, 1.1)); // Zipfian counts
+    for(size_t i = 0; i < d; ++i) vals.insert(vals.end(), n[i], keys[i]);
+    std::shuffle(vals.begin(), vals.end(), wy);
+    HeavyKeeper<32,32> hk(tbsz, nh, 1.08);
+    BlockedHeavyKeeper<32,32> bhk(tbsz, nh, 1.08);
+    for(const auto v: vals) hk.addh(v), bhk.addh(v);
+    const size_t ntop = 100;
+    double hkerr = 0, bhkerr = 0;
+    for(size_t i = 0; i < ntop; ++i) {
+        hkerr += std::abs(double(hk.queryh(keys[i])) - n[i]) / n[i];
+        bhkerr += std::abs(double(bhk.queryh(keys[i])) - n[i]) / n[i];
+    }
+    hkerr /= ntop, bhkerr /= ntop;
+    std::fprintf(stderr, "Mean relative error over top %zu keys: HeavyKeeper %g, BlockedHeavyKeeper %g\n", ntop, hkerr, bhkerr);
+    assert(bhkerr <= std::max(2. * hkerr, 0.02));
+    HeavyKeeperHeap<BlockedHeavyKeeper<32,32>, uint64_t> bhkh(20, BlockedHeavyKeeper<32,32>(tbsz, nh, 1.08));
+    for(const auto v: vals) bhkh.addh(v);
+    assert(std::get<0>(bhkh.to_container()).size() == 20);
+}
+
+// Writers on separate shards while a reader takes topk() snapshots; the merged top 20 should match the true top 20.
+void run_concurrent() {
+    const size_t d = 20000;
+    const unsigned nthreads = 4;
+    std::vector<uint64_t> keys(d), vals;
+    std::vector<uint32_t> n(d);
+    wy::WyRand<uint64_t, 2> wy(d + 1);
+    for(auto &k: keys) k = wy();
+    for(size_t i = 0; i < d; ++i) n[i] = std::max(1., 100000. / std::pow(i + 1, 1.1));
+    for(size_t i = 0; i < d; ++i) vals.insert(vals.end(), n[i], keys[i]);
+    std::shuffle(vals.begin(), vals.end(), wy);
+    ConcurrentHeavyKeeperHeap<HeavyKeeper<32,32>, uint64_t> chk(20, HeavyKeeper<32,32>(tbsz, nh, 1.08), nthreads, 1024);
+    std::atomic<bool> done(false);
+    size_t nsnapshots = 0;
+    std::thread reader([&]() {
+        while(!done.load()) {
+            const auto snap = chk.topk();
+            assert(snap.size() <= 20);
+            for(size_t i = 1; i < snap.size(); ++i) assert(snap[i - 1].count >= snap[i].count);
+            ++nsnapshots;
+        }
+    });
+    std::vector<std::thread> writers;
+    const size_t per = (vals.size() + nthreads - 1) / nthreads;
+    for(unsigned t = 0; t < nthreads; ++t) writers.emplace_back([&,t]() {
+        for(size_t i = t * per, e = std::min(vals.size(), i + per); i < e; chk.addh(vals[i++], t));
+    });
+    for(auto &w: writers) w.join();
+    done.store(true);
+    reader.join();
+    chk.publish();
+    const auto top = chk.topk();
+    std::set<uint64_t> truth(keys.begin(), keys.begin() + 20);
+    size_t found = 0;
+    double err = 0;
+    for(const auto &e: top) {
+        if(!truth.count(e.value)) continue;
+        ++found;
+        const size_t i = std::find(keys.begin(), keys.end(), e.value) - keys.begin();
+        err += std::abs(double(e.count) - n[i]) / n[i];
+    }
+    std::fprintf(stderr, "ConcurrentHeavyKeeperHeap: found %zu of the top 20, mean relative error %g, %zu snapshots during ingestion\n", found, err / found, nsnapshots);
+    assert(found >= 18);
+    assert(err / found < 0.1);
+    HeavyKeeperHeap<HeavyKeeper<32,32>, uint64_t> serial(20, HeavyKeeper<32,32>(tbsz, nh, 1.08));
+    for(const auto v: vals) serial.addh(v);
+    found = 0;
+    for(const auto x: std::get<0>(serial.to_container())) found += truth.count(x);
+    std::fprintf(stderr, "HeavyKeeperHeap: found %zu of the top 20\n", found);
+    assert(found >= 12); // Its heap order uses live counts, which drift as buckets decay
+}
+
 void run_hkh() {
     //using hkt = HeavyKeeper<32,32>;
 }
@@ -0,0 +1,41 @@
+#include "hll.h"
+
+using namespace sketch;
+
+// The blocked all-pairs engine must agree with jaccard_index on every pair.
+int main(int argc, char *argv[]) {
+    const size_t nsketches = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 37;
+    for(const auto jestim: {static_cast<hll::JointEstimationMethod>(hll::ERTL_MLE), hll::ERTL_JOINT_MLE}) {
+        for(const unsigned p: {6u, 10u, 13u}) {
+            std::vector<hll::hll_t> sketches;
+            wy::WyHash<uint64_t> gen(p);
+            for(size_t i = 0; i < nsketches; ++i) {
+                sketches.emplace_back(p, hll::ERTL_MLE, jestim);
+                // Overlapping ranges give a spread of similarities.
+                for(size_t j = i * 1000; j < i * 1000 + 20000 + gen() % 20000; ++j) sketches.back().addh(j);
+            }
+            for(auto &s: sketches) s.sum();
+            const auto mat = hll::jaccard_matrix(sketches, 3);
+            assert(mat.size() == nsketches * (nsketches - 1) / 2);
+            size_t k = 0;
+            for(size_t i = 0; i < nsketches; ++i) {
+                for(size_t j = i + 1; j < nsketches; ++j, ++k) {
+                    const float expected = sketches[i].jaccard_index(sketches[j]);
+                    if(std::abs(mat[k] - expected) > 1e-6) {
+                        std::fprintf(stderr, "jestim %d, p %u: (%zu, %zu) %g vs expected %g\n", int(jestim), p, i, j, mat[k], expected);
+                        return EXIT_FAILURE;
+                    }
+                }
+            }
+            const auto row = hll::jaccard_one_vs_many(sketches[3], sketches, 2);
+            for(size_t i = 0; i < nsketches; ++i) {
+                const float expected = sketches[3].jaccard_index(sketches[i]);
+                if(std::abs(row[i] - expected) > 1e-6) {
+                    std::fprintf(stderr, "one vs many, jestim %d, p %u: %zu %g vs expected %g\n", int(jestim), p, i, row[i], expected);
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+    std::fprintf(stderr, "All-pairs comparisons match pairwise comparisons\n");
+}
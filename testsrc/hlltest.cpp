@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <numeric>
 #include <cinttypes>
+#include <thread>
 #include "hll.h"
 #include "mh.h"
 #include "hbb.h"
@@ -95,6 +96,62 @@ int main(int argc, char *argv[]) {
 #endif
             auto mini = t.compress(4);
         }
+        {
+            // Batched insertion must produce exactly the same registers as scalar insertion.
+            std::vector<uint64_t> keys(100003);
+            wy::WyHash<uint64_t> gen(nbits);
+            for(auto &k: keys) k = gen();
+            hll::hll_t scalar(nbits), batch(nbits);
+            hll::hllbase_t<hll::MurFinHash> mscalar(nbits), mbatch(nbits);
+            for(const auto k: keys) scalar.addh(k), mscalar.addh(k);
+            batch.addh_batch(keys.data(), keys.size());
+            mbatch.addh_batch(keys.data(), keys.size());
+            assert(scalar == batch);
+            assert(mscalar == mbatch);
+            if(scalar != batch || mscalar != mbatch) {
+                std::fprintf(stderr, "addh_batch mismatch for nbits = %d\n", nbits);
+                return EXIT_FAILURE;
+            }
+            // Incremental histogram must match a full register scan through insertion, merging and clearing.
+            {
+                hll::hll_t inc(nbits);
+                inc.set_incremental();
+                for(size_t i = 0; i < keys.size() / 2; inc.addh(keys[i++]));
+                inc.addh_batch(keys.data() + keys.size() / 2, keys.size() - keys.size() / 2);
+                assert(inc == scalar);
+                assert(inc.report() == scalar.report());
+                auto other = scalar.compress(nbits - 2);
+                hll::hll_t inc2(nbits - 2);
+                inc2.set_incremental();
+                for(size_t i = 0; i < 1000; inc2.addh(i++));
+                inc2 += other;
+                for(size_t i = 0; i < 1000; other.addh(i++));
+                other.not_ready();
+                assert(inc2.report() == other.report());
+                inc.clear();
+                inc.addh(uint64_t(1337));
+                hll::hll_t one(nbits);
+                one.addh(uint64_t(1337));
+                assert(inc.report() == one.report());
+            }
+            // Sharded concurrent insertion must fold to the serial sketch.
+            for(const uint64_t interval: {uint64_t(0), uint64_t(4096)}) {
+                hll::shardedhll_t sharded(nbits, 3, interval);
+                std::vector<std::thread> threads;
+                for(unsigned tid = 0; tid < 4; ++tid)
+                    threads.emplace_back([&,tid]() {
+                        for(size_t i = tid; i < keys.size(); i += 8) sharded.addh(keys[i], tid);
+                        for(size_t i = tid + 4; i < keys.size(); i += 8) sharded.addh(keys[i]);
+                    });
+                for(auto &t: threads) t.join();
+                assert(sharded.finalize() == scalar);
+                assert(sharded.report() == scalar.report());
+                if(sharded.finalize() != scalar) {
+                    std::fprintf(stderr, "shardedhll_t mismatch for nbits = %d\n", nbits);
+                    return EXIT_FAILURE;
+                }
+            }
+        }
     }
 	return EXIT_SUCCESS;
 }
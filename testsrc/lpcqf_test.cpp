@@ -1,4 +1,6 @@
 #include "sketch/lpcqf.h"
+#include <random>
+#include <unordered_map>
 
 int main() {
     size_t nentered = 132;
@@ -16,4 +18,67 @@ int main() {
         lp_noquot.update(i, i + 1);
         std::fprintf(stderr, "NoQuotientEstimate for %zu: %zu\n", i, size_t(lp_noquot.count_estimate(i)));
     }
+    {
+        // batch_update, with repeats within and across blocks, matches item-at-a-time updates.
+        std::vector<uint64_t> items;
+        std::vector<int32_t> incs;
+        std::mt19937_64 mt(13);
+        for(size_t i = 0; i < 100000; ++i) items.push_back((mt() & 1) ? mt() % 16: mt() % 20000), incs.push_back(mt() % 5 + 1);
+        auto check = [&](auto &&looped, auto &&batched, bool weighted) {
+            for(size_t i = 0; i < items.size(); ++i) weighted ? looped.update(items[i], incs[i]): looped.update(items[i]);
+            weighted ? batched.batch_update(items.data(), items.size(), incs.data()): batched.batch_update(items.data(), items.size());
+            for(uint64_t k = 0; k < 20000; ++k) assert(looped.count_estimate(k) == batched.count_estimate(k));
+        };
+        check(sketch::LPCQF<uint32_t, 8, sketch::IS_POW2>(1 << 16), sketch::LPCQF<uint32_t, 8, sketch::IS_POW2>(1 << 16), true);
+        check(sketch::LPCQF<uint32_t, 8, sketch::IS_POW2>(1 << 16), sketch::LPCQF<uint32_t, 8, sketch::IS_POW2>(1 << 16), false);
+        check(sketch::LPCQF<uint64_t, 16, sketch::IS_QUADRATIC_PROBING>(50000), sketch::LPCQF<uint64_t, 16, sketch::IS_QUADRATIC_PROBING>(50000), true);
+        check(sketch::LPCQF<double, 32, sketch::IS_POW2>(1 << 16), sketch::LPCQF<double, 32, sketch::IS_POW2>(1 << 16), false);
+        std::fprintf(stderr, "batch_update matches update\n");
+    }
+    {
+        // A resizable table grows from 64 slots as it fills, and counts survive incremental migration.
+        sketch::LPCQF<uint64_t, 32, sketch::IS_POW2 | sketch::IS_RESIZABLE> rs(64);
+        std::unordered_map<uint64_t, uint64_t> truth;
+        std::mt19937_64 mt(7);
+        size_t nresizing = 0;
+        for(size_t i = 0; i < 200000; ++i) {
+            const uint64_t k = mt() % 50000, c = mt() % 3 + 1;
+            rs.update(k, c);
+            truth[k] += c;
+            if(rs.resizing() && i % 7 == 0) {
+                assert(rs.count_estimate(k) >= truth[k]);
+                ++nresizing;
+            }
+        }
+        assert(nresizing > 0);
+        assert(rs.size() >= 2 * truth.size());
+        // Keys whose 32-bit fingerprints collide share an entry, so allow a couple of overestimates.
+        size_t nwrong;
+        auto check = [&]() {
+            nwrong = 0;
+            for(const auto &pair: truth) {
+                assert(rs.count_estimate(pair.first) >= pair.second);
+                nwrong += rs.count_estimate(pair.first) != pair.second;
+            }
+            assert(nwrong <= 2);
+        };
+        check();
+        const size_t sz = rs.size();
+        rs.grow();
+        assert(rs.resizing() && rs.size() == 2 * sz);
+        check();
+        rs.finish_resize();
+        assert(!rs.resizing());
+        check();
+        // Approximate counters are carried over unchanged.
+        sketch::LPCQF<uint32_t, 16, sketch::IS_POW2 | sketch::IS_RESIZABLE | sketch::IS_APPROXINC> ars(64);
+        for(size_t i = 0; i < 100000; ++i) ars.update(mt() % 5000);
+        std::vector<long double> before;
+        for(uint64_t k = 0; k < 5000; ++k) before.push_back(ars.count_estimate(k));
+        ars.grow();
+        for(uint64_t k = 0; k < 5000; ++k) assert(ars.count_estimate(k) == before[k]);
+        ars.finish_resize();
+        for(uint64_t k = 0; k < 5000; ++k) assert(ars.count_estimate(k) == before[k]);
+        std::fprintf(stderr, "Resizable LPCQF grew to %zu slots, %zu mismatched counts\n", rs.size(), nwrong);
+    }
 }
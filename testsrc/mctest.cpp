@@ -2,6 +2,7 @@
 //#include "sketch/mh.h"
 #include <unordered_map>
 #include <getopt.h>
+#include <thread>
 
 
 using namespace sketch::cm;
@@ -125,6 +126,68 @@ int main(int argc, char *argv[]) {
     for(const auto k: hset) {
         std::fprintf(stderr, "Count sketch4w %" PRIi64 "\t%s\n", k, std::to_string(size_t(hist4w[k])).data());
     }
+    {
+        // Batched updates and queries match item-at-a-time calls for each update policy and storage type.
+        auto check = [&](auto &&looped, auto &&batched) {
+            for(const auto item: items) looped.addh(item);
+            batched.add_batch(items.data(), items.size());
+            assert(std::equal(looped.ref().begin(), looped.ref().end(), batched.ref().begin()));
+            std::vector<uint64_t> ests(items2.size());
+            batched.est_count_batch(items2.data(), items2.size(), ests.data());
+            for(size_t i = 0; i < items2.size(); ++i) assert(ests[i] == looped.est_count(items2[i]));
+            ests.resize(items.size());
+            batched.est_count_batch(items.data(), items.size(), ests.data());
+            for(size_t i = 0; i < items.size(); ++i) assert(ests[i] == looped.est_count(items[i]) && ests[i] > 0);
+        };
+        items2.insert(items2.end(), items.begin(), items.begin() + items.size() / 2);
+        items.insert(items.end(), items2.begin(), items2.end()); // Repeated items, within and across blocks
+        check(ccm_t(nbits, l2sz, nhashes), ccm_t(nbits, l2sz, nhashes));
+        check(pccm_t(nbits >> 1, l2sz, nhashes, 13), pccm_t(nbits >> 1, l2sz, nhashes, 13));
+        using NonConservative = ccmbase_t<update::Increment, DefaultCompactVectorType, WangHash, false>;
+        check(NonConservative(nbits, l2sz, nhashes), NonConservative(nbits, l2sz, nhashes));
+        check(ccmbase_t<update::Increment, DefaultStaticCompactVectorType<4>>(4, l2sz, nhashes), ccmbase_t<update::Increment, DefaultStaticCompactVectorType<4>>(4, l2sz, nhashes));
+        using CountSketch = ccmbase_t<update::CountSketch, std::vector<int32_t, Allocator<int32_t>>, WangHash, false>;
+        CountSketch csl(32, l2sz, 5), csb(32, l2sz, 5);
+        for(const auto item: items) csl.addh(item);
+        csb.add_batch(items.data(), items.size());
+        assert(csl.ref() == csb.ref());
+        std::vector<uint64_t> ests(items.size());
+        csb.est_count_batch(items.data(), items.size(), ests.data());
+        for(size_t i = 0; i < items.size(); ++i) assert(ests[i] == csl.est_count(items[i]));
+        std::fprintf(stderr, "Batched updates match\n");
+    }
+    {
+        // Concurrent conservative updates under contention: strict updates never undercount and match sequential accuracy;
+        // relaxed updates may lose increments, but only a small fraction of them.
+        using Concurrent = ccmbase_t<update::Increment, std::vector<uint32_t, Allocator<uint32_t>>>;
+        const unsigned nthreads = std::max(4u, std::thread::hardware_concurrency());
+        std::vector<uint64_t> keys(1 << 16);
+        for(auto &k: keys) k = mt();
+        const size_t nper = 8 * keys.size() / nthreads;
+        std::vector<uint64_t> truth(keys.size());
+        std::vector<std::vector<uint32_t>> picks(nthreads, std::vector<uint32_t>(nper));
+        for(auto &p: picks) for(auto &i: p) ++truth[i = (mt() & 1) ? mt() % 64: mt() % keys.size()]; // Half the updates hit 64 hot keys
+        Concurrent strict(32, 12, nhashes), relaxed(32, 12, nhashes), sequential(32, 12, nhashes);
+        std::vector<std::thread> threads;
+        for(unsigned t = 0; t < nthreads; ++t) threads.emplace_back([&,t]() {
+            for(const auto i: picks[t]) strict.add_concurrent(keys[i]), relaxed.add_concurrent_relaxed(keys[i]);
+        });
+        for(auto &th: threads) th.join();
+        for(const auto &p: picks) for(const auto i: p) sequential.addh(keys[i]);
+        double strict_over = 0, seq_over = 0, relaxed_under = 0;
+        for(size_t i = 0; i < keys.size(); ++i) {
+            const uint64_t s = strict.est_count_concurrent(keys[i]), r = relaxed.est_count_concurrent(keys[i]);
+            assert(s >= truth[i] && s == strict.est_count(keys[i]));
+            strict_over += s - truth[i];
+            seq_over += sequential.est_count(keys[i]) - truth[i];
+            relaxed_under += r < truth[i] ? truth[i] - r: 0;
+        }
+        const double total = double(nper) * nthreads;
+        std::fprintf(stderr, "Concurrent CM, %u threads: strict overcount %g, sequential overcount %g, relaxed undercount %g of %g\n",
+                     nthreads, strict_over, seq_over, relaxed_under, total);
+        assert(strict_over <= seq_over * 1.1 + keys.size());
+        assert(relaxed_under <= total * 0.01);
+    }
     KWiseIndependentPolynomialHash<4> hf; // Just to test compilation
     std::fprintf(stderr, "l2 join size needs further debugging, not doing\n");
     double nonmin = cmswithnonminmal.l2est();
@@ -1,5 +1,6 @@
 #include "mh.h"
 #include <random>
+#include <map>
 
 template<typename T>
 int pc(const T &x, const char *s="unspecified") {
@@ -29,7 +30,90 @@ using namespace sketch;
 using namespace common;
 using namespace mh;
 
+// The merge loop FinalRMinHash::jaccard_index used before the SIMD kernel, as a reference.
+template<typename Vec>
+size_t reference_bottom_k(const Vec &a, const Vec &b, size_t k) {
+    size_t shared = 0;
+    for(size_t i = 0, j = 0, nused = 0; nused < k && i < a.size() && j < b.size(); ++nused) {
+        if(a[i] == b[j]) ++shared, ++i, ++j;
+        else if(a[i] < b[j]) ++i;
+        else ++j;
+    }
+    return shared;
+}
+
+template<typename T>
+void test_intersection_kernels() {
+    std::mt19937_64 mt(sizeof(T));
+    for(const size_t n: {0, 1, 7, 64, 100, 1000, 10007}) {
+        for(const double olap: {0., .1, .5, .9, 1.}) {
+            std::set<T> sa, sb;
+            while(sa.size() < n) {
+                const T v = mt();
+                sa.insert(v);
+                if(std::uniform_real_distribution<double>()(mt) < olap) sb.insert(v);
+            }
+            while(sb.size() < n) sb.insert(T(mt()));
+            std::vector<T> a(sa.begin(), sa.end()), b(sb.begin(), sb.end());
+            b.resize(n);
+            std::vector<T> common;
+            std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(common));
+            assert(isz::intersection_size(a.data(), a.size(), b.data(), b.size()) == common.size());
+            assert(isz::intersection_size(a, b) == common.size());
+            for(const size_t k: {n, n / 3, n * 2})
+                assert(isz::bottom_k_intersection_size(a.data(), a.size(), b.data(), b.size(), k) == reference_bottom_k(a, b, k));
+            const std::vector<T> ashort(a.begin(), a.begin() + n / 2);
+            assert(isz::bottom_k_intersection_size(ashort.data(), ashort.size(), b.data(), b.size(), n) == reference_bottom_k(ashort, b, n));
+        }
+    }
+}
+
+// RangeMinHash and CountingRangeMinHash keep the same minimizers (and counts) as a std::set/std::map bottom-k.
+void test_flat_bottom_k() {
+    std::mt19937_64 mt(7);
+    for(const size_t k: {1, 5, 64, 1000}) {
+        for(const size_t n: {size_t(0), k / 2, k, 50 * k + 3}) {
+            RangeMinHash<uint64_t> rm(k);
+            CountingRangeMinHash<uint64_t> crm(k);
+            std::set<uint64_t> ref;
+            std::map<uint64_t, uint32_t> cref;
+            for(size_t i = 0; i < n; ++i) {
+                const uint64_t v = mt() % (20 * k + 1); // Plenty of repeats
+                rm.add(v);
+                crm.add(v);
+                ref.insert(v);
+                ++cref[v];
+            }
+            while(ref.size() > k) ref.erase(std::prev(ref.end()));
+            while(cref.size() > k) cref.erase(std::prev(cref.end()));
+            assert(rm.size() == ref.size() && crm.size() == ref.size());
+            // Iteration runs in Cmp order, as std::set<T, std::greater<T>> would.
+            assert(std::equal(rm.begin(), rm.end(), ref.rbegin(), ref.rend()));
+            assert(ref.empty() || rm.max_element() == *ref.rbegin());
+            auto f = rm.cfinalize();
+            assert(std::equal(f.first.begin(), f.first.end(), ref.begin(), ref.end()));
+            auto cit = cref.rbegin();
+            for(const auto &p: crm) assert(p.first == cit->first && p.second == cit->second), ++cit;
+            if(n) {
+                // FinalCRMinHash pads a partly-filled sketch up to k entries.
+                auto cf = crm.cfinalize();
+                assert(cf.size() == k && std::equal(f.first.begin(), f.first.end(), cf.first.begin()));
+            }
+            // Merging two halves gives the sketch of the whole stream.
+            RangeMinHash<uint64_t> h1(k), h2(k);
+            size_t i = 0;
+            for(const auto v: ref) (i++ & 1 ? h1: h2).add(v);
+            h1 += h2;
+            assert(std::equal(h1.begin(), h1.end(), rm.begin(), rm.end()));
+            if(n) assert(rm.jaccard_index(h1) == 1.);
+        }
+    }
+}
+
 int main(int argc, char *argv[]) {
+    test_flat_bottom_k();
+    test_intersection_kernels<uint64_t>();
+    test_intersection_kernels<uint32_t>();
     KWiseHasherSet<4> zomg(100);
     std::fprintf(stderr, "hv for 133: %zu\n", size_t(zomg(133, 1)));
     size_t nelem = argc == 1 ? 1000000: size_t(std::strtoull(argv[1], nullptr, 10));
@@ -127,6 +211,8 @@ int main(int argc, char *argv[]) {
     std::fprintf(stderr, "m1 is %s-sorted\n", forward_sorted(m1.begin(), m1.end()) ? "forward": "reverse");
     //auto kmf = kmh.finalize();
     assert(ji == m1.jaccard_index(m2));
+    assert(m1.jaccard_index(m2) == double(reference_bottom_k(m1.first, m2.first, m1.size())) / m1.size());
+    assert(f1.set_jaccard_index(f2) == double(reference_bottom_k(f1.first, f2.first, f1.size())) / f1.size());
     std::fprintf(stderr, "jaccard between finalized MH sketches: %lf, card %lf\n", m1.jaccard_index(m2), m1.cardinality_estimate());
     {
         // Part 2: verify merging of final sketches
@@ -0,0 +1,78 @@
+#include "hll.h"
+#include <cinttypes>
+#include <thread>
+
+using namespace sketch;
+
+int main(int argc, char *argv[]) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 200000;
+    // Vector pack/unpack must agree with the scalar layout.
+    {
+        std::vector<uint8_t> regs(4096), unpacked(4096), packed(hll::detail::packed6_nbytes(4096)), spacked(packed.size());
+        wy::WyHash<uint64_t> gen(7);
+        for(auto &r: regs) r = gen() % 64;
+        hll::detail::pack6(regs.data(), packed.data(), regs.size());
+        hll::detail::pack6_scalar(regs.data(), spacked.data(), regs.size());
+        assert(packed == spacked);
+        hll::detail::unpack6(packed.data(), unpacked.data(), regs.size());
+        assert(unpacked == regs);
+        if(packed != spacked || unpacked != regs) return EXIT_FAILURE;
+    }
+    for(const unsigned p: {4u, 6u, 10u, 12u, 16u}) {
+        hll::hll_t h1(p), h2(p);
+        hll::phll_t ph1(p), ph2(p);
+        wy::WyHash<uint64_t> gen(p);
+        for(size_t i = 0; i < n; ++i) {
+            const auto v = gen();
+            h1.addh(v); ph1.addh(v);
+            if(i & 1) h2.addh(v), ph2.addh(v);
+            else {
+                const auto v2 = gen();
+                h2.addh(v2); ph2.addh(v2);
+            }
+        }
+        assert(ph1.core().size() == h1.core().size());
+        assert(ph1.unpack() == h1);
+        assert(ph2.unpack() == h2);
+        assert(hll::phll_t(h1) == ph1);
+        assert(hll::detail::sum_counts(ph1.core()) == hll::detail::sum_counts(h1.core()));
+        assert(ph1.report() == h1.report());
+        assert(ph1.union_size(ph2) == h1.union_size(h2));
+        assert(ph1.jaccard_index(ph2) == h1.jaccard_index(h2));
+        auto pu = ph1 + ph2;
+        auto u = h1;
+        std::transform(h1.core().begin(), h1.core().end(), h2.core().begin(), u.mutable_core().begin(), [](auto x, auto y) {return std::max(x, y);});
+        assert(pu.unpack() == u);
+        for(unsigned np = 2; np <= p; ++np)
+            assert(ph1.compress(np).unpack() == h1.compress(np));
+        const auto mem = ph1.est_memory_usage().second, umem = h1.est_memory_usage().second;
+        std::fprintf(stderr, "p = %u. Estimate %g (unpacked %g). Union: %g. Register bytes: %zu vs %zu\n",
+                     p, ph1.report(), h1.report(), pu.report(), mem, umem);
+        assert(mem * 4 == umem * 3);
+        // Batched insertion
+        hll::phll_t pb(p);
+        std::vector<uint64_t> keys(n);
+        for(auto &k: keys) k = gen();
+        pb.addh_batch(keys.data(), keys.size());
+        hll::hll_t hb(p);
+        for(const auto k: keys) hb.addh(k);
+        assert(pb.unpack() == hb);
+        // Concurrent insertion
+        {
+            hll::phll_t pc(p);
+            std::vector<std::thread> threads;
+            for(size_t t = 0; t < 4; ++t)
+                threads.emplace_back([&,t]() {for(size_t i = t; i < keys.size(); i += 4) pc.addh(keys[i]);});
+            for(auto &t: threads) t.join();
+            assert(pc.unpack() == hb);
+        }
+        // Serialization, packed and from unpacked sketches
+        ph1.write("phlltest.hll.gz");
+        hll::phll_t rph1("phlltest.hll.gz");
+        assert(rph1 == ph1);
+        h1.write("phlltest.hll.gz");
+        hll::phll_t rh1("phlltest.hll.gz");
+        assert(rh1 == ph1);
+        std::remove("phlltest.hll.gz");
+    }
+}
@@ -0,0 +1,166 @@
+#include "sketch/ssi.h"
+#include "sketch/setsketch.h"
+#include <thread>
+
+using namespace sketch;
+
+using Index = SetSketchIndex<uint64_t, uint32_t>;
+
+int main(int argc, char **argv) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 2000;
+    const size_t m = 64, nqueries = 200;
+    // Sketches of sets which overlap their neighbours, so that queries have a range of candidates.
+    std::vector<std::vector<uint16_t>> sketches;
+    for(size_t i = 0; i < n; ++i) {
+        setsketch::SetSketch<uint16_t> ss(m, 1.001, 30., 65534);
+        for(size_t j = i * 50; j < i * 50 + 200; ++j) ss.update(j);
+        sketches.emplace_back(ss.data(), ss.data() + m);
+    }
+    Index serial(m), concurrent(m);
+    concurrent.make_concurrent();
+    assert(concurrent.concurrent() && !serial.concurrent());
+    for(const auto &s: sketches) serial.update(s), concurrent.update(s);
+    auto converted = serial;
+    converted.make_concurrent();
+    assert(converted == serial);
+    assert(concurrent == serial);
+    for(size_t i = 0; i < nqueries; ++i) {
+        const auto &q = sketches[i * (n / nqueries)];
+        const auto expected = serial.query_candidates(q, 50);
+        assert(concurrent.query_candidates(q, 50) == expected);
+        assert(converted.query_candidates(q, 50) == expected);
+        assert(!std::get<0>(expected).empty());
+    }
+    // Frozen CSR layout, in memory and mapped from disk
+    {
+        auto frozen = serial;
+        frozen.freeze();
+        assert(frozen.frozen() && frozen == serial);
+        frozen.write_frozen("ssitest.frz");
+        auto mapped = Index::open_frozen("ssitest.frz");
+        assert(mapped.frozen() && mapped.m() == m && mapped.size() == n);
+        for(size_t i = 0; i < nqueries; ++i) {
+            const auto &q = sketches[i * (n / nqueries) + 1];
+            const auto expected = serial.query_candidates(q, 50);
+            assert(frozen.query_candidates(q, 50) == expected);
+            assert(mapped.query_candidates(q, 50) == expected);
+            assert(mapped.query_candidates(q, 50, -1, false) == serial.query_candidates(q, 50, -1, false));
+        }
+        bool threw = false;
+        try {frozen.update(sketches[0]);} catch(const std::runtime_error &) {threw = true;}
+        assert(threw);
+        std::remove("ssitest.frz");
+        std::fprintf(stderr, "Frozen index: %zu bytes for %zu IDs\n", frozen.frozen_bytes(), n);
+    }
+    for(const size_t nkeys: {0, 1, 3, 7, 8, 9, 33, 1000}) {
+        std::vector<uint64_t> k64(nkeys);
+        std::vector<uint32_t> k32(nkeys);
+        std::vector<uint16_t> k16(nkeys);
+        for(size_t i = 0; i < nkeys; ++i) k64[i] = i * 3 + 1, k32[i] = i * 3 + 1, k16[i] = i * 3 + 1;
+        for(size_t q = 0; q < nkeys * 3 + 3; ++q) {
+            const size_t expected = q % 3 == 1 && q / 3 < nkeys ? q / 3: nkeys;
+            assert(lsh::detail::find_sorted(k64.data(), nkeys, uint64_t(q)) == expected);
+            assert(lsh::detail::find_sorted(k32.data(), nkeys, uint32_t(q)) == expected);
+            assert(lsh::detail::find_sorted(k16.data(), nkeys, uint16_t(q)) == expected);
+        }
+    }
+    // Top-k queries re-ranked against a contiguous store match brute force.
+    {
+        std::vector<uint16_t> store;
+        for(const auto &s: sketches) store.insert(store.end(), s.begin(), s.end());
+        auto frozen = serial;
+        frozen.freeze();
+        const size_t k = 5;
+        for(size_t qi = 0; qi < 50; ++qi) {
+            const auto &q = sketches[qi * (n / 50) + 3];
+            std::vector<double> brute(n);
+            for(size_t i = 0; i < n; ++i) brute[i] = eq::count_eq(q.data(), &store[i * m], m) / double(m);
+            std::sort(brute.begin(), brute.end(), std::greater<>());
+            const auto top = serial.query_topk(q, k, store.data(), 1e-9);
+            assert(top.first.size() == k && top.second.size() == k);
+            assert(top.second[0] == 1.);
+            for(size_t i = 0; i < k; ++i) {
+                assert(top.second[i] == brute[i]);
+                assert(top.second[i] == eq::count_eq(q.data(), &store[top.first[i] * m], m) / double(m));
+            }
+            assert(frozen.query_topk(q, k, store.data(), 1e-9) == top);
+            assert(concurrent.query_topk(q, k, store.data(), 1e-9) == top);
+        }
+    }
+    // Batch insertion and queries over a contiguous register matrix match one-at-a-time calls.
+    {
+        std::vector<uint16_t> store;
+        for(const auto &s: sketches) store.insert(store.end(), s.begin(), s.end());
+        Index batched(m), cbatched(m);
+        cbatched.make_concurrent();
+        assert(batched.insert_batch(store.data(), n / 3, 3) == 0);
+        assert(batched.insert_batch(store.data() + n / 3 * m, n - n / 3, 3) == n / 3);
+        cbatched.insert_batch(store.data(), n, 2);
+        assert(batched == serial && cbatched == serial);
+        auto frozen = serial;
+        frozen.freeze();
+        for(const Index *idx: {&serial, &frozen, &cbatched}) {
+            const auto res = idx->query_batch(store.data(), n, 50, -1, true, 3);
+            assert(res.size() == n && res.indptr.back() == res.ids.size() && res.rowptr.back() == res.items_per_row.size());
+            for(size_t i = 0; i < n; i += 7) {
+                const auto expected = serial.query_candidates(sketches[i], 50);
+                assert(std::equal(res.ids.begin() + res.indptr[i], res.ids.begin() + res.indptr[i + 1], std::get<0>(expected).begin(), std::get<0>(expected).end()));
+                assert(std::equal(res.counts.begin() + res.indptr[i], res.counts.begin() + res.indptr[i + 1], std::get<1>(expected).begin(), std::get<1>(expected).end()));
+                assert(std::equal(res.items_per_row.begin() + res.rowptr[i], res.items_per_row.begin() + res.rowptr[i + 1], std::get<2>(expected).begin(), std::get<2>(expected).end()));
+            }
+        }
+        bool threw = false;
+        try {frozen.insert_batch(store.data(), 1);} catch(const std::runtime_error &) {threw = true;}
+        assert(threw);
+    }
+    // Serialization from concurrent mode
+    concurrent.write("ssitest.ssi.gz");
+    Index read("ssitest.ssi.gz");
+    assert(read == serial);
+    std::remove("ssitest.ssi.gz");
+
+    // Queries concurrent with insertion see only inserted IDs, and the final index matches the serial one.
+    {
+        Index mixed(m);
+        mixed.make_concurrent();
+        for(size_t i = 0; i < n / 2; ++i) mixed.update(sketches[i]);
+        std::atomic<bool> done{false};
+        std::atomic<size_t> nq{0};
+        std::vector<std::thread> readers;
+        for(size_t t = 0; t < 3; ++t) {
+            readers.emplace_back([&,t]() {
+                for(size_t i = t; !done.load(); i = (i + 3) % n) {
+                    const size_t before = mixed.size();
+                    auto res = mixed.query_candidates(sketches[i], 100);
+                    for(const auto id: std::get<0>(res))
+                        if(id >= n) std::abort();
+                    if(i + 1 < before && std::get<0>(res).empty()) std::abort(); // Sketches inserted before the query must match themselves
+                    ++nq;
+                }
+            });
+        }
+        std::thread writer([&]() {
+            for(size_t i = n / 2; i < n; ++i) mixed.update(sketches[i]);
+            done.store(true);
+        });
+        writer.join();
+        for(auto &t: readers) t.join();
+        assert(mixed == serial);
+        for(size_t i = 0; i < nqueries; ++i)
+            assert(mixed.query_candidates(sketches[i], 50) == serial.query_candidates(sketches[i], 50));
+        std::fprintf(stderr, "%zu queries ran concurrently with %zu inserts\n", nq.load(), n - n / 2);
+    }
+    // Bottom-k mode
+    {
+        Index bk, cbk;
+        cbk.make_concurrent();
+        for(size_t i = 0; i < 100; ++i) {
+            std::vector<uint64_t> items(16);
+            for(size_t j = 0; j < items.size(); ++j) items[j] = i * 8 + j;
+            bk.update(items); cbk.update(items);
+        }
+        std::vector<uint64_t> q{8, 9, 10, 400};
+        assert(bk.query_candidates(q, 10) == cbk.query_candidates(q, 10));
+        assert(bk == cbk);
+    }
+}
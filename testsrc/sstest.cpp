@@ -98,4 +98,24 @@ int main(int argc, char **argv) {
     std::fprintf(stderr, "Registers for smallnibbles: Max: %u. min: %u.\n", *std::max_element(nshl.data(), nshl.data() + m), *std::min_element(nshl.data(), nshl.data() + m));
     std::fprintf(stderr, "Registers for bytes: Max: %u. min: %u.\n", *std::max_element(lhb.data(), lhb.data() + m), *std::min_element(lhb.data(), lhb.data() + m));
     std::fprintf(stderr, "Registers for shorts: Max: %u. min: %u.\n", *std::max_element(rhn.data(), rhn.data() + rhn.size()), *std::min_element(rhn.data(), rhn.data() + rhn.size()));
+    {
+        // Batch updates match one-at-a-time updates, including ragged tails and ids arriving in several batches.
+        std::vector<uint64_t> ids(n * 10 + 37);
+        for(size_t i = 0; i < ids.size(); ++i) ids[i] = i * 0x9e3779b97f4a7c15ull;
+        ByteSetS sb1(m), sb2(m);
+        ShortSetS ss1(m, sb, sa), ss2(m, sb, sa);
+        WideShortSetS ws1(m), ws2(m);
+        SType c1(m), c2(m);
+        CSetSketch<long double> lc1(m), lc2(m);
+        for(const auto id: ids) sb1.update(id), ss1.update(id), ws1.update(id), c1.update(id), lc1.update(id);
+        const size_t split = ids.size() / 3;
+        for(const auto range: {std::make_pair(size_t(0), split), std::make_pair(split, ids.size())}) {
+            const uint64_t *p = ids.data() + range.first;
+            const size_t nb = range.second - range.first;
+            sb2.update_batch(p, nb); ss2.update_batch(p, nb); ws2.update_batch(p, nb); c2.update_batch(p, nb); lc2.update_batch(p, nb);
+        }
+        assert(sb1 == sb2 && ss1 == ss2 && ws1 == ws2 && c1 == c2 && lc1 == lc2);
+        assert(c1.total_updates() == c2.total_updates());
+        std::fprintf(stderr, "Batch updates match for %zu ids\n", ids.size());
+    }
 }
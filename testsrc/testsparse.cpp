@@ -21,7 +21,51 @@ public:
     void rename(const char *name) {name_ = name;}
 };
 
+// AdaptiveHLL holds the same registers as a dense HLL built from the same keys, in either representation,
+// and its comparisons match the dense ones whichever representations are mixed.
+void test_adaptive() {
+    const int p = 14;
+    std::vector<AdaptiveHLL<>> ahs;
+    std::vector<hll_t> hs;
+    for(const size_t n: {0, 10, 100, 1000, 3000, 100000}) {
+        AdaptiveHLL<> a(p);
+        hll_t h(p);
+        std::vector<uint64_t> keys(n);
+        for(size_t i = 0; i < n; ++i) keys[i] = i * 7 + n;
+        for(size_t i = 0; i < n / 2; ++i) a.addh(keys[i]), h.addh(keys[i]);
+        a.addh_batch(keys.data() + n / 2, n - n / 2);
+        h.addh_batch(keys.data() + n / 2, n - n / 2);
+        assert(a.to_dense() == h);
+        assert(a.report() == h.report());
+        if(n <= 1000) {
+            assert(a.is_sparse());
+            assert(a.est_memory_usage().second * 4 <= a.m());
+        }
+        a.compact();
+        if(n == 100) assert(a.est_memory_usage().second * 64 <= a.m());
+        if(n == 100000) assert(!a.is_sparse());
+        std::fprintf(stderr, "AdaptiveHLL with %zu keys: %s, %zu heap bytes, estimate %g\n", n, a.is_sparse() ? "sparse": "dense", a.est_memory_usage().second, a.report());
+        ahs.push_back(std::move(a));
+        hs.push_back(std::move(h));
+    }
+    for(size_t i = 1; i < ahs.size(); ++i) {
+        for(size_t j = 1; j < ahs.size(); ++j) {
+            const auto fsc = ahs[i].full_set_comparison(ahs[j]), dfsc = hs[i].full_set_comparison(hs[j]);
+            for(size_t k = 0; k < 3; ++k) assert(std::abs(fsc[k] - dfsc[k]) <= 1e-6 * std::max(1., dfsc[k]));
+            auto u = ahs[i] + ahs[j];
+            assert(u.to_dense() == hs[i] + hs[j]);
+        }
+    }
+    AdaptiveHLL<> merged(p), tiny(p, 0);
+    for(const auto &a: ahs) merged += a;
+    tiny.addh(1);
+    assert(!tiny.is_sparse() || tiny.est_memory_usage().second <= 64);
+    merged.clear();
+    assert(merged.is_sparse() && merged.report() == 0.);
+}
+
 int main() {
+    test_adaptive();
     enum {FIRST_LOOP_N = 150, HLL_SIZE=16};
     for(const auto size: {FIRST_LOOP_N * 1, FIRST_LOOP_N * 2, FIRST_LOOP_N * 512/* FIRST_LOOP_N << 10, FIRST_LOOP_N << 16 */}) {
         hll_t h1(HLL_SIZE), h2(HLL_SIZE);